@@ -1,5 +1,8 @@
 #include "app.h"
 #include "loader.h"
+#include <QtAlgorithms>
+#include <algorithm>
+#include <cmath>
 
 
 static MeshContext meshContext;
@@ -14,15 +17,14 @@ namespace App
 
 void ModelMesh::swallow()
 {
-    VertexIterator vi(*this, meshContext.triangleBuffer, VertexIterator::ITERATE_TRIANGLES, VertexIterator::ACTION_PUSH_POINT);
-    vi.pumpAll();
-
-    VertexIterator vi2(*this, meshContext.normalBuffer, VertexIterator::ITERATE_PER_TRIANGLE, VertexIterator::ACTION_PUSH_NORMAL);
-    vi2.pumpAll();
+    swallow(meshContext.triangleBuffer);
+}
 
-    idprojectionData.clear();
-    VertexIterator vi3(*this, &idprojectionData, Core::VertexIterator::ITERATE_TRIANGLES, Core::VertexIterator::ACTION_PUSH_FACEID);
-    vi3.pumpAll();
+void ModelMesh::swallow(Core::VertexBufferDraft& triangleDraft)
+{
+    VertexIterator vi(*this, triangleDraft, VertexIterator::ITERATE_TRIANGLES, VertexIterator::ACTION_PUSH_POINT_FACEID);
+    vi.setFaceIdOffset(faceIdBase);
+    vi.pumpAll();
 }
 
 
@@ -52,6 +54,87 @@ ModelMesh::ModelMesh()
 
 }
 
+Model::~Model()
+{
+    clear();
+}
+
+void Model::clear()
+{
+    qDeleteAll(parts);
+    parts.clear();
+}
+
+void Model::setParts(const QVector<ModelMesh*>& newParts)
+{
+    clear();
+    parts = newParts;
+}
+
+int Model::faceCount() const
+{
+    int count = 0;
+    for (const ModelMesh* part : parts)
+        count += part->faces.size();
+    return count;
+}
+
+void Model::numberFaces()
+{
+    Core::FaceIndex base = 0;
+    for (ModelMesh* part : parts)
+    {
+        part->faceIdBase = base;
+        base += part->faces.size();
+    }
+}
+
+void Model::mergeMetrics()
+{
+    if (parts.isEmpty())
+    {
+        setBounds(QVector3D(), QVector3D());
+        return;
+    }
+
+    QVector3D minPoint = parts[0]->minPoint;
+    QVector3D maxPoint = parts[0]->maxPoint;
+    for (const ModelMesh* part : parts)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            minPoint[axis] = std::min(minPoint[axis], part->minPoint[axis]);
+            maxPoint[axis] = std::max(maxPoint[axis], part->maxPoint[axis]);
+        }
+    }
+    setBounds(minPoint, maxPoint);
+}
+
+void Model::setBounds(const QVector3D& minPoint, const QVector3D& maxPoint)
+{
+    this->minPoint = minPoint;
+    this->maxPoint = maxPoint;
+    centerPoint = (minPoint + maxPoint)/2;
+    width = maxPoint.x() - minPoint.x();
+    height = maxPoint.y() - minPoint.y();
+    depth = maxPoint.z() - minPoint.z();
+
+    boundingRadius = sqrt(width*width + height*height + depth*depth);
+}
+
+ModelMesh* Model::findFace(unsigned int faceId, Core::FaceIndex& faceIndex) const
+{
+    for (ModelMesh* part : parts)
+    {
+        if (faceId >= part->faceIdBase && faceId - part->faceIdBase < (unsigned int) part->faces.size())
+        {
+            faceIndex = faceId - part->faceIdBase;
+            return part;
+        }
+    }
+    return nullptr;
+}
+
 BasegridMesh::BasegridMesh(int squareCount, float side): squareCount(squareCount), side(side)
 {
     float square_side = side/squareCount;
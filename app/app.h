@@ -17,15 +17,50 @@ class ModelMesh : public Core::Mesh
 {
 
 public:
-    QVector<float> idprojectionData; // face ids to project
     QVector<Core::FaceIndex> uioverlayFaces;
+    Core::FaceIndex faceIdBase = 0; // added to face indices when projecting ids, so that ids are unique among the parts of a Model
 
-    void swallow();
+    void swallow(); // expanded triangles, each point followed by the id of its face, for the picking pass
+    void swallow(Core::VertexBufferDraft& triangleDraft); // same as swallow() but with a draft other than the global MeshContext one
     void swallowUioverlay(Core::VertexBufferDraft& targetDraft);
 
     ModelMesh();
 };
 
+/*!
+ * \brief A loaded model made of one or more parts
+ *
+ * Each solid of the source file becomes a ModelMesh part. Parts keep their relative
+ * placement and share the model transformation. Metrics cover all parts.
+ */
+class Model
+{
+public:
+    QVector<ModelMesh*> parts; // owned by Model
+    QMatrix4x4 modelTrans; // place model in the world
+    // metrics
+    QVector3D minPoint;
+    QVector3D maxPoint;
+    QVector3D centerPoint;
+    float width = 0;
+    float height = 0;
+    float depth = 0;
+    float boundingRadius = 0;
+
+    Model() {}
+    ~Model();
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    void clear(); // removes and deletes all parts
+    void setParts(const QVector<ModelMesh*>& newParts); // replaces parts and takes ownership of the new ones
+    int faceCount() const;
+    void numberFaces(); // sets faceIdBase of the parts so that projected face ids follow each other
+    void mergeMetrics(); // sets metrics from those of the parts. Parts should have their metrics generated.
+    void setBounds(const QVector3D& minPoint, const QVector3D& maxPoint);
+    ModelMesh* findFace(unsigned int faceId, Core::FaceIndex& faceIndex) const; // part with the projected face id or nullptr. faceIndex is set to the index within the part.
+};
+
 class BasegridMesh : public Core::Mesh
 {
     float side;
@@ -49,8 +84,7 @@ class MeshContext
 {
 public:
     Core::VertexBufferDraft wireframeBuffer;
-    Core::VertexBufferDraft triangleBuffer;
-    Core::VertexBufferDraft normalBuffer;
+    Core::VertexBufferDraft triangleBuffer; // 3 points per face, each followed by its face id for the picking pass. Empty when picking doesn't need them.
 
 };
 
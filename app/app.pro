@@ -2,18 +2,28 @@ HEADERS       = glwidget.h \
                 app.h \
                 appwindow.h \
                 loader.h \
+                meshcache.h \
+                modelloader.h \
                 mesh.h \
+                pointrange.h \
+                pointtransform.h \
                 rendering.h \
-                stl_reader.h
+                stl_reader.h \
+                writer.h
 SOURCES       = glwidget.cpp \
                 app.cpp \
                 appwindow.cpp \
                 loader.cpp \
+                meshcache.cpp \
+                modelloader.cpp \
                 main.cpp \
                 mesh.cpp \
-                rendering.cpp
+                pointrange.cpp \
+                pointtransform.cpp \
+                rendering.cpp \
+                writer.cpp
 
-QT           += widgets
+QT           += widgets concurrent
 
 # install
 INSTALLS += target
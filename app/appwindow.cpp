@@ -4,7 +4,10 @@
 
 #include <QDockWidget>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QListWidget>
+#include <QProgressBar>
+#include <QToolButton>
 
 AppWindow::AppWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -20,7 +23,25 @@ AppWindow::AppWindow(QWidget *parent) :
     QObject::connect(ui->actionE_xit, &QAction::triggered, QCoreApplication::instance(), QCoreApplication::quit, Qt::QueuedConnection);
     connect(this, &AppWindow::buttonRebaseClicked, glWidget, &GLWidget::rebaseOnFace);
     connect(this, &AppWindow::newStlFilename, glWidget, &GLWidget::onNewStlFilename);
+    connect(this, &AppWindow::saveStlFilename, glWidget, &GLWidget::onSaveStlFilename);
+    connect(this, &AppWindow::weldToleranceChanged, glWidget, &GLWidget::setWeldTolerance);
     connect(ui->toolButtonResetCamera, &QToolButton::clicked, glWidget, &GLWidget::resetCamera);
+
+    // loading progress lives in the status bar
+    loadingProgressBar = new QProgressBar();
+    loadingProgressBar->setRange(0, 100);
+    loadingProgressBar->setMaximumWidth(200);
+    loadingProgressBar->hide();
+    ui->statusbar->addPermanentWidget(loadingProgressBar);
+    cancelLoadingButton = new QToolButton();
+    cancelLoadingButton->setText(tr("Cancel"));
+    cancelLoadingButton->hide();
+    ui->statusbar->addPermanentWidget(cancelLoadingButton);
+
+    connect(glWidget, &GLWidget::loadingProgress, this, &AppWindow::onLoadingProgress);
+    connect(glWidget, &GLWidget::loadingStopped, this, &AppWindow::onLoadingStopped);
+    connect(glWidget, &GLWidget::statusMessage, [this](QString message) { ui->statusbar->showMessage(message, 5000); });
+    connect(cancelLoadingButton, &QToolButton::clicked, glWidget, &GLWidget::cancelLoading);
 }
 
 AppWindow::~AppWindow()
@@ -42,9 +63,50 @@ void AppWindow::on_action_Open_triggered()
 
 }
 
+void AppWindow::on_action_Save_triggered()
+{
+    const QString binaryFilter = tr("Binary STL (*.stl)");
+    const QString asciiFilter = tr("ASCII STL (*.stl)");
+    QString selectedFilter = binaryFilter;
+    QString fileName = QFileDialog::getSaveFileName(this,
+        tr("Save STL file"), QString(), binaryFilter + ";;" + asciiFilter, &selectedFilter);
+
+    if (!fileName.isNull())
+        emit saveStlFilename(fileName, selectedFilter == asciiFilter);
+}
+
+void AppWindow::on_action_WeldTolerance_triggered()
+{
+    bool ok = false;
+    double tolerance = QInputDialog::getDouble(this, tr("Weld tolerance"),
+        tr("Weld corners closer than this when loading.\n0 welds corners with equal coordinates only."),
+        weldTolerance, 0, 1000, 6, &ok);
+
+    if (ok) {
+        weldTolerance = tolerance;
+        emit weldToleranceChanged(tolerance);
+        ui->statusbar->showMessage(tr("Weld tolerance %1 applies to files opened from now on").arg(tolerance), 5000);
+    }
+}
+
 
 void AppWindow::on_toolButtonRebase_clicked()
 {
     emit buttonRebaseClicked();
 }
 
+void AppWindow::onLoadingProgress(int percent, QString stage)
+{
+    loadingProgressBar->setValue(percent);
+    loadingProgressBar->show();
+    cancelLoadingButton->show();
+    ui->statusbar->showMessage(stage);
+}
+
+void AppWindow::onLoadingStopped(QString message)
+{
+    loadingProgressBar->hide();
+    cancelLoadingButton->hide();
+    ui->statusbar->showMessage(message, 5000);
+}
+
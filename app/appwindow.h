@@ -3,6 +3,9 @@
 
 #include <QMainWindow>
 
+QT_FORWARD_DECLARE_CLASS(QProgressBar)
+QT_FORWARD_DECLARE_CLASS(QToolButton)
+
 namespace Ui {
 class AppWindow;
 }
@@ -19,15 +22,25 @@ public slots:
 
 private slots:
     void on_action_Open_triggered();
+    void on_action_Save_triggered();
+    void on_action_WeldTolerance_triggered();
 
     void on_toolButtonRebase_clicked();
 
+    void onLoadingProgress(int percent, QString stage);
+    void onLoadingStopped(QString message);
+
 signals:
     void newStlFilename(QString filename);
+    void saveStlFilename(QString filename, bool ascii);
+    void weldToleranceChanged(double tolerance);
     void buttonRebaseClicked();
 
 private:
     Ui::AppWindow *ui;
+    QProgressBar* loadingProgressBar;
+    QToolButton* cancelLoadingButton;
+    double weldTolerance = 0;
 };
 
 #endif // APPWINDOW_H
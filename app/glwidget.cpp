@@ -51,18 +51,104 @@
 #include "glwidget.h"
 #include <QMouseEvent>
 #include <QOpenGLShaderProgram>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
 #include <QCoreApplication>
 #include <math.h>
-#include "loader.h"
+#include <cstring>
+#include <vector>
 
 #include <QDebug>
 
 
 using Core::Mesh;
 
+static_assert(sizeof(QVector3D) == 3*sizeof(float), "points are uploaded as packed floats");
+static_assert(sizeof(Core::Triangle) == 3*sizeof(Core::PointIndex), "faces are uploaded as packed indices");
+
+static bool compactVertices = false;
+static const int COMPACT_POINT_SIZE = 4 * sizeof(quint16); // x, y, z and padding to keep points 4-byte aligned
+
+void GLWidget::setCompactVertices(bool compact)
+{
+    compactVertices = compact;
+}
+
+// Stores each point as 16-bit fractions of the box at origin with the given extent
+static void quantizePoints(const QVector<QVector3D>& points, const QVector3D& origin, const QVector3D& extent, quint16* out)
+{
+    Core::forRanges(points.size(), [&points, &origin, &extent, out](int first, int last) {
+        for (int point_i = first; point_i < last; point_i++)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                const float fraction = qBound(0.0f, (points[point_i][axis] - origin[axis]) / extent[axis], 1.0f);
+                out[4 * point_i + axis] = quint16(fraction * 65535.0f + 0.5f);
+            }
+            out[4 * point_i + 3] = 0;
+        }
+    });
+}
+
+// Model shading. The flat normal of a face is worked out from how the eye space
+// position changes across the screen, so no normals need to be uploaded.
+static const char* modelVShader =
+    "attribute vec4 vertex;\n"
+    "varying vec3 vert;\n"
+    "uniform mat4 mvpMatrix;\n"
+    "uniform mat4 mvMatrix;\n"
+    "void main() {\n"
+    "   vert = (mvMatrix * vertex).xyz;\n"
+    "   gl_Position = mvpMatrix * vertex;\n"
+    "}\n";
+static const char* modelFShader =
+    "varying highp vec3 vert;\n"
+    "void main() {\n"
+    "   highp vec3 vertNormal = normalize(cross(dFdx(vert), dFdy(vert)));\n"
+    "   highp vec3 lightDir = vec3(0.0, 0.0, -1.0);\n"
+    "   highp float intensity =  dot(-lightDir, vertNormal);\n"
+    "   gl_FragColor = vec4(0.5, 0.5, 0.5, 1)*intensity;\n"
+    "}\n";
+// Unshaded model, for GLES contexts without derivatives
+static const char* modelPlainFShader =
+    "void main() {\n"
+    "   gl_FragColor = vec4(0.5, 0.5, 0.5, 1);\n"
+    "}\n";
+
+// Plain colored lines
+static const char* overlayVShader =
+    "attribute vec4 vertex;\n"
+    "uniform mat4 mvpMatrix;\n"
+    "void main() {\n"
+    "  gl_Position = mvpMatrix * vertex;\n"
+    "}\n";
+static const char* overlayFShader =
+    "uniform vec4 color;\n"
+    "void main(){\n"
+    "   gl_FragColor = color;\n"
+    "}\n";
+
+// Face ids straight from the primitive number, which needs GLSL 1.50. Faces of all parts are
+// drawn in one go in the order of Model::numberFaces(), so the primitive number is the face id.
+// Written as integers to idTarget, so there's no limit to the 24 bits of an RGB color.
+static const char* idPrimitiveVShader =
+    "#version 150\n"
+    "in vec4 vertex;\n"
+    "uniform mat4 mvpMatrix;\n"
+    "void main() {\n"
+    "   gl_Position = mvpMatrix * vertex;\n"
+    "}\n";
+static const char* idPrimitiveFShader =
+    "#version 150\n"
+    "out uint faceId;\n"
+    "void main() {\n"
+    "   faceId = uint(gl_PrimitiveID) + 1u; // 0 is left for the background\n"
+    "}\n";
+
 
 GLWidget::GLWidget(QWidget *parent)
-    : QOpenGLWidget(parent)
+    : QOpenGLWidget(parent),
+      iboFaces(QOpenGLBuffer::IndexBuffer)
 {
     m_core = QSurfaceFormat::defaultFormat().profile() == QSurfaceFormat::CoreProfile;
 
@@ -72,17 +158,31 @@ GLWidget::GLWidget(QWidget *parent)
     setFocusPolicy(Qt::StrongFocus);
     setMouseTracking(true);
 
-    modelMesh = new ModelMesh();
+    model = new Model();
     boundingRadius = 10;
     basegridMesh = new BasegridMesh(20, boundingRadius);
     resetCamera();
+
+    modelLoader = new ModelLoader();
+    modelLoader->moveToThread(&loaderThread);
+    connect(&loaderThread, &QThread::finished, modelLoader, &QObject::deleteLater);
+    connect(modelLoader, &ModelLoader::progress, this, &GLWidget::onLoaderProgress);
+    connect(modelLoader, &ModelLoader::previewReady, this, &GLWidget::onModelPreview);
+    connect(modelLoader, &ModelLoader::finished, this, &GLWidget::onModelLoaded);
+    connect(modelLoader, &ModelLoader::failed, this, &GLWidget::onLoadFailed);
+    connect(modelLoader, &ModelLoader::saved, this, &GLWidget::onModelSaved);
+    connect(modelLoader, &ModelLoader::saveFailed, this, &GLWidget::onSaveFailed);
+    loaderThread.start();
 }
 
 GLWidget::~GLWidget()
 {
+    modelLoader->cancel();
+    loaderThread.quit();
+    loaderThread.wait();
     cleanup();
     delete camera;
-    delete modelMesh;
+    delete model;
     delete basegridMesh;
 }
 
@@ -167,9 +267,23 @@ void GLWidget::cleanup()
         makeCurrent();
 
         vboPoints.destroy();
-        vboFaceid.destroy();
+        vboPreview.destroy();
+        vboModelPoints.destroy();
+        iboFaces.destroy();
         renderState_idProjection.cleanup();
-        renderState_model.cleanup();
+        renderState_idPrimitive.cleanup();
+        renderState_preview.cleanup();
+        renderState_modelIndexed.cleanup();
+        renderState_modelTriangles.cleanup();
+        renderState_hover.cleanup();
+        idTarget.destroy();
+        for (HoverReadback& readback : hoverReadbacks)
+        {
+            if (readback.fence)
+                context()->extraFunctions()->glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+            readback.pbo.destroy();
+        }
 
         doneCurrent();
     }
@@ -179,12 +293,11 @@ void adjacentFaces(Core::Mesh& mesh, QVector<Core::FaceIndex>& inner_faces, QVec
 {
     for (int inner_i = 0; inner_i < inner_faces.size(); inner_i++)
     {
-        QVector<Core::FaceIndex>& adjacent_faces = mesh.faceFaces[inner_faces[inner_i]];
-        for (int adj_i=0; adj_i<adjacent_faces.size(); adj_i++)
+        for (Core::FaceIndex adjacent_face : mesh.faceFaces()[inner_faces[inner_i]])
         {
-            if (!out_faces.contains(adjacent_faces[adj_i]))
+            if (!out_faces.contains(adjacent_face))
             {
-                out_faces.append(adjacent_faces[adj_i]);
+                out_faces.append(adjacent_face);
             }
         }
     }
@@ -193,21 +306,23 @@ void adjacentFaces(Core::Mesh& mesh, QVector<Core::FaceIndex>& inner_faces, QVec
 /// Rebuild face set that constitutes the overlay. Does not push to buffer draft.
 bool GLWidget::updateUiOverlay()
 {
-    MeshContext& meshContext = App::getMeshContext();
-
-    if (!selectedFaces.empty())
+    for (ModelMesh* part : model->parts)
     {
-        //qDebug() << "selected faces: " << selectedFaces.size();
-        modelMesh->uioverlayFaces.clear();
-        modelMesh->uioverlayFaces.append(selectedFaces);
+        part->uioverlayFaces.clear();
+    }
 
-        return true;
-    } else
+    // selected face ids are unique among parts. Hand each one to its part.
+    for (int selected_i = 0; selected_i < selectedFaces.size(); selected_i++)
     {
-        modelMesh->uioverlayFaces.clear();
+        Core::FaceIndex faceIndex;
+        ModelMesh* part = model->findFace(selectedFaces[selected_i], faceIndex);
+        if (part)
+        {
+            part->uioverlayFaces.append(faceIndex);
+        }
     }
 
-    return false;
+    return !selectedFaces.empty();
 }
 
 void GLWidget::initializeGL()
@@ -217,52 +332,77 @@ void GLWidget::initializeGL()
     connect(context(), &QOpenGLContext::aboutToBeDestroyed, this, &GLWidget::cleanup);
     meshContext.triangleBuffer.clear();
     meshContext.wireframeBuffer.clear();
-    meshContext.normalBuffer.clear();
-
-    // generate secondary source data
-    modelMesh->chew(Core::Mesh::CHEW_GRAPH );
-    modelMesh->swallow();
 
     initializeOpenGLFunctions();
 
-    // buffer with model vertices
+    // buffer with triangle vertices and face ids
     vboPoints.create();
-    // and normals
-    vboNormals.create();
-    // buffer with face ids
-    vboFaceid.create();
+    // unwelded triangles of a model being loaded
+    vboPreview.create();
+    // model points and the faces that index them
+    vboModelPoints.create();
+    iboFaces.create();
 
     uiOverlayVbo.create();
     uiOverlayVbo.bind();
     uiOverlayVbo.release();
 
-    // main scene model
-    renderState_model.setVShader(
-        "attribute vec4 vertex;\n"
-        "attribute vec3 normal;\n"
-        "varying vec3 vert;\n"
-        "varying vec3 vertNormal;\n"
-        "uniform mat4 mvpMatrix;\n"
-        "uniform mat3 normalMatrix;\n"
-        "void main() {\n"
-        "   vert = vertex.xyz;\n"
-        "   vertNormal = normalMatrix * normal;\n"
-        "   gl_Position = mvpMatrix * vertex;\n"
-        "}\n");
-    renderState_model.setFShader(
-        "varying highp vec3 vert;\n"
-        "varying highp vec3 vertNormal;\n"
-        "void main() {\n"
-        "   highp vec3 lightDir = vec3(0.0, 0.0, -1.0);\n"
-        "   highp float intensity =  dot(-lightDir, vertNormal);\n"
-        "   gl_FragColor = vec4(0.5, 0.5, 0.5, 1)*intensity;\n"
-        "}\n");
-    renderState_model.addAttribute("vertex",vboPoints);
-    renderState_model.addAttribute("normal",vboNormals);
-    renderState_model.setupProgram();
-    renderState_model.setupVao();
-
-    // id projection
+    // dFdx() and dFdy() of the model shading are an extension to the GLSL of GLES
+    const auto glVersion = context()->format().version();
+    QByteArray modelFShaderSource(modelFShader);
+    if (context()->isOpenGLES())
+    {
+        if (context()->hasExtension("GL_OES_standard_derivatives"))
+        {
+            modelFShaderSource.prepend("#extension GL_OES_standard_derivatives : enable\n");
+        } else
+        {
+            qWarning() << "no GL_OES_standard_derivatives, the model is drawn unshaded";
+            modelFShaderSource = modelPlainFShader;
+        }
+    }
+    // 32 bit indices for iboFaces are an extension on GLES2
+    uintIndices = !context()->isOpenGLES() || glVersion >= qMakePair(3, 0) || context()->hasExtension("GL_OES_element_index_uint");
+
+    // main scene model, from expanded triangles while previewing and indexed afterwards
+    renderState_preview.setVShader(modelVShader);
+    renderState_preview.setFShader(modelFShaderSource.constData());
+    renderState_preview.addAttribute("vertex",vboPreview);
+    renderState_preview.setupProgram();
+    renderState_preview.setupVao();
+
+    auto addModelPoints = [this](RenderState& state) {
+        if (compactVertices)
+            state.addAttribute("vertex", vboModelPoints, 3, GL_UNSIGNED_SHORT, true, COMPACT_POINT_SIZE, 0);
+        else
+            state.addAttribute("vertex",vboModelPoints);
+        state.setIndexBuffer(iboFaces);
+    };
+    renderState_modelIndexed.setVShader(modelVShader);
+    renderState_modelIndexed.setFShader(modelFShaderSource.constData());
+    addModelPoints(renderState_modelIndexed);
+    renderState_modelIndexed.setupProgram();
+    renderState_modelIndexed.setupVao();
+    if (!renderState_modelIndexed.program->isLinked())
+        qWarning() << "model shader failed to link:" << renderState_modelIndexed.program->log();
+
+    // id projection from the indexed faces, if the context has gl_PrimitiveID
+    if (!context()->isOpenGLES() && context()->format().version() >= qMakePair(3, 2))
+    {
+        renderState_idPrimitive.setVShader(idPrimitiveVShader);
+        renderState_idPrimitive.setFShader(idPrimitiveFShader);
+        addModelPoints(renderState_idPrimitive);
+        renderState_idPrimitive.setupProgram();
+        primitiveIdPicking = renderState_idPrimitive.program->isLinked();
+        if (primitiveIdPicking)
+            renderState_idPrimitive.setupVao();
+    }
+    modelLoader->setFaceIdVertices(!primitiveIdPicking);
+    qInfo() << "picking faces by" << (primitiveIdPicking ? "primitive number" : "face id vertices");
+    if (!uintIndices)
+        qWarning() << "no GL_OES_element_index_uint, the model is drawn from its face id vertices";
+
+    // id projection from face ids stored along with the points
     renderState_idProjection.setVShader(
         "attribute vec4 vertex;\n"
         "attribute vec3 faceid;\n"
@@ -280,28 +420,46 @@ void GLWidget::initializeGL()
         //"gl_FragColor = vec4(1.0, 0.0, 0.0, 1.0);\n"
         "}\n"
     );
-    renderState_idProjection.addAttribute("vertex", vboPoints);
-    renderState_idProjection.addAttribute("faceid", vboFaceid);
+    const int idVertexSize = 6 * sizeof(GLfloat); // point and face id, interleaved
+    renderState_idProjection.addAttribute("vertex", vboPoints, 3, GL_FLOAT, false, idVertexSize, 0);
+    renderState_idProjection.addAttribute("faceid", vboPoints, 3, GL_FLOAT, false, idVertexSize, 3 * sizeof(GLfloat));
     renderState_idProjection.setupProgram();
     renderState_idProjection.setupVao();
 
+    // main scene model from the triangles of vboPoints, when iboFaces can't be drawn. That is only
+    // on GLES2, where there's no primitiveIdPicking and so vboPoints always holds the triangles.
+    renderState_modelTriangles.setVShader(modelVShader);
+    renderState_modelTriangles.setFShader(modelFShaderSource.constData());
+    renderState_modelTriangles.addAttribute("vertex", vboPoints, 3, GL_FLOAT, false, idVertexSize, 0);
+    renderState_modelTriangles.setupProgram();
+    renderState_modelTriangles.setupVao();
+
     // ui overlay
-    renderState_uiOverlay.setVShader(
-        "attribute vec4 vertex;\n"
-        "uniform mat4 mvpMatrix;\n"
-        "void main() {\n"
-        "  gl_Position = mvpMatrix * vertex;\n"
-        "}\n"
-    );
-    renderState_uiOverlay.setFShader(
-        "uniform vec4 color;\n"
-        "void main(){\n"
-        "   gl_FragColor = color;\n"
-        "}\n"
-    );
+    renderState_uiOverlay.setVShader(overlayVShader);
+    renderState_uiOverlay.setFShader(overlayFShader);
     renderState_uiOverlay.addAttribute("vertex",uiOverlayVbo);
     renderState_uiOverlay.setupProgram();
     renderState_uiOverlay.setupVao();
+
+    renderState_hover.setVShader(overlayVShader);
+    renderState_hover.setFShader(overlayFShader);
+    addModelPoints(renderState_hover);
+    renderState_hover.setupProgram();
+    renderState_hover.setupVao();
+
+    // hover picking, where readbacks can be fenced
+    hoverPicking = context()->isOpenGLES() ? glVersion >= qMakePair(3, 0) : glVersion >= qMakePair(3, 2);
+    if (hoverPicking)
+    {
+        for (HoverReadback& readback : hoverReadbacks)
+        {
+            readback.pbo.create();
+            readback.pbo.setUsagePattern(QOpenGLBuffer::StreamRead);
+            readback.pbo.bind();
+            readback.pbo.allocate(4); // one RGBA pixel
+            readback.pbo.release();
+        }
+    }
 }
 
 
@@ -309,56 +467,61 @@ void GLWidget::paintGL()
 {
     MeshContext& meshContext = App::getMeshContext();
 
+    // hover picking goes first, so that a face read back by now is outlined in this frame
+    bool hoverInFlight = false;
+    if (hoverPicking)
+    {
+        hoverInFlight = collectHoverPicks();
+        if (hoverPending)
+        {
+            startHoverPick();
+            hoverInFlight = true;
+        }
+    }
+
+    glClearColor(0.2, 0.2, 0.2, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glLineWidth(1);
 
-    // view transformation (camera)
-    camera->setZoom((float)zoomLevel * Config::wheelDegreesToZUnits);
-    camera->setRot(-m_xRot/16.0f, -m_yRot/16.0f, -m_zRot/16.0f);
-
     // camera & world
-    QMatrix4x4 vTrans = camera->getTrans();
-    vTrans.translate(0,-modelMesh->height/2,0);
+    QMatrix4x4 vTrans = viewTrans();
     QMatrix4x4 pvTrans = pTrans * vTrans; // used all over the place
 
-    // render triangle ids to image
-    renderState_idProjection.vao.bind();
-    renderState_idProjection.program->bind();
-    renderState_idProjection.program->setUniformValue(0, pvTrans * modelMesh->modelTrans);
-    fbo->bind();
-    glDisable(GL_BLEND);
-    glClearColor(0.0, 0.0, 0.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glDrawArrays(GL_TRIANGLES, 0, modelMesh->idprojectionData.size()/3);
-    snapshotImage = fbo->toImage();
-    fbo->release();
-    renderState_idProjection.vao.release();
-
-    // Render model
-    QMatrix4x4 vmTrans = vTrans * modelMesh->modelTrans;
-    QMatrix3x3 normalTrans3 = vmTrans.toGenericMatrix<3,3>();
-
-    glClearColor(0.2, 0.2, 0.2, 1.0);
-    renderState_model.vao.bind();
-    renderState_model.program->bind();
-    int loc = renderState_model.program->uniformLocation("mvpMatrix");
-    renderState_model.program->setUniformValue(loc, pvTrans * modelMesh->modelTrans);
-    loc = renderState_model.program->uniformLocation("normalMatrix");
-    renderState_model.program->setUniformValue(loc, normalTrans3);
-    glDrawArrays(GL_TRIANGLES, 0, meshContext.triangleBuffer.getData().size()/3); // 3 floats per point
-    renderState_model.program->release();
-    renderState_model.vao.release();
+    // Render model, or the preview of the one being loaded
+    const bool previewing = previewVertexCount > 0;
+    RenderState& modelState = previewing ? renderState_preview : uintIndices ? renderState_modelIndexed : renderState_modelTriangles;
+    QMatrix4x4 mTrans = previewing ? previewTrans : model->modelTrans;
+    if (!previewing && uintIndices)
+        mTrans *= modelPointsTrans;
+    modelState.vao.bind();
+    modelState.program->bind();
+    int loc = modelState.program->uniformLocation("mvpMatrix");
+    modelState.program->setUniformValue(loc, pvTrans * mTrans);
+    loc = modelState.program->uniformLocation("mvMatrix");
+    modelState.program->setUniformValue(loc, vTrans * mTrans);
+    if (previewing)
+        glDrawArrays(GL_TRIANGLES, 0, previewVertexCount);
+    else if (!uintIndices)
+        glDrawArrays(GL_TRIANGLES, 0, faceidVertexCount);
+    else if (modelIndexCount > 0)
+        glDrawElements(GL_TRIANGLES, modelIndexCount, GL_UNSIGNED_INT, nullptr);
+    modelState.program->release();
+    modelState.vao.release();
 
     glEnable(GL_BLEND);
     glClearColor(0.2, 0.2, 0.2, 1.0);
 
     // process wireframe data
-    if (updateUiOverlay()) // update set of faces according to UI state
+    if (!previewing && updateUiOverlay()) // update set of faces according to UI state. The selection is on the model, which isn't shown.
     {
-        modelMesh->swallowUioverlay(meshContext.wireframeBuffer); // populate meshModel.uioverlayData
+        for (ModelMesh* part : model->parts)
+        {
+            if (!part->uioverlayFaces.isEmpty())
+                part->swallowUioverlay(meshContext.wireframeBuffer); // populate meshModel.uioverlayData
+        }
     }
     basegridMesh->swallow(meshContext.wireframeBuffer);
 
@@ -384,19 +547,221 @@ void GLWidget::paintGL()
 
     glLineWidth(3);
     glClear(GL_DEPTH_BUFFER_BIT);
-    renderState_uiOverlay.program->setUniformValue(renderState_uiOverlay.program->uniformLocation("mvpMatrix"), pvTrans * modelMesh->modelTrans);
+    renderState_uiOverlay.program->setUniformValue(renderState_uiOverlay.program->uniformLocation("mvpMatrix"), pvTrans * model->modelTrans);
     QColor selectionColor(Qt::green); selectionColor.setAlpha(200);
     renderState_uiOverlay.program->setUniformValue(renderState_uiOverlay.program->uniformLocation("color"), selectionColor);
-    meshinfo = meshContext.wireframeBuffer.getMeshInfo(modelMesh);
-    if (meshinfo)
+    for (ModelMesh* part : model->parts)
     {
-        glDrawArrays(GL_LINES, meshinfo->offset/3, meshinfo->size/3);
+        meshinfo = meshContext.wireframeBuffer.getMeshInfo(part);
+        if (meshinfo)
+        {
+            glDrawArrays(GL_LINES, meshinfo->offset/3, meshinfo->size/3);
+        }
     }
 
     renderState_uiOverlay.program->release();
     renderState_uiOverlay.vao.release();
 
+    // outline of the face under the cursor. Face ids follow the order of iboFaces.
+    if (!previewing && hoveredFace != NO_FACE && hoveredFace < Core::FaceIndex(modelIndexCount / 3))
+    {
+        renderState_hover.vao.bind();
+        renderState_hover.program->bind();
+        renderState_hover.program->setUniformValue(renderState_hover.program->uniformLocation("mvpMatrix"), pvTrans * model->modelTrans * modelPointsTrans);
+        QColor hoverColor(Qt::yellow); hoverColor.setAlpha(200);
+        renderState_hover.program->setUniformValue(renderState_hover.program->uniformLocation("color"), hoverColor);
+        glDrawElements(GL_LINE_LOOP, 3, GL_UNSIGNED_INT, reinterpret_cast<const void*>(qintptr(hoveredFace) * sizeof(Core::Triangle)));
+        renderState_hover.program->release();
+        renderState_hover.vao.release();
+    }
+
     meshContext.wireframeBuffer.clear();
+
+    if (hoverPending || hoverInFlight)
+        update(); // come back for the readbacks
+}
+
+QMatrix4x4 GLWidget::viewTrans()
+{
+    camera->setZoom((float)zoomLevel * Config::wheelDegreesToZUnits);
+    camera->setRot(-m_xRot/16.0f, -m_yRot/16.0f, -m_zRot/16.0f);
+
+    QMatrix4x4 vTrans = camera->getTrans();
+    const float height = (previewVertexCount > 0) ? previewHeight : model->height;
+    vTrans.translate(0,-height/2,0);
+    return vTrans;
+}
+
+/// Size of the id pass target in pixels. Empty if there's none.
+QSize GLWidget::idTargetSize() const
+{
+    if (primitiveIdPicking)
+        return idTarget.size();
+    return fbo ? fbo->size() : QSize();
+}
+
+/// Draw face ids into the pixels of region of the id target (rows counted from the bottom). Leaves the target bound so that region can be read back.
+void GLWidget::renderIdPass(const QRect& region)
+{
+    RenderState& idState = primitiveIdPicking ? renderState_idPrimitive : renderState_idProjection;
+    QMatrix4x4 idTrans = pTrans * viewTrans() * model->modelTrans;
+    if (primitiveIdPicking)
+    {
+        idTrans *= modelPointsTrans;
+        idTarget.bind();
+    } else
+    {
+        fbo->bind();
+    }
+    const QSize targetSize = idTargetSize();
+    glViewport(0, 0, targetSize.width(), targetSize.height());
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(region.x(), region.y(), region.width(), region.height());
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    if (primitiveIdPicking)
+    {
+        const GLuint background[4] = {0, 0, 0, 0};
+        context()->extraFunctions()->glClearBufferuiv(GL_COLOR, 0, background); // glClear() leaves integer buffers undefined
+        glClear(GL_DEPTH_BUFFER_BIT);
+    } else
+    {
+        glClearColor(0.0, 0.0, 0.0, 1.0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    idState.vao.bind();
+    idState.program->bind();
+    idState.program->setUniformValue(idState.program->uniformLocation("mvpMatrix"), idTrans);
+    if (primitiveIdPicking)
+        glDrawElements(GL_TRIANGLES, modelIndexCount, GL_UNSIGNED_INT, nullptr);
+    else
+        glDrawArrays(GL_TRIANGLES, 0, faceidVertexCount);
+    idState.program->release();
+    idState.vao.release();
+    glDisable(GL_SCISSOR_TEST);
+}
+
+/// Read the id target pixel at x, row into 4 bytes at pixel, or into the bound pixel pack buffer if pixel is null
+void GLWidget::readIdPixel(int x, int row, void* pixel)
+{
+    if (primitiveIdPicking)
+        glReadPixels(x, row, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, pixel);
+    else
+        glReadPixels(x, row, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+}
+
+/// Face id held by a pixel read with readIdPixel(). NO_FACE for the background.
+Core::FaceIndex GLWidget::idPixelFace(const void* pixel) const
+{
+    if (primitiveIdPicking)
+    {
+        GLuint value;
+        memcpy(&value, pixel, sizeof(value));
+        return (value == 0) ? NO_FACE : Core::FaceIndex(value - 1); // 0 is the background
+    }
+
+    const uchar* rgba = static_cast<const uchar*>(pixel);
+    QVector3D faceidVector(rgba[0], rgba[1], rgba[2]);
+    const Core::FaceIndex faceid = Core::unhideIntFromVector3D(faceidVector);
+    return (faceid == 0) ? NO_FACE : faceid; // face 0 looks like the background here
+}
+
+/// Id of the face at widget position x, y. NO_FACE if there's none. Renders the id pass for that pixel alone and reads it back.
+Core::FaceIndex GLWidget::pickFace(int x, int y)
+{
+    const QSize targetSize = idTargetSize();
+    if (previewVertexCount > 0 || x < 0 || y < 0 || x >= targetSize.width() || y >= targetSize.height())
+        return NO_FACE; // the preview has no faces to pick
+
+    makeCurrent();
+    const int row = targetSize.height() - 1 - y; // widget rows go down, framebuffer rows go up
+    renderIdPass(QRect(x, row, 1, 1));
+    uchar pixel[4];
+    readIdPixel(x, row, pixel);
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    doneCurrent();
+
+    return idPixelFace(pixel);
+}
+
+/// Render the id pass for the pixel at hoverPos and start reading it back into the next pixel pack buffer of the ring. Doesn't wait for the result.
+void GLWidget::startHoverPick()
+{
+    HoverReadback& readback = hoverReadbacks[hoverNext];
+    if (readback.fence)
+        return; // all buffers are in flight. Stays pending until one is collected.
+
+    hoverPending = false;
+    const int x = hoverPos.x();
+    const int y = hoverPos.y();
+    const QSize targetSize = idTargetSize();
+    if (modelIndexCount == 0 || previewVertexCount > 0 || x < 0 || y < 0 || x >= targetSize.width() || y >= targetSize.height())
+    {
+        hoveredFace = NO_FACE;
+        return;
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const int row = targetSize.height() - 1 - y;
+    renderIdPass(QRect(x, row, 1, 1));
+    readback.pbo.bind();
+    readIdPixel(x, row, nullptr); // into the buffer, so this returns right away
+    readback.pbo.release();
+    readback.fence = context()->extraFunctions()->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    hoverNext = (hoverNext + 1) % HOVER_READBACKS;
+}
+
+/// Take the face ids of the readbacks that are done by now, oldest first. Returns whether any are still in flight.
+bool GLWidget::collectHoverPicks()
+{
+    QOpenGLExtraFunctions* f = context()->extraFunctions();
+    for (int slot_i = 0; slot_i < HOVER_READBACKS; slot_i++)
+    {
+        HoverReadback& readback = hoverReadbacks[(hoverNext + slot_i) % HOVER_READBACKS];
+        if (!readback.fence)
+            continue;
+
+        const GLenum status = f->glClientWaitSync(readback.fence, 0, 0); // poll only
+        if (status == GL_TIMEOUT_EXPIRED)
+            return true; // the ones after it were issued later and can't be done either
+        f->glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+        if (status == GL_WAIT_FAILED)
+            continue;
+
+        readback.pbo.bind();
+        const void* pixel = readback.pbo.mapRange(0, 4, QOpenGLBuffer::RangeRead);
+        if (pixel)
+        {
+            hoveredFace = idPixelFace(pixel);
+            readback.pbo.unmap();
+        }
+        readback.pbo.release();
+    }
+    return false;
+}
+
+/// Pick with face id vertices into fbo from now on, when the integer id target can't be had. Expects the context to be current.
+void GLWidget::pickByFaceIdVertices()
+{
+    qWarning() << "can't render to an integer id target, picking faces by face id vertices";
+    primitiveIdPicking = false;
+    idTarget.destroy();
+    modelLoader->setFaceIdVertices(true); // loads in flight are covered by uploadModel()
+
+    // the model shown has no face id vertices yet
+    buildFaceIdVertices();
+    const QVector<float>& vertices = App::getMeshContext().triangleBuffer.getData();
+    vboPoints.bind();
+    vboPoints.allocate(vertices.constData(), vertices.size() * sizeof(GLfloat));
+    vboPoints.release();
+    faceidVertexCount = 3 * model->faceCount();
 }
 
 void GLWidget::resizeGL(int w, int h)
@@ -404,13 +769,23 @@ void GLWidget::resizeGL(int w, int h)
     pTrans.setToIdentity();
     pTrans.perspective(45.0f, GLfloat(w) / h, 0.01f, 1000.0f); // near/far only care about clipping
 
-    if (fbo)
+    // the id targets have depth, so that the nearest face gets picked
+    if (primitiveIdPicking)
     {
-        fbo->release();
-        delete fbo;
+        const bool created = idTarget.create(QSize(w, h), GL_R32UI);
+        glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+        if (!created)
+            pickByFaceIdVertices();
+    }
+    if (!primitiveIdPicking)
+    {
+        if (fbo)
+        {
+            fbo->release();
+            delete fbo;
+        }
+        fbo = new QOpenGLFramebufferObject(w, h, QOpenGLFramebufferObject::CombinedDepthStencil);
     }
-    fbo = new QOpenGLFramebufferObject(w,h);
-
 }
 
 void GLWidget::mousePressEvent(QMouseEvent *event)
@@ -432,17 +807,11 @@ void GLWidget::mouseReleaseEvent(QMouseEvent *event)
 void GLWidget::onMouseClicked(int x, int y)
 {
     // check for face picking
-    QRgb rgb = snapshotImage.pixel(QPoint(x,y));
-    int red = qRed(rgb);
-    int green = qGreen(rgb);
-    int blue = qBlue(rgb);
-
-    QVector3D faceidVector(red,green,blue);
-    unsigned int faceid = Core::unhideIntFromVector3D(faceidVector);
+    const Core::FaceIndex faceid = pickFace(x, y);
 
-    if (faceid == 0)
+    if (faceid == NO_FACE)
     {
-        this->selectedFace = -1; // nothing selected
+        this->selectedFace = NO_FACE; // nothing selected
         this->selectedFaces.clear();
         updateUiOverlay();
     } else
@@ -463,7 +832,7 @@ void GLWidget::onMouseClicked(int x, int y)
         update();
     }
 
-    qDebug() << "face at clicked position: " << red << green << blue << ". Faceid: " << faceid;
+    qDebug() << "face at clicked position: " << faceid;
 }
 
 void GLWidget::onCtrlStateChanged(bool down)
@@ -513,6 +882,30 @@ void GLWidget::mouseMoveEvent(QMouseEvent *event)
         }
     //}
     mouseLastPos = event->pos();
+
+    // pick the face under the cursor in the next frame. Not while dragging the view around.
+    if (hoverPicking && !event->buttons())
+    {
+        hoverPos = event->pos();
+        hoverPending = true;
+        update();
+    } else if (hoveredFace != NO_FACE)
+    {
+        hoveredFace = NO_FACE;
+        hoverPending = false;
+        update();
+    }
+}
+
+void GLWidget::leaveEvent(QEvent* event)
+{
+    hoverPending = false;
+    if (hoveredFace != NO_FACE)
+    {
+        hoveredFace = NO_FACE;
+        update();
+    }
+    QOpenGLWidget::leaveEvent(event);
 }
 
 void GLWidget::wheelEvent(QWheelEvent *event)
@@ -533,6 +926,9 @@ void GLWidget::keyPressEvent(QKeyEvent* event)
             ctrlDown = true;
             emit ctrlStateChanged(true);
         }
+    } else if (event->key() == Qt::Key_Escape)
+    {
+        cancelLoading();
     }
 }
 
@@ -562,39 +958,114 @@ void GLWidget::resetCamera()
 
 void GLWidget::processModel()
 {
-    modelMesh->generateMetrics();
+    for (ModelMesh* part : model->parts)
+    {
+        part->generateMetrics();
+    }
+    model->mergeMetrics();
+    model->numberFaces();
 
     // populate buffer drafts
+    App::getMeshContext().triangleBuffer.clear();
+    if (!primitiveIdPicking)
+        buildFaceIdVertices();
+
+    uploadModel();
+}
+
+/// Fill the triangle draft with the points and face ids of the model, for the id pass of renderState_idProjection
+void GLWidget::buildFaceIdVertices()
+{
     MeshContext& meshContext = App::getMeshContext();
     meshContext.triangleBuffer.clear();
-    meshContext.normalBuffer.clear();
-    modelMesh->swallow();
+    meshContext.triangleBuffer.reserve(18 * model->faceCount()); // 3 points and face ids of 3 floats per face
+    for (ModelMesh* part : model->parts)
+    {
+        part->swallow();
+    }
+}
+
+/// Push points and faces of the model and the triangle draft to the GPU, place the model on the base grid and reset camera and selection.
+void GLWidget::uploadModel()
+{
+    MeshContext& meshContext = App::getMeshContext();
 
     // populate vertex buffer objects
+    if (!primitiveIdPicking && meshContext.triangleBuffer.getData().isEmpty() && model->faceCount() > 0)
+        buildFaceIdVertices(); // loaded before picking fell back to face id vertices
+    makeCurrent();
     vboPoints.bind();
     vboPoints.allocate(meshContext.triangleBuffer.getData().constData(), meshContext.triangleBuffer.getData().size() * sizeof(GLfloat));
     vboPoints.release();
-    vboNormals.bind();
-    vboNormals.allocate(meshContext.normalBuffer.getData().constData(), meshContext.normalBuffer.getData().size() * sizeof(GLfloat));
-    vboNormals.release();
-    // buffer with face ids
-    vboFaceid.bind();
-    vboFaceid.allocate(modelMesh->idprojectionData.constData(), modelMesh->idprojectionData.size() * sizeof(GLfloat));
-    vboFaceid.release();
-
-    modelMesh->modelTrans.setToIdentity();
-    modelMesh->modelTrans.translate(-modelMesh->centerPoint.x(),-modelMesh->minPoint.y(), -modelMesh->centerPoint.z());
-
-    boundingRadius = modelMesh->boundingRadius;
+
+    // points and faces of the parts go one after the other. Indices are shifted by the points of the parts before.
+    int pointCount = 0;
+    for (const ModelMesh* part : model->parts)
+        pointCount += part->points.size();
+    const int pointSize = compactVertices ? COMPACT_POINT_SIZE : int(sizeof(QVector3D));
+    QVector3D quantizationExtent = model->maxPoint - model->minPoint;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (quantizationExtent[axis] <= 0)
+            quantizationExtent[axis] = 1; // flat along this axis
+    }
+    modelPointsTrans.setToIdentity();
+    if (compactVertices)
+    {
+        modelPointsTrans.translate(model->minPoint);
+        modelPointsTrans.scale(quantizationExtent.x(), quantizationExtent.y(), quantizationExtent.z());
+    }
+    vboModelPoints.bind();
+    vboModelPoints.allocate(pointCount * pointSize);
+    iboFaces.bind();
+    iboFaces.allocate(model->faceCount() * sizeof(Core::Triangle));
+    int pointBase = 0;
+    int faceBase = 0;
+    for (const ModelMesh* part : model->parts)
+    {
+        if (compactVertices)
+        {
+            std::vector<quint16> quantized(4 * part->points.size());
+            quantizePoints(part->points, model->minPoint, quantizationExtent, quantized.data());
+            vboModelPoints.write(pointBase * pointSize, quantized.data(), part->points.size() * pointSize);
+        } else
+        {
+            vboModelPoints.write(pointBase * pointSize, part->points.constData(), part->points.size() * pointSize);
+        }
+        if (pointBase == 0)
+        {
+            iboFaces.write(0, part->faces.constData(), part->faces.size() * sizeof(Core::Triangle));
+        } else
+        {
+            const Core::PointIndex* indices = reinterpret_cast<const Core::PointIndex*>(part->faces.constData());
+            QVector<Core::PointIndex> shifted(3 * part->faces.size());
+            for (int index_i = 0; index_i < shifted.size(); index_i++)
+                shifted[index_i] = indices[index_i] + pointBase;
+            iboFaces.write(faceBase * sizeof(Core::Triangle), shifted.constData(), shifted.size() * sizeof(Core::PointIndex));
+        }
+        pointBase += part->points.size();
+        faceBase += part->faces.size();
+    }
+    iboFaces.release();
+    vboModelPoints.release();
+    modelIndexCount = 3 * faceBase;
+    faceidVertexCount = primitiveIdPicking ? 0 : 3 * faceBase; // the preview has no faces and so no face ids
+    doneCurrent();
+
+    model->modelTrans.setToIdentity();
+    model->modelTrans.translate(-model->centerPoint.x(),-model->minPoint.y(), -model->centerPoint.z());
+
+    boundingRadius = model->boundingRadius;
     resetCamera();
 
     if (basegridMesh)
         delete basegridMesh;
-    basegridMesh = new BasegridMesh(20, std::max(modelMesh->width, modelMesh->height)* 4.0);
+    basegridMesh = new BasegridMesh(20, std::max(model->width, model->height)* 4.0);
 
 
     // clear selection
-    this->selectedFace = -1;
+    hoveredFace = NO_FACE;
+    this->selectedFace = NO_FACE;
     this->selectedFaces.clear();
     updateUiOverlay();
     update();
@@ -602,26 +1073,145 @@ void GLWidget::processModel()
 
 void GLWidget::rebaseOnFace()
 {
-    if (selectedFace != -1)
+    Core::FaceIndex faceIndex;
+    ModelMesh* selectedPart = (selectedFace != NO_FACE) ? model->findFace(selectedFace, faceIndex) : nullptr;
+    if (selectedPart)
     {
         // find rotation matrix from source and target normal of selected face
-        QVector3D n = modelMesh->faceNormal(selectedFace);
+        QVector3D n = selectedPart->faceNormal(faceIndex);
         QVector3D targetNormal(0,-1,0); // we need to rotate the object so that it faces down (the Υ axis)
         QQuaternion q = QQuaternion::rotationTo(n, targetNormal);
-        QMatrix4x4 rotMatrix(q.toRotationMatrix());
+        const Core::AffineTransform rotation{QMatrix4x4(q.toRotationMatrix())};
 
-        // rotate all points of the model
-        VertexIterator vi(*modelMesh, Core::VertexIterator::ITERATE_POINTS, Core::VertexIterator::ACTION_CALLBACK_POINT, [&rotMatrix](QVector3D& point){
-            point = rotMatrix*point;
-        });
-        vi.pumpAll();
+        // rotate all points of all parts of the model
+        for (ModelMesh* part : model->parts)
+            part->transform(rotation);
         processModel();
     }
 }
 
 void GLWidget::onNewStlFilename(QString filename)
 {
-    Utils::Loader loader;
-    loader.loadStl(filename, *modelMesh);
-    processModel();
+    loadRequest = modelLoader->request(filename, weldTolerance); // supersedes any load in progress
+}
+
+void GLWidget::setWeldTolerance(double tolerance)
+{
+    weldTolerance = float(qMax(0.0, tolerance));
+}
+
+/// Write all parts to an stl file, one after the other
+/// Writes the model as it is now in the loader thread. Later changes to the model don't go into the file.
+void GLWidget::onSaveStlFilename(QString filename, bool ascii)
+{
+    if (loadRequest != 0)
+    {
+        emit statusMessage(tr("Can't save while a model is loading"));
+        return;
+    }
+
+    modelLoader->save(filename, *model, ascii);
+    emit statusMessage(tr("Saving to %1").arg(filename));
+}
+
+void GLWidget::onModelSaved(QString filename, int faceCount)
+{
+    emit statusMessage(tr("Saved %1 faces to %2").arg(faceCount).arg(filename));
+}
+
+void GLWidget::onSaveFailed(QString filename, QString message)
+{
+    emit statusMessage(tr("Saving %1 failed: %2").arg(filename).arg(message));
+}
+
+void GLWidget::cancelLoading()
+{
+    if (loadRequest == 0)
+        return;
+
+    modelLoader->cancel();
+    loadRequest = 0;
+    dropPreview();
+    emit loadingStopped(tr("Loading cancelled"));
+}
+
+void GLWidget::onLoaderProgress(quint64 requestId, int percent, QString stage)
+{
+    if (requestId == loadRequest)
+        emit loadingProgress(percent, stage);
+}
+
+/// Show the unwelded triangles until the model is ready. Picking is off meanwhile. The current model stays, in case loading fails or is cancelled.
+void GLWidget::onModelPreview(quint64 requestId, ModelLoader::PreviewPtr preview)
+{
+    if (requestId != loadRequest)
+        return;
+
+    // straight from the soup, which the loader keeps welding meanwhile
+    const std::vector<float>& cornerCoords = preview->soup->cornerCoords;
+    makeCurrent();
+    vboPreview.bind();
+    vboPreview.allocate(cornerCoords.data(), int(cornerCoords.size() * sizeof(GLfloat)));
+    vboPreview.release();
+    doneCurrent();
+    previewVertexCount = int(cornerCoords.size() / 3);
+
+    const QVector3D center = (preview->minPoint + preview->maxPoint) / 2;
+    const QVector3D size = preview->maxPoint - preview->minPoint;
+    previewTrans.setToIdentity();
+    previewTrans.translate(-center.x(), -preview->minPoint.y(), -center.z());
+    previewHeight = size.y();
+    boundingRadius = size.length();
+    hoveredFace = NO_FACE;
+    resetCamera();
+}
+
+/// Go back to showing the model and free the preview triangles
+void GLWidget::dropPreview()
+{
+    if (previewVertexCount == 0)
+        return;
+
+    previewVertexCount = 0;
+    makeCurrent();
+    vboPreview.bind();
+    vboPreview.allocate(0);
+    vboPreview.release();
+    doneCurrent();
+
+    if (model->faceCount() > 0)
+        boundingRadius = model->boundingRadius;
+    resetCamera(); // it was placed for the preview
+}
+
+/// Swap in the loaded model and its buffers in one go
+void GLWidget::onModelLoaded(quint64 requestId, ModelLoader::ResultPtr result)
+{
+    if (requestId != loadRequest)
+        return; // result is dropped along with its model
+
+    delete model;
+    model = result->model;
+    result->model = nullptr;
+
+    MeshContext& meshContext = App::getMeshContext();
+    meshContext.triangleBuffer = result->triangleBuffer;
+
+    dropPreview();
+    uploadModel();
+    loadRequest = 0;
+    QString message = tr("Loaded %1 faces in %2 parts").arg(model->faceCount()).arg(model->parts.size());
+    if (result->mergedPoints > 0)
+        message += tr(", %1 points merged by the weld tolerance").arg(result->mergedPoints);
+    emit loadingStopped(message);
+}
+
+void GLWidget::onLoadFailed(quint64 requestId, QString message)
+{
+    if (requestId != loadRequest)
+        return;
+
+    loadRequest = 0;
+    dropPreview();
+    emit loadingStopped(tr("Loading failed: %1").arg(message));
 }
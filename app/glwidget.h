@@ -58,9 +58,11 @@
 #include <QOpenGLBuffer>
 #include <QOpenGLTexture>
 #include <QMatrix4x4>
+#include <QThread>
 
 #include "rendering.h"
 #include "app.h"
+#include "modelloader.h"
 
 
 QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
@@ -82,6 +84,8 @@ public:
     QSize minimumSizeHint() const override;
     QSize sizeHint() const override;
 
+    static void setCompactVertices(bool compact); // for widgets created afterwards. Model points are quantized to 16 bits per axis.
+
 public slots:
     void setXRotation(int angle);
     void setYRotation(int angle);
@@ -94,6 +98,9 @@ public slots:
     void onCtrlStateChanged(bool down);
     void rebaseOnFace();
     void onNewStlFilename(QString filename);
+    void onSaveStlFilename(QString filename, bool ascii);
+    void setWeldTolerance(double tolerance); // applies to the next load
+    void cancelLoading();
     void resetCamera();
 
     void cleanup();
@@ -105,6 +112,9 @@ signals:
     void zoomChangedBy(int degreesDelta);
     void mouseClickedAt(int x, int y);
     void ctrlStateChanged(bool down);
+    void loadingProgress(int percent, QString stage);
+    void loadingStopped(QString message); // loading finished, failed or was cancelled
+    void statusMessage(QString message);
 
 protected:
     void initializeGL() override;
@@ -116,10 +126,30 @@ protected:
     void wheelEvent(QWheelEvent *event) override;
     void keyPressEvent(QKeyEvent* event) override;
     void keyReleaseEvent(QKeyEvent* event) override;
+    void leaveEvent(QEvent* event) override;
 
     void processModel();
+    void buildFaceIdVertices();
+    void uploadModel();
+    void pickByFaceIdVertices();
+    void dropPreview();
     bool updateUiOverlay();
-
+    QMatrix4x4 viewTrans(); // camera transformation for the current zoom and rotation
+    QSize idTargetSize() const;
+    void renderIdPass(const QRect& region);
+    void readIdPixel(int x, int row, void* pixel);
+    Core::FaceIndex idPixelFace(const void* pixel) const;
+    Core::FaceIndex pickFace(int x, int y);
+    void startHoverPick();
+    bool collectHoverPicks();
+
+private slots:
+    void onLoaderProgress(quint64 requestId, int percent, QString stage);
+    void onModelPreview(quint64 requestId, ModelLoader::PreviewPtr preview);
+    void onModelLoaded(quint64 requestId, ModelLoader::ResultPtr result);
+    void onLoadFailed(quint64 requestId, QString message);
+    void onModelSaved(QString filename, int faceCount);
+    void onSaveFailed(QString filename, QString message);
 
 private:
 
@@ -137,21 +167,57 @@ private:
 
     QPoint mouseLastPos;
     QPoint mousePressedPos;
-    ModelMesh* modelMesh = 0;
+    Model* model = 0; // loaded model. Each of its parts is registered with the buffer drafts separately.
     BasegridMesh* basegridMesh = 0;
 
-    RenderState renderState_model;
-    RenderState renderState_idProjection;
+    // background loading
+    QThread loaderThread;
+    ModelLoader* modelLoader = 0; // lives in loaderThread
+    quint64 loadRequest = 0; // id of the request in progress. 0 if none.
+    float weldTolerance = 0; // passed on to the loader. 0 welds equal corners only.
+
+    RenderState renderState_preview; // draws the triangles of vboPreview
+    RenderState renderState_modelIndexed; // draws the faces of iboFaces
+    RenderState renderState_modelTriangles; // draws the triangles of vboPoints. Fallback for when iboFaces can't be drawn.
+    RenderState renderState_idProjection; // draws the triangles and face ids of vboPoints. Fallback for when renderState_idPrimitive can't be set up.
+    RenderState renderState_idPrimitive; // draws the faces of iboFaces, each in the color of its gl_PrimitiveID
     RenderState renderState_uiOverlay;
-
-    QOpenGLBuffer vboPoints;
-    QOpenGLBuffer vboNormals;
-    QOpenGLBuffer vboFaceid;
-
-    QOpenGLFramebufferObject* fbo = 0;
-    QImage snapshotImage;
-
-    int selectedFace = -1; // id of the clicked face. -1 if none is selected
+    RenderState renderState_hover; // outlines a face of iboFaces
+
+    QOpenGLBuffer vboPoints; // 3 vertices per face, a point and its face id each. Only filled when picking needs face id vertices.
+    QOpenGLBuffer vboPreview; // unwelded triangles of the model being loaded, 3 floats per point
+    int previewVertexCount = 0; // vertices in vboPreview. While there are any they're drawn instead of the model, which is kept until the new one replaces it.
+    QMatrix4x4 previewTrans; // places the preview on the base grid
+    float previewHeight = 0;
+    QOpenGLBuffer vboModelPoints; // points of all parts, one part after the other
+    QOpenGLBuffer iboFaces; // faces of all parts as indices to vboModelPoints
+    int modelIndexCount = 0; // indices in iboFaces
+    bool uintIndices = true; // iboFaces can be drawn. GLES2 needs GL_OES_element_index_uint for that.
+    QMatrix4x4 modelPointsTrans; // maps what vboModelPoints holds to model space. Undoes the quantization of compact vertices.
+    int faceidVertexCount = 0; // vertices with face ids in vboPoints
+    bool primitiveIdPicking = false; // the id pass draws with renderState_idPrimitive into idTarget and vboPoints holds no face ids
+    static const Core::FaceIndex NO_FACE = ~Core::FaceIndex(0); // face id of nothing. Ids cover the rest of the FaceIndex range.
+
+    // id pass targets, only rendered to when picking
+    IntegerTarget idTarget; // face id + 1 per pixel, 0 for none. Goes with renderState_idPrimitive.
+    QOpenGLFramebufferObject* fbo = 0; // face ids as RGB colors, for renderState_idProjection
+
+    // hover picking. The face under the cursor is read back through a ring of pixel pack
+    // buffers and taken a frame or two later, once the fence of its readback has passed.
+    struct HoverReadback
+    {
+        QOpenGLBuffer pbo{QOpenGLBuffer::PixelPackBuffer};
+        GLsync fence = nullptr; // set while the readback is in flight
+    };
+    static const int HOVER_READBACKS = 3;
+    HoverReadback hoverReadbacks[HOVER_READBACKS];
+    int hoverNext = 0; // slot of the next readback. The oldest one in flight, if any, is at or after it.
+    bool hoverPicking = false; // the context has fences, so readbacks can be left to finish on their own
+    bool hoverPending = false; // the cursor moved since the last readback started
+    QPoint hoverPos;
+    Core::FaceIndex hoveredFace = NO_FACE; // id of the face under the cursor
+
+    Core::FaceIndex selectedFace = NO_FACE; // id of the clicked face
     QVector<Core::FaceIndex> selectedFaces;
 
     // ui overlay rendering
@@ -1,45 +1,215 @@
 #include "loader.h"
 #include "qvector3d.h"
 #include "stl_reader.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QDebug>
+#include <algorithm>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
 
 using namespace stl_reader; // only for loader.cpp local use
 
 namespace Utils {
 
-typedef StlMesh<float, unsigned int> ReaderMesh;
+namespace {
+
+static_assert(sizeof(QVector3D) == 3*sizeof(float), "QVector3D is expected to be three packed floats");
+static_assert(sizeof(Core::Triangle) == 3*sizeof(Core::PointIndex), "Triangle is expected to be three packed indices");
+
+/*!
+ * \brief Presents a QVector of packed triples to stl_reader as a flat container
+ *
+ * The reader resizes the container once and then writes each component, so
+ * coordinates and indices end up directly in mesh storage without an intermediate
+ * copy.
+ */
+template <typename Triple, typename T>
+class FlatArrayView
+{
+    QVector<Triple>& triples;
+    T* raw = nullptr;
+
+    void updateRaw()
+    {
+        raw = triples.isEmpty() ? nullptr : reinterpret_cast<T*>(triples.data());
+    }
+
+public:
+    typedef T value_type;
+
+    FlatArrayView(QVector<Triple>& triples) : triples(triples)
+    {
+        updateRaw();
+    }
+
+    size_t size() const { return size_t(triples.size()) * 3; }
+    bool empty() const { return triples.isEmpty(); }
+
+    void clear()
+    {
+        triples.clear();
+        raw = nullptr;
+    }
+
+    void resize(size_t count)
+    {
+        triples.resize(int(count / 3));
+        updateRaw();
+    }
+
+    T& operator[](size_t i) { return raw[i]; }
+    const T& operator[](size_t i) const { return raw[i]; }
+};
+
+typedef FlatArrayView<QVector3D, float> Vector3DArrayView;
+typedef FlatArrayView<Core::Triangle, Core::PointIndex> TriangleArrayView;
+
+/// Read-only flat container over a part of an array, e.g. the corners of a single solid
+template <typename T>
+class ConstRangeView
+{
+    const T* first;
+    size_t count;
+
+public:
+    typedef T value_type;
+
+    ConstRangeView(const T* first, size_t count) : first(first), count(count) {}
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return first[i]; }
+};
+
+} // anonymous namespace
 
 Loader::Loader()
 {
 
 }
 
-void Loader::loadStl(QString filename, Core::Mesh& new_mesh)
+int Loader::Soup::solidCount() const
+{
+    return solidRanges.empty() ? 0 : int(solidRanges.size()) - 1;
+}
+
+void Loader::loadStl(QString filename, Core::Mesh& new_mesh, const Options& options)
+{
+    new_mesh.clear();
+
+    // read the triangle soup. Facet normals go straight to the mesh.
+    Soup soup;
+    readSoup(filename, soup);
+    new_mesh.normals.swap(soup.normals);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // weld corners of all solids into mesh points and faces
+    Vector3DArrayView normals(new_mesh.normals);
+    Vector3DArrayView points(new_mesh.points);
+    TriangleArrayView faces(new_mesh.faces);
+    size_t mergedPoints = 0;
+    WeldStlSoup(soup.cornerCoords, points, normals, faces, soup.solidRanges, options.weldTolerance, &mergedPoints);
+    stats.weldMs = timer.elapsed();
+    stats.peakRssBytes = peakResidentBytes();
+    stats.mergedPoints = qint64(mergedPoints);
+
+    qInfo() << "loaded" << filename << ":" << new_mesh.points.size() << "points," << new_mesh.faces.size() << "faces,"
+            << stats.mergedPoints << "points merged by tolerance."
+            << "read:" << stats.readMs << "ms, weld:" << stats.weldMs << "ms, peak RSS:" << stats.peakRssBytes/(1024*1024) << "MiB";
+}
+
+bool Loader::readSoup(QString filename, Soup& soup, const CancelCheck& cancelled)
 {
     QByteArray ba = filename.toLocal8Bit();
     const char *filename_cstr = ba.data();
-    ReaderMesh reader_mesh (filename_cstr);
-    new_mesh.clear();
+    resetPeakResidentBytes();
 
-    // first, copy vertices
-    for (ReaderMesh::IndexType vertex_i = 0; vertex_i < reader_mesh.num_vrts(); vertex_i++)
-    {
-        const ReaderMesh::ValueType* v = reader_mesh.vrt_coords(vertex_i);
-        QVector3D qvertex(v[0], v[1], v[2]);
+    QElapsedTimer timer;
+    timer.start();
+
+    Vector3DArrayView normals(soup.normals);
+    const bool complete = ReadStlFileSoup(filename_cstr, soup.cornerCoords, normals, soup.solidRanges, cancelled);
+    stats.readMs = timer.elapsed();
+    stats.weldMs = 0;
+    stats.peakRssBytes = peakResidentBytes();
+    stats.mergedPoints = 0;
+    return complete;
+}
+
+qint64 Loader::weldSolid(const Soup& soup, int solid_i, Core::Mesh& mesh, const Options& options, const CancelCheck& cancelled)
+{
+    mesh.clear();
+
+    const size_t firstTriangle = soup.solidRanges[solid_i];
+    const size_t triangleCount = soup.solidRanges[solid_i + 1] - firstTriangle;
+    ConstRangeView<float> cornerCoords(soup.cornerCoords.data() + firstTriangle*9, triangleCount*9);
+    std::vector<unsigned int> solids = {0, (unsigned int) triangleCount};
+    if (soup.normals.size() == soup.cornerCoords.size()/9)
+        mesh.normals = soup.normals.mid(int(firstTriangle), int(triangleCount));
 
-        new_mesh.points.append(qvertex);
+    Vector3DArrayView normals(mesh.normals);
+    Vector3DArrayView points(mesh.points);
+    TriangleArrayView faces(mesh.faces);
+    size_t mergedPoints = 0;
+    if (!WeldStlSoup(cornerCoords, points, normals, faces, solids, options.weldTolerance, &mergedPoints, cancelled))
+    {
+        mesh.clear();
+        return 0;
     }
-    // next, copy indices to vertices
-    for (ReaderMesh::IndexType triangle_i = 0; triangle_i < reader_mesh.num_tris(); triangle_i++)
+    return qint64(mergedPoints);
+}
+
+const Loader::Stats& Loader::lastStats() const
+{
+    return stats;
+}
+
+void Loader::setMaxThreads(int threadCount)
+{
+    stl_reader::SetMaxWorkerThreads(size_t(std::max(0, threadCount)));
+}
+
+qint64 peakResidentBytes()
+{
+#if defined(Q_OS_LINUX)
+    // VmHWM is the high water mark of the resident set and, unlike ru_maxrss, can be reset
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly | QIODevice::Text))
     {
-        Core::Triangle triangle;
-        // iterate over face/triangle corners
-        for (unsigned int corner_i = 0; corner_i < triangle.PointCount; corner_i++)
+        for (QByteArray line = status.readLine(); !line.isEmpty(); line = status.readLine())
         {
-            triangle.points[corner_i] = reader_mesh.tri_corner_ind(triangle_i, corner_i);
+            if (line.startsWith("VmHWM:"))
+                return line.mid(6).trimmed().split(' ').first().toLongLong() * 1024; // reported in kB
         }
-        new_mesh.faces.append(triangle);
     }
+    return 0;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+  #if defined(Q_OS_DARWIN)
+    return usage.ru_maxrss; // bytes
+  #else
+    return qint64(usage.ru_maxrss) * 1024; // kilobytes
+  #endif
+#else
+    return 0;
+#endif
+}
 
+void resetPeakResidentBytes()
+{
+#if defined(Q_OS_LINUX)
+    QFile clearRefs("/proc/self/clear_refs");
+    if (clearRefs.open(QIODevice::WriteOnly))
+        clearRefs.write("5");
+#endif
 }
 
 
@@ -2,26 +2,103 @@
 #define UTILS_LOADER_H
 
 #include "mesh.h"
+#include <functional>
+#include <vector>
 
 namespace Utils {
 
 class Loader
 {
 public:
+    /// Timings and memory usage of the last loadStl() or readSoup() call
+    struct Stats
+    {
+        qint64 readMs = 0; // parsing the file into a triangle soup
+        qint64 weldMs = 0; // identifying shared corners and filling mesh storage
+        qint64 peakRssBytes = 0; // peak resident set size of the process while loading. 0 if unknown.
+        qint64 mergedPoints = 0; // points merged because of Options::weldTolerance
+    };
+
+    struct Options
+    {
+        float weldTolerance; // corners closer than this are welded. 0 welds equal corners only.
+
+        Options() : weldTolerance(0) {}
+    };
+
+    /// Unwelded triangles of an stl file as read by readSoup()
+    struct Soup
+    {
+        std::vector<float> cornerCoords; // 9 floats per triangle, its three corners one after the other
+        QVector<QVector3D> normals; // one per triangle as found in the file
+        std::vector<unsigned int> solidRanges; // solid i spans triangles solidRanges[i] up to solidRanges[i+1]
+
+        int solidCount() const;
+    };
+
+    /// Returns true once a running readSoup() or weldSolid() should stop. Called now and then, possibly from several threads at once.
+    typedef std::function<bool()> CancelCheck;
+
     Loader();
 
     /**
      * @brief Loads an stl file into a Core::Mesh object
      *
-     * If more than one solids are found in the stl file, only the
-     * first one will be loaded.
+     * If more than one solids are found in the stl file, they are all
+     * loaded into the same mesh. Use readSoup() and weldSolid() to
+     * keep them apart.
+     *
+     * Welded coordinates and face indices are written straight into the
+     * mesh points and faces. Facet normals found in the file are kept in
+     * the mesh normals.
      *
      * @param filename path and filename of the .stl file to load
      * @param mesh allocated Core::Mesh object to hold new mesh data
+     * @param options how to weld corners
+     */
+    void loadStl(QString filename, Core::Mesh& mesh, const Options& options = Options());
+
+    /**
+     * @brief Reads the triangles of an stl file without welding them
+     *
+     * Throws std::runtime_error if the file can't be read.
+     *
+     * @param cancelled stops reading early if set
+     * @return false if cancelled, the soup is incomplete then
+     */
+    bool readSoup(QString filename, Soup& soup, const CancelCheck& cancelled = CancelCheck());
+
+    /**
+     * @brief Welds the triangles of a single solid into a Core::Mesh object
+     *
+     * Safe to call from several threads at once, as long as each call gets
+     * its own mesh.
+     *
+     * @param soup triangles as read by readSoup()
+     * @param solid_i index of the solid, less than soup.solidCount()
+     * @param mesh allocated Core::Mesh object to hold the solid
+     * @param options how to weld corners
+     * @param cancelled stops welding early if set. The mesh is left empty then.
+     * @return number of points merged because of the weld tolerance
      */
-    void loadStl(QString filename, Core::Mesh& mesh); // add options parameter
+    static qint64 weldSolid(const Soup& soup, int solid_i, Core::Mesh& mesh, const Options& options = Options(),
+                            const CancelCheck& cancelled = CancelCheck());
+
+    const Stats& lastStats() const;
+
+    /// Limits the threads of a single read or weld. 0 uses all cores.
+    static void setMaxThreads(int threadCount);
+
+private:
+    Stats stats;
 };
 
+/// Peak resident set size of the process in bytes or 0 if the platform doesn't tell
+qint64 peakResidentBytes();
+
+/// Restarts tracking of the peak resident set size, where the platform allows it (Linux)
+void resetPeakResidentBytes();
+
 } // namespace Utils
 
 #endif // UTILS_LOADER_H
@@ -57,6 +57,8 @@
 #include "glwidget.h"
 //#include "mainwindow.h"
 #include "appwindow.h"
+#include "loader.h"
+#include "mesh.h"
 
 int main(int argc, char *argv[])
 {
@@ -66,6 +68,24 @@ int main(int argc, char *argv[])
     QCoreApplication::setOrganizationName("otsakir");
     QCoreApplication::setApplicationVersion(QT_VERSION_STR);
 
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QCoreApplication::applicationName());
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption threadsOption("threads", "Use at most <count> threads for loading and processing models. 0 uses all cores.", "count", "0");
+    parser.addOption(threadsOption);
+    QCommandLineOption compactOption("compact-vertices", "Keep model points on the GPU as 16-bit fractions of the model bounds. Saves memory at a small loss of precision.");
+    parser.addOption(compactOption);
+    parser.process(app);
+
+    bool threadsOk;
+    const int threads = parser.value(threadsOption).toInt(&threadsOk);
+    if (!threadsOk || threads < 0)
+        parser.showHelp(1);
+    Core::setMaxThreads(threads);
+    Utils::Loader::setMaxThreads(threads);
+    GLWidget::setCompactVertices(parser.isSet(compactOption));
+
     QSurfaceFormat fmt;
     fmt.setDepthBufferSize(24);
 
@@ -2,6 +2,10 @@
 #include <limits.h>
 #include <algorithm>
 #include <QDebug>
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
 #include "cmath"
 
 
@@ -9,6 +13,48 @@
 
 namespace Core {
 
+static std::atomic<int> maxThreadCount(0);
+
+void setMaxThreads(int threadCount)
+{
+    maxThreadCount = std::max(0, threadCount);
+    QThreadPool::globalInstance()->setMaxThreadCount(maxThreads());
+}
+
+int maxThreads()
+{
+    const int threadCount = maxThreadCount;
+    return threadCount > 0 ? threadCount : std::max(1, QThread::idealThreadCount());
+}
+
+void forRanges(int itemCount, const std::function<void(int first, int last)>& work, int minRangeSize)
+{
+    if (itemCount <= 0)
+        return;
+
+    const int splitCount = rangeCount(itemCount, minRangeSize);
+    if (splitCount == 1)
+    {
+        work(0, itemCount);
+        return;
+    }
+
+    QVector<int> ranges(splitCount);
+    std::iota(ranges.begin(), ranges.end(), 0);
+    QtConcurrent::blockingMap(ranges, [itemCount, splitCount, &work](int range_i) {
+        work(int(qint64(itemCount) * range_i / splitCount), int(qint64(itemCount) * (range_i + 1) / splitCount));
+    });
+}
+
+int rangeCount(int itemCount, int minRangeSize)
+{
+    // a few ranges per thread, so that threads finishing early pick up more work
+    const int threadCount = maxThreads();
+    if (threadCount == 1)
+        return 1;
+    return std::max(1, std::min(threadCount * 4, itemCount / std::max(1, minRangeSize)));
+}
+
 
 QVector3D hideIntInVector3D(unsigned int i)
 {
@@ -45,255 +91,249 @@ unsigned int unhideIntFromVector3D(QVector3D& v, bool normalized)
 
 
 
-void VertexIterator::init()
-{
-    switch (type)
-    {
-        case ITERATE_TRIANGLES:
-            pointIndexer = new IndexerRanged<int>(0, 3, {1,1,-2});
-        break;
-        case ITERATE_TRIANGLES_TO_LINES:
-            pointIndexer = new IndexerRanged<int>(0, 3, {1,0,1,0,-2,0});
-        break;
-        case ITERATE_POINTS:
-            pointIndexer = new IndexerRanged<int>(0, sourceArrays.points.size());
-        break;
-        case ITERATE_PER_TRIANGLE:
-            pointIndexer = new IndexerRanged<int>(0, sourceArrays.points.size(), {3});
-        break;
-    }
-}
+namespace {
 
-VertexIterator::VertexIterator(SourceArrays& sourceArrays, Type type, ActionType actionType, PointCallback pointCallback)
-    : VertexIterator(sourceArrays, 0, type, actionType)
+/*
+ * Vertex pumping, specialized at compile time for each iteration type and
+ * action. Output size is known up front, so every loop writes floats straight
+ * into a presized target.
+ */
+
+// corners of a face visited by one face step of an iteration type
+template <VertexIterator::Type type> struct FaceSteps;
+template <> struct FaceSteps<VertexIterator::ITERATE_TRIANGLES>
 {
-    this->pointCallback = pointCallback;
-}
+    static const int COUNT = 3;
+    static int corner(int step) { return step; }
+};
+template <> struct FaceSteps<VertexIterator::ITERATE_TRIANGLES_TO_LINES>
+{
+    static const int COUNT = 6;
+    static int corner(int step) { return ((step + 1) / 2) % 3; } // A-B, B-C, C-A
+};
+template <> struct FaceSteps<VertexIterator::ITERATE_PER_TRIANGLE>
+{
+    static const int COUNT = 1;
+    static int corner(int) { return 0; }
+};
 
+// floats an action writes per step
+template <VertexIterator::ActionType action> struct StepFloats { static const int COUNT = 3; };
+template <> struct StepFloats<VertexIterator::ACTION_PUSH_NORMAL> { static const int COUNT = 9; }; // same normal for all points of a face
+template <> struct StepFloats<VertexIterator::ACTION_CALLBACK_POINT> { static const int COUNT = 0; };
+template <> struct StepFloats<VertexIterator::ACTION_PUSH_POINT_FACEID> { static const int COUNT = 6; };
 
-VertexIterator::VertexIterator(SourceArrays& sa, QVector<float>* target, Type type, ActionType actionType)
-    : sourceArrays(sa),
-      targetArray(target),
-      faceIndex(0),
-      infaceIndex(0),
-      pointIndex(0),
-      type(type),
-      bufferDraft(0)
+// every face of the mesh or the faces of a lookup table
+struct AllFaces
 {
-    setAction(actionType);
-    switch (type)
-    {
-        case ITERATE_TRIANGLES:
-            faceIndexer = new IndexerRanged<FaceIndex>(0, sa.faces.size(),{0,0,1});
-            pumpFunction = &VertexIterator::pumpByFace;
-        break;
-        case ITERATE_TRIANGLES_TO_LINES:
-            faceIndexer = new IndexerRanged<FaceIndex>(0, sa.faces.size(),{0,0,0,0,0,1});
-            pumpFunction = &VertexIterator::pumpByFace;
-        break;
-        case ITERATE_PER_TRIANGLE:
-            faceIndexer = new IndexerRanged<FaceIndex>(0, sa.faces.size(),{1});
-            pumpFunction = &VertexIterator::pumpByFaceOnly;
-        break;
-        case ITERATE_POINTS:
-            faceIndexer = 0;
-            pumpFunction = &VertexIterator::pumpByPoint;
-        break;
-    }
+    int count;
+    FaceIndex operator[](int i) const { return FaceIndex(i); }
+};
 
-    init();
-
-}
+struct ListedFaces
+{
+    const FaceIndex* ids;
+    int count;
+    FaceIndex operator[](int i) const { return ids[i]; }
+};
 
-VertexIterator::VertexIterator(SourceArrays& sa, VertexBufferDraft& bufferDraft, Type type, ActionType actionType)
-    : VertexIterator(sa, (bufferDraft.registerForFrame(&sa)), type, actionType)
+inline float* writeVector(float* out, const QVector3D& v)
 {
-    this->bufferDraft = &bufferDraft;
+    out[0] = v.x();
+    out[1] = v.y();
+    out[2] = v.z();
+    return out + 3;
 }
 
-
-
-VertexIterator::VertexIterator(SourceArrays& sa, QVector<FaceIndex>* faceIds, QVector<float>& target, Type type, ActionType actionType)
-    : sourceArrays(sa),
-      targetArray(&target),
-      faceIndex(0),
-      infaceIndex(0),
-      pointIndex(0),
-      faceIds(faceIds),
-      type(type),
-      bufferDraft(0)
+template <VertexIterator::Type type, VertexIterator::ActionType action, typename Faces>
+void pumpFaces(SourceArrays& sa, const Faces& faces, FaceIndex faceIdOffset, const VertexIterator::PointCallback& callback, float* out)
 {
-    setAction(actionType);
-    faceIndexer = new IndexerIndirect<FaceIndex>(*faceIds);
-    switch (type)
+    typedef FaceSteps<type> Steps;
+    QVector3D* points = (action == VertexIterator::ACTION_CALLBACK_POINT) ? sa.points.data() : nullptr;
+    const QVector3D* constPoints = sa.points.constData();
+    const Triangle* triangles = sa.faces.constData();
+    const QVector3D* normals = (action == VertexIterator::ACTION_PUSH_NORMAL) ? sa.faceNormals().constData() : nullptr;
+
+    for (int i = 0; i < faces.count; i++)
     {
-        case ITERATE_TRIANGLES:
-            faceIndexer = new IndexerIndirect<FaceIndex>(*faceIds,{0,0,1});
-            pumpFunction = &VertexIterator::pumpByFace;
-        break;
-        case ITERATE_TRIANGLES_TO_LINES:
-            faceIndexer = new IndexerIndirect<FaceIndex>(*faceIds,{0,0,0,0,0,1});
-            pumpFunction = &VertexIterator::pumpByFace;
-        break;
-        case ITERATE_PER_TRIANGLE:
-            assert(false); // throw error for now. Have a better look at spoint point - TODO
-        break;
+        const FaceIndex faceIndex = faces[i];
+        for (int step = 0; step < Steps::COUNT; step++)
+        {
+            const PointIndex pointIndex = triangles[faceIndex].points[Steps::corner(step)];
+            switch (action)
+            {
+                case VertexIterator::ACTION_PUSH_POINT:
+                    out = writeVector(out, constPoints[pointIndex]);
+                break;
+                case VertexIterator::ACTION_PUSH_FACEID:
+                    out = writeVector(out, hideIntInVector3D(faceIdOffset + faceIndex));
+                break;
+                case VertexIterator::ACTION_PUSH_NORMAL:
+                    out = writeVector(writeVector(writeVector(out, normals[faceIndex]), normals[faceIndex]), normals[faceIndex]);
+                break;
+                case VertexIterator::ACTION_CALLBACK_POINT:
+                    callback(points[pointIndex]);
+                break;
+                case VertexIterator::ACTION_PUSH_POINT_FACEID:
+                    out = writeVector(writeVector(out, constPoints[pointIndex]), hideIntInVector3D(faceIdOffset + faceIndex));
+                break;
+            }
+        }
     }
-
-    init();
 }
 
-VertexIterator::VertexIterator(SourceArrays& sa, QVector<FaceIndex>* faceIds, VertexBufferDraft& bufferDraft, Type type, ActionType actionType)
-    : VertexIterator(sa, faceIds, *(bufferDraft.registerForFrame(&sa)), type, actionType)
+template <VertexIterator::ActionType action>
+void pumpPoints(SourceArrays& sa, const VertexIterator::PointCallback& callback, float* out)
 {
-    this->bufferDraft = &bufferDraft;
+    const int count = sa.points.size();
+    if (action == VertexIterator::ACTION_CALLBACK_POINT)
+    {
+        QVector3D* points = sa.points.data();
+        for (int point_i = 0; point_i < count; point_i++)
+            callback(points[point_i]);
+    }
+    else
+    {
+        const QVector3D* points = sa.points.constData();
+        for (int point_i = 0; point_i < count; point_i++)
+            out = writeVector(out, points[point_i]);
+    }
 }
 
-VertexIterator::~VertexIterator()
+// where pumped floats go: a block of a draft or the end of a plain target
+struct Output
 {
-    delete faceIndexer;
-    faceIndexer = nullptr;
-}
+    const SourceArrays* mesh;
+    QVector<float>* target;
+    VertexBufferDraft* draft;
 
-// pushes point indexed by faces[faceIndex]/points[infaceIndex]
-void VertexIterator::action_pushFacePoint()
-{
-    const QVector3D& v = sourceArrays.points[ sourceArrays.faces[faceIndex].points[infaceIndex] ];
-    targetArray->append(v.x());
-    targetArray->append(v.y());
-    targetArray->append(v.z());
-}
+    // null if the mesh already has a block in the draft
+    float* reserve(int floatCount) const
+    {
+        return draft ? draft->reserveBlock(mesh, floatCount) : reserveFloats(*target, floatCount);
+    }
+};
 
-// pushes faceIndex after encoding
-void VertexIterator::action_pushFaceId()
+template <VertexIterator::Type type, VertexIterator::ActionType action, typename Faces>
+void pumpFacesInto(SourceArrays& sa, const Faces& faces, FaceIndex faceIdOffset, const VertexIterator::PointCallback& callback, const Output& output)
 {
-    QVector3D faceidAsVector = hideIntInVector3D(faceIndex);
-    targetArray->append(faceidAsVector.x());
-    targetArray->append(faceidAsVector.y());
-    targetArray->append(faceidAsVector.z());
+    const int floatCount = faces.count * FaceSteps<type>::COUNT * StepFloats<action>::COUNT;
+    float* out = output.reserve(floatCount);
+    if (out || floatCount == 0)
+        pumpFaces<type, action>(sa, faces, faceIdOffset, callback, out);
 }
 
-// pushes poinnt index by points[pointIndex]
-void VertexIterator::action_pushPoint()
+// turns the runtime action of a face iteration into a template argument
+template <VertexIterator::Type type, typename Faces>
+void pumpFacesAs(VertexIterator::ActionType action, SourceArrays& sa, const Faces& faces, FaceIndex faceIdOffset, const VertexIterator::PointCallback& callback, const Output& output)
 {
-    QVector3D& v = sourceArrays.points[ pointIndex ];
-    targetArray->append(v.x());
-    targetArray->append(v.y());
-    targetArray->append(v.z());
+    switch (action)
+    {
+        case VertexIterator::ACTION_PUSH_POINT:
+            pumpFacesInto<type, VertexIterator::ACTION_PUSH_POINT>(sa, faces, faceIdOffset, callback, output);
+        break;
+        case VertexIterator::ACTION_PUSH_FACEID:
+            pumpFacesInto<type, VertexIterator::ACTION_PUSH_FACEID>(sa, faces, faceIdOffset, callback, output);
+        break;
+        case VertexIterator::ACTION_PUSH_NORMAL:
+            pumpFacesInto<type, VertexIterator::ACTION_PUSH_NORMAL>(sa, faces, faceIdOffset, callback, output);
+        break;
+        case VertexIterator::ACTION_CALLBACK_POINT:
+            pumpFacesInto<type, VertexIterator::ACTION_CALLBACK_POINT>(sa, faces, faceIdOffset, callback, output);
+        break;
+        case VertexIterator::ACTION_PUSH_POINT_FACEID:
+            pumpFacesInto<type, VertexIterator::ACTION_PUSH_POINT_FACEID>(sa, faces, faceIdOffset, callback, output);
+        break;
+    }
 }
 
-// calculates single normal vector for face indexed by faces[faceIndex] and triple-pushes it.
-void VertexIterator::action_pushNormal()
+template <typename Faces>
+void pumpFacesOf(VertexIterator::Type type, VertexIterator::ActionType action, SourceArrays& sa, const Faces& faces, FaceIndex faceIdOffset, const VertexIterator::PointCallback& callback, const Output& output)
 {
-    QVector3D n = sourceArrays.faceNormal(faceIndex);
-    for (int i=0; i<3; i++) // same normal for all points of a face
+    switch (type)
     {
-        targetArray->append(n.x());
-        targetArray->append(n.y());
-        targetArray->append(n.z());
+        case VertexIterator::ITERATE_TRIANGLES:
+            pumpFacesAs<VertexIterator::ITERATE_TRIANGLES>(action, sa, faces, faceIdOffset, callback, output);
+        break;
+        case VertexIterator::ITERATE_TRIANGLES_TO_LINES:
+            pumpFacesAs<VertexIterator::ITERATE_TRIANGLES_TO_LINES>(action, sa, faces, faceIdOffset, callback, output);
+        break;
+        case VertexIterator::ITERATE_PER_TRIANGLE:
+            pumpFacesAs<VertexIterator::ITERATE_PER_TRIANGLE>(action, sa, faces, faceIdOffset, callback, output);
+        break;
+        case VertexIterator::ITERATE_POINTS:
+            assert(false); // handled by pumpPoints()
+        break;
     }
 }
 
-// invokes callback passing it point indexed by faces[faceIndex]/points[infaceIndex]
-void VertexIterator::action_callbackFacePoint()
+} // anonymous namespace
+
+VertexIterator::VertexIterator(SourceArrays& sourceArrays, Type type, ActionType actionType, PointCallback pointCallback)
+    : VertexIterator(sourceArrays, 0, type, actionType)
 {
-    QVector3D& v = sourceArrays.points[ sourceArrays.faces[faceIndex].points[infaceIndex] ];
-    pointCallback(v);
+    this->pointCallback = pointCallback;
 }
 
-void VertexIterator::action_callbackPoint()
+VertexIterator::VertexIterator(SourceArrays& sa, QVector<float>* target, Type type, ActionType actionType)
+    : sourceArrays(sa),
+      type(type),
+      actionType(actionType),
+      targetArray(target),
+      bufferDraft(0)
 {
-    QVector3D& v = sourceArrays.points[ pointIndex ];
-    pointCallback(v);
 }
 
-/// Iterate on faces and points within them.
-bool VertexIterator::pumpByFace()
+VertexIterator::VertexIterator(SourceArrays& sa, VertexBufferDraft& bufferDraft, Type type, ActionType actionType)
+    : VertexIterator(sa, 0, type, actionType)
 {
-    if (!faceIndexer->available())
-        return false;
-
-    faceIndex = faceIndexer->get();
-    infaceIndex = pointIndexer->get();
-
-    (this->*actionFunction)();
-
-    faceIndexer->next();
-    pointIndexer->next();
-
-    return true;
+    this->bufferDraft = &bufferDraft;
 }
 
-/// Iterate on faces only (i.e. do not touch point indexer) and perform action once for each iteration.
-bool VertexIterator::pumpByFaceOnly() // i.e. do not touch point indexer
+VertexIterator::VertexIterator(SourceArrays& sa, QVector<FaceIndex>* faceIds, QVector<float>& target, Type type, ActionType actionType)
+    : VertexIterator(sa, &target, type, actionType)
 {
-    if (!faceIndexer->available())
-        return false;
-
-    faceIndex = faceIndexer->get();
-    (this->*actionFunction)();
-    faceIndexer->next();
-
-    return true;
+    assert(type != ITERATE_POINTS && type != ITERATE_PER_TRIANGLE); // points don't go through the lookup table
+    this->faceIds = faceIds;
 }
 
-/// Push source point to target, move to next point. Ignore source faces, assume ACTION_PUSH_POINT.
-bool VertexIterator::pumpByPoint()
+VertexIterator::VertexIterator(SourceArrays& sa, QVector<FaceIndex>* faceIds, VertexBufferDraft& bufferDraft, Type type, ActionType actionType)
+    : VertexIterator(sa, bufferDraft, type, actionType)
 {
-    if (!pointIndexer->available())
-        return false;
-
-    pointIndex = pointIndexer->get();
-    (this->*actionFunction)();
-
-    return pointIndexer->next();
+    assert(type != ITERATE_POINTS && type != ITERATE_PER_TRIANGLE);
+    this->faceIds = faceIds;
 }
 
-/// Opaque interface for pumpBy* functions.
-bool VertexIterator::pump()
+void VertexIterator::setFaceIdOffset(FaceIndex offset)
 {
-    return (this->*pumpFunction)();
+    faceIdOffset = offset;
 }
 
-/// Performs pump cycles until points/faces end. If a vertex buffer draft was given, it will mark pumped block offset and size.
+/// Pumps all points/faces in one go. With a vertex buffer draft, the output becomes the block of this mesh in the draft.
 void VertexIterator::pumpAll()
 {
-    if (bufferDraft)
+    const Output output = {&sourceArrays, targetArray, bufferDraft};
+    if (type == ITERATE_POINTS)
     {
-        bufferDraft->startCountingPumped();
-        while (pump()) {};
-        bufferDraft->stopCountingPumped();
-    } else
+        assert(actionType == ACTION_PUSH_POINT || actionType == ACTION_CALLBACK_POINT); // points have no face to take ids or normals from
+        if (actionType == ACTION_CALLBACK_POINT)
+            pumpPoints<ACTION_CALLBACK_POINT>(sourceArrays, pointCallback, nullptr);
+        else if (float* out = output.reserve(3 * sourceArrays.points.size()))
+            pumpPoints<ACTION_PUSH_POINT>(sourceArrays, pointCallback, out);
+    }
+    else if (faceIds)
     {
-        while (pump()) {};
+        const ListedFaces faces = {faceIds->constData(), faceIds->size()};
+        pumpFacesOf(type, actionType, sourceArrays, faces, faceIdOffset, pointCallback, output);
     }
-}
-
-void VertexIterator::setAction(ActionType t)
-{
-    switch (t)
+    else
     {
-        case ACTION_PUSH_POINT:
-            if (type == ITERATE_POINTS)
-                actionFunction = &VertexIterator::action_pushPoint;
-            else
-                actionFunction = &VertexIterator::action_pushFacePoint;
-        break;
-        case ACTION_PUSH_FACEID:
-            actionFunction = &VertexIterator::action_pushFaceId;
-        break;
-        case ACTION_PUSH_NORMAL:
-            actionFunction = &VertexIterator::action_pushNormal;
-        break;
-        case ACTION_CALLBACK_POINT:
-            if (type == ITERATE_POINTS)
-                actionFunction = &VertexIterator::action_callbackPoint;
-            else
-                actionFunction = &VertexIterator::action_callbackFacePoint;
-        break;
+        const AllFaces faces = {sourceArrays.faces.size()};
+        pumpFacesOf(type, actionType, sourceArrays, faces, faceIdOffset, pointCallback, output);
     }
-    actionType = t;
 
+    if (actionType == ACTION_CALLBACK_POINT)
+        sourceArrays.pointsChanged(); // the callback gets points by reference and may have moved them
 }
 
 
@@ -314,211 +354,330 @@ void Mesh::chew(ChewType chewType)
 
     chewTypeUsed = chewType;
 
-    // pupulate point graph array. Find all connection/edges between points.
+    // everything comes from a single edge table, which isn't needed afterwards
     if (chewType.bits.graph)
+        graph();
+    edgeFaces();
+    faceFaces();
+    releaseEdgeTable();
+}
+
+const EdgeTable& SourceArrays::edgeTable() const
+{
+    if (!(built & SECONDARY_EDGETABLE))
     {
-        graph.resize(points.size());
-        if (!faces.empty())
-        {
-            for (int face_i=0; face_i < faces.size(); face_i++ )
+        edgeTableData.build(faces, points.size());
+        built |= SECONDARY_EDGETABLE;
+    }
+    return edgeTableData;
+}
+
+void SourceArrays::releaseEdgeTable()
+{
+    built &= ~SECONDARY_EDGETABLE;
+    edgeTableData.clear();
+}
+
+const PointGraph& SourceArrays::graph() const
+{
+    // pupulate point graph array. The two points of each edge are connected.
+    if (!(built & SECONDARY_GRAPH))
+    {
+        const EdgeTable& edges = edgeTable();
+        graphData.build(points.size(), edges.edgeCount(), [this, &edges](PointGraph::Builder& builder, int first, int last) {
+            for (int edge_i = first; edge_i < last; edge_i++)
             {
-                Triangle& triangle = faces[face_i];
-                graph.putPair(triangle.points[0], triangle.points[1]);
-                graph.putPair(triangle.points[1], triangle.points[2]);
-                graph.putPair(triangle.points[2], triangle.points[0]);
+                const EdgeTable::HalfEdgeIndex h = edges.edge(edge_i)[0];
+                const PointIndex m = EdgeTable::from(faces, h);
+                const PointIndex n = EdgeTable::to(faces, h);
+                builder.put(m, n);
+                builder.put(n, m);
             }
-        }
+        });
+        built |= SECONDARY_GRAPH;
     }
+    return graphData;
+}
 
-    // populate pointFaces array. Be able to tell which faces are adjacent to any point.
-    if (!faces.empty())
+const Adjacency<FaceIndex>& SourceArrays::pointFaces() const
+{
+    // populate pointFaces array. Each face on an edge is adjacent to both points of the edge.
+    if (!(built & SECONDARY_POINTFACES))
     {
-        // clear pointFaces. Initially, each point should have 0 adjacent faces
-        pointFaces.resize(points.size());
-        for (int point_i=0; point_i<pointFaces.size(); point_i++)
-        {
-            pointFaces[point_i].clear();
-        }
-        // Populate pointFaces array. Find faces for each point.
-        for (int face_i=0; face_i < faces.size(); face_i++ )
-        {
-            Triangle& triangle = faces[face_i];
-            for (PointIndex point_i=0; point_i < Triangle::PointCount; point_i++)
+        const EdgeTable& edges = edgeTable();
+        pointFacesData.build(points.size(), edges.edgeCount(), [this, &edges](Adjacency<FaceIndex>::Builder& builder, int first, int last) {
+            for (int edge_i = first; edge_i < last; edge_i++)
             {
-                QVector<FaceIndex>& faces_for_point = pointFaces[triangle.points[point_i]];
-                if (! faces_for_point.contains(face_i))
+                for (EdgeTable::HalfEdgeIndex h : edges.edge(edge_i))
                 {
-                    faces_for_point.append(face_i);
+                    builder.put(EdgeTable::from(faces, h), EdgeTable::face(h));
+                    builder.put(EdgeTable::to(faces, h), EdgeTable::face(h));
                 }
             }
-        }
-        // populate faceFaces
-        faceFaces.resize(faces.size());
-        for (int face_i=0; face_i < faces.size(); face_i++ )
-        {
-            faceFaces[face_i].clear();
+        });
+        built |= SECONDARY_POINTFACES;
+    }
+    return pointFacesData;
+}
 
-            Triangle& triangle = faces[face_i];
-            for (PointIndex point_i=0; point_i < Triangle::PointCount; point_i++)
+const Adjacency<FaceIndex>& SourceArrays::faceFaces() const
+{
+    // populate faceFaces. Faces sharing a point with a face are adjacent to it, the face included.
+    if (!(built & SECONDARY_FACEFACES))
+    {
+        const Adjacency<FaceIndex>& facesOfPoints = pointFaces();
+        faceFacesData.build(faces.size(), faces.size(), [this, &facesOfPoints](Adjacency<FaceIndex>::Builder& builder, int first, int last) {
+            for (int face_i = first; face_i < last; face_i++)
             {
-                // get all adjacent faces for this point of the triangle
-                QVector<FaceIndex>& faces_for_point = pointFaces[triangle.points[point_i]];
-                for (int pointfaces_i=0; pointfaces_i < faces_for_point.size(); pointfaces_i++)
+                const Triangle& triangle = faces[face_i];
+                for (int point_i=0; point_i < Triangle::PointCount; point_i++)
                 {
-                    // push adjacent faces of the triangle's point to the faceFaces array, if not already there
-                    if ( ! faceFaces[face_i].contains(faces_for_point[pointfaces_i]) )
+                    for (FaceIndex adjacent_i : facesOfPoints[triangle.points[point_i]])
+                        builder.put(face_i, adjacent_i);
+                }
+            }
+        });
+        built |= SECONDARY_FACEFACES;
+    }
+    return faceFacesData;
+}
+
+const Adjacency<FaceIndex>& SourceArrays::edgeFaces() const
+{
+    // populate edgeFaces. Twins give the neighbour across a manifold edge, other edges make all their faces adjacent.
+    if (!(built & SECONDARY_EDGEFACES))
+    {
+        const EdgeTable& edges = edgeTable();
+        edgeFacesData.build(faces.size(), edges.edgeCount(), [&edges](Adjacency<FaceIndex>::Builder& builder, int first, int last) {
+            for (int edge_i = first; edge_i < last; edge_i++)
+            {
+                const auto halfEdges = edges.edge(edge_i);
+                const EdgeTable::HalfEdgeIndex twin = edges.twin(halfEdges[0]);
+                if (twin != EdgeTable::NO_TWIN)
+                {
+                    builder.put(EdgeTable::face(halfEdges[0]), EdgeTable::face(twin));
+                    builder.put(EdgeTable::face(twin), EdgeTable::face(halfEdges[0]));
+                    continue;
+                }
+                for (EdgeTable::HalfEdgeIndex h : halfEdges)
+                {
+                    for (EdgeTable::HalfEdgeIndex other : halfEdges)
                     {
-                        faceFaces[face_i].append(faces_for_point[pointfaces_i]);
+                        if (EdgeTable::face(h) != EdgeTable::face(other))
+                            builder.put(EdgeTable::face(h), EdgeTable::face(other));
                     }
                 }
             }
-        }
+        });
+        built |= SECONDARY_EDGEFACES;
     }
-
-
+    return edgeFacesData;
 }
 
-void Mesh::swallow(Core::VertexBufferDraft& targetDraft)
+const QVector<QVector3D>& SourceArrays::faceNormals() const
 {
-    QVector<float>* target = targetDraft.registerForFrame(this);
-    if (target != nullptr)
+    if (!(built & SECONDARY_FACENORMALS))
     {
-        VertexIterator vi(*this, target, Core::VertexIterator::ITERATE_POINTS, Core::VertexIterator::ACTION_PUSH_POINT);
-        while (vi.pumpByPoint()) {};
+        faceNormalsData.resize(faces.size());
+        QVector3D* normalsOut = faceNormalsData.data();
+        forRanges(faces.size(), [this, normalsOut](int first, int last) {
+            for (int face_i = first; face_i < last; face_i++)
+                normalsOut[face_i] = faceNormal(face_i);
+        });
+        built |= SECONDARY_FACENORMALS;
     }
+    return faceNormalsData;
 }
 
-void Mesh::generateMetrics()
+void SourceArrays::pointsChanged()
 {
-    float maxfloat = std::numeric_limits<float>::max();
-    float minfloat = std::numeric_limits<float>::min();
-    this->minPoint = QVector3D(maxfloat, maxfloat, maxfloat);
-    this->maxPoint = QVector3D(minfloat, minfloat, minfloat);
-    QVector3D& minPoint = this->minPoint;
-    QVector3D& maxPoint = this->maxPoint;
-
-    VertexIterator vi(*this, Core::VertexIterator::ITERATE_POINTS, Core::VertexIterator::ACTION_CALLBACK_POINT, [&minPoint, &maxPoint](QVector3D& point){
-        // find min
-        if (point.x() < minPoint.x())
-            minPoint.setX(point.x());
-        if (point.y() < minPoint.y())
-            minPoint.setY(point.y());
-        if (point.z() < minPoint.z())
-            minPoint.setZ(point.z());
-        // find max
-        if (point.x() > maxPoint.x())
-            maxPoint.setX(point.x());
-        if (point.y() > maxPoint.y())
-            maxPoint.setY(point.y());
-        if (point.z() > maxPoint.z())
-            maxPoint.setZ(point.z());
+    built &= ~SECONDARY_FACENORMALS;
+    faceNormalsData.clear();
+}
 
-    });
-    vi.pumpAll();
-    centerPoint = (minPoint + maxPoint)/2;
-    width = maxPoint.x() - minPoint.x();
-    height = maxPoint.y() - minPoint.y();
-    depth = maxPoint.z() - minPoint.z();
+void SourceArrays::facesChanged()
+{
+    built = 0;
+    edgeTableData.clear();
+    graphData.clear();
+    pointFacesData.clear();
+    faceFacesData.clear();
+    edgeFacesData.clear();
+    faceNormalsData.clear();
+}
 
-    boundingRadius = sqrt(width*width + height*height + depth*depth);
+void SourceArrays::transform(const AffineTransform& transform)
+{
+    transformPoints(transform, points.data(), points.size());
 
-    qDebug() << "min point: " << minPoint;
-    qDebug() << "max point: " << maxPoint;
-    qDebug() << "mid point: " << centerPoint;
-    qDebug() << "dimensions: " << width << " " << height << " " << depth;
-    qDebug() << "bounding radius: " << boundingRadius;
+    const AffineTransform normalTransform = transform.normalTransform();
+    transformNormals(normalTransform, normals.data(), normals.size());
+    if (built & SECONDARY_FACENORMALS)
+        transformNormals(normalTransform, faceNormalsData.data(), faceNormalsData.size());
 }
 
-/*
-Mesh::ChewType Mesh::chewType()
+const EdgeTable::HalfEdgeIndex EdgeTable::NO_TWIN;
+
+// returns the counter and adds one to it. Plain loads and stores do when a single thread counts.
+static quint32 increment(std::atomic<quint32>& counter, bool concurrent)
 {
-    return chewTypeUsed;
+    if (concurrent)
+        return counter.fetch_add(1, std::memory_order_relaxed);
+    const quint32 count = counter.load(std::memory_order_relaxed);
+    counter.store(count + 1, std::memory_order_relaxed);
+    return count;
 }
-*/
 
-// resize and clear
-void PointGraph::resize(size_t pointCount/*, size_t relatedCount*/)
+void EdgeTable::build(const QVector<Triangle>& faces, int pointCount)
 {
-/*
-    size_t area = pointCount * relatedCount;
+    const int halfEdgeCount = faces.size() * Triangle::PointCount;
+    auto lowerPoint = [&faces](HalfEdgeIndex h) {
+        const Triangle& triangle = faces[face(h)];
+        return std::min(triangle.points[corner(h)], triangle.points[(corner(h) + 1) % Triangle::PointCount]);
+    };
+    auto upperPoint = [&faces](HalfEdgeIndex h) {
+        const Triangle& triangle = faces[face(h)];
+        return std::max(triangle.points[corner(h)], triangle.points[(corner(h) + 1) % Triangle::PointCount]);
+    };
 
-    if (pointCount == 0 || relatedCount == 0)
-    {
-        qDebug() << "invalid dimmensions for PointGraph";
-        return STATUS_ERROR;
-    }
-
-    // if "area" of new connections array is different we need to re-allocate
-    if (area != this->pointCount * this->maxRelatedCount)
+    // bucket half-edges by their lower point, a counting sort over ranges of half-edges
+    std::unique_ptr<std::atomic<quint32>[]> counters(new std::atomic<quint32>[size_t(pointCount)]());
+    const bool concurrent = rangeCount(halfEdgeCount) > 1;
+    forRanges(halfEdgeCount, [&counters, concurrent, &lowerPoint](int first, int last) {
+        for (HalfEdgeIndex h = first; h < HalfEdgeIndex(last); h++)
+            increment(counters[lowerPoint(h)], concurrent);
+    });
+    std::vector<quint32> bucketStarts(size_t(pointCount) + 1);
+    bucketStarts[0] = 0;
+    for (int point_i = 0; point_i < pointCount; point_i++)
     {
-        delete [] connections;
-        pointCount = this->pointCount;
-        relatedCount = this->maxRelatedCount;
-        connections = new PointIndex[area];
+        bucketStarts[point_i + 1] = bucketStarts[point_i] + counters[point_i].load(std::memory_order_relaxed);
+        counters[point_i].store(bucketStarts[point_i], std::memory_order_relaxed);
     }
 
-    // reset content
-    std::fill(connections, connections+area, EMPTY_VALUE);
-    */
+    order.resize(halfEdgeCount);
+    forRanges(halfEdgeCount, [this, &counters, concurrent, &lowerPoint](int first, int last) {
+        for (HalfEdgeIndex h = first; h < HalfEdgeIndex(last); h++)
+            order[increment(counters[lowerPoint(h)], concurrent)] = h;
+    });
+    counters.reset();
 
-    connections.resize(pointCount);
-    //connections.squeeze(); // TODO - release memory for point entries that are now not used
-    for (int point_i = 0; point_i < connections.size(); point_i++)
-    {
-        connections[point_i].clear();
+    // sort buckets by upper point and the half-edge index, which undoes the scatter order. Half-edges of an
+    // edge end up next to each other.
+    std::vector<quint32> bucketEdges(size_t(pointCount) + 1, 0); // edges in each bucket, shifted by one
+    forRanges(pointCount, [this, &bucketStarts, &bucketEdges, &upperPoint](int first, int last) {
+        for (int point_i = first; point_i < last; point_i++)
+        {
+            HalfEdgeIndex* begin = order.data() + bucketStarts[point_i];
+            HalfEdgeIndex* end = order.data() + bucketStarts[point_i + 1];
+            std::sort(begin, end, [&upperPoint](HalfEdgeIndex a, HalfEdgeIndex b) {
+                const PointIndex upperA = upperPoint(a);
+                const PointIndex upperB = upperPoint(b);
+                return upperA < upperB || (upperA == upperB && a < b);
+            });
+            for (HalfEdgeIndex* h = begin; h != end; h++)
+            {
+                if (h == begin || upperPoint(*h) != upperPoint(h[-1]))
+                    bucketEdges[point_i + 1]++;
+            }
+        }
+    }, 1 << 12);
+    std::partial_sum(bucketEdges.begin(), bucketEdges.end(), bucketEdges.begin());
+
+    // mark where edges start and link twins, bucket by bucket
+    edgeStarts.resize(bucketEdges.back() + 1);
+    edgeStarts.back() = quint32(halfEdgeCount);
+    twins.assign(halfEdgeCount, NO_TWIN);
+    forRanges(pointCount, [this, &faces, &bucketStarts, &bucketEdges, &upperPoint](int first, int last) {
+        for (int point_i = first; point_i < last; point_i++)
+        {
+            quint32 edge_i = bucketEdges[point_i];
+            HalfEdgeIndex* begin = order.data() + bucketStarts[point_i];
+            HalfEdgeIndex* end = order.data() + bucketStarts[point_i + 1];
+            while (begin != end)
+            {
+                const PointIndex upper = upperPoint(*begin);
+                HalfEdgeIndex* run = begin;
+                while (run != end && upperPoint(*run) == upper)
+                    run++;
+
+                edgeStarts[edge_i++] = quint32(begin - order.data());
+                // two half-edges running in opposite directions are twins
+                if (run - begin == 2 && faces[face(begin[0])].points[corner(begin[0])] != faces[face(begin[1])].points[corner(begin[1])])
+                {
+                    twins[begin[0]] = begin[1];
+                    twins[begin[1]] = begin[0];
+                }
+                begin = run;
+            }
+        }
+    }, 1 << 12);
+}
 
-    }
+void EdgeTable::clear()
+{
+    std::vector<HalfEdgeIndex>().swap(order);
+    std::vector<quint32>().swap(edgeStarts);
+    std::vector<HalfEdgeIndex>().swap(twins);
 }
 
-void PointGraph::putPair(PointIndex m, PointIndex n)
+void Mesh::swallow(Core::VertexBufferDraft& targetDraft)
 {
-    //assert((int)m < pointCount);
-    //assert((int)n < pointCount);
+    VertexIterator vi(*this, targetDraft, Core::VertexIterator::ITERATE_POINTS, Core::VertexIterator::ACTION_PUSH_POINT);
+    vi.pumpAll();
+}
 
-    if (connections[m].indexOf(n) == -1)
+void Mesh::generateMetrics()
+{
+    if (points.isEmpty())
     {
-        connections[m].append(n);
+        setBounds(QVector3D(), QVector3D());
+        return;
     }
 
-    if (connections[n].indexOf(m) == -1)
-    {
-        connections[n].append(m);
-    }
+    // each range of points is measured along the three axes, then ranges are merged
+    float lowest[3], highest[3];
+    std::fill(lowest, lowest + 3, std::numeric_limits<float>::max());
+    std::fill(highest, highest + 3, std::numeric_limits<float>::lowest());
+    QMutex merging;
+    forRanges(points.size(), [&](int first, int last) {
+        float rangeLowest[3], rangeHighest[3];
+        std::fill(rangeLowest, rangeLowest + 3, std::numeric_limits<float>::max());
+        std::fill(rangeHighest, rangeHighest + 3, std::numeric_limits<float>::lowest());
+        pointRange(points.constData() + first, size_t(last - first), rangeLowest, rangeHighest);
+        QMutexLocker locker(&merging);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            lowest[axis] = std::min(lowest[axis], rangeLowest[axis]);
+            highest[axis] = std::max(highest[axis], rangeHighest[axis]);
+        }
+    }, 1 << 16);
+    setBounds(QVector3D(lowest[0], lowest[1], lowest[2]), QVector3D(highest[0], highest[1], highest[2]));
 
+    qDebug() << "min point: " << minPoint;
+    qDebug() << "max point: " << maxPoint;
+    qDebug() << "mid point: " << centerPoint;
+    qDebug() << "dimensions: " << width << " " << height << " " << depth;
+    qDebug() << "bounding radius: " << boundingRadius;
 }
 
-void PointGraph::clear()
+void Mesh::setBounds(const QVector3D& minPoint, const QVector3D& maxPoint)
 {
-    connections.clear();
-    pointCount = 0;
+    this->minPoint = minPoint;
+    this->maxPoint = maxPoint;
+    centerPoint = (minPoint + maxPoint)/2;
+    width = maxPoint.x() - minPoint.x();
+    height = maxPoint.y() - minPoint.y();
+    depth = maxPoint.z() - minPoint.z();
+
+    boundingRadius = sqrt(width*width + height*height + depth*depth);
 }
 
 /*
-void PointGraph::putPoint(PointIndex basePoint, PointIndex relative)
+Mesh::ChewType Mesh::chewType()
 {
-    PointIndex* baseColumn = connections + basePoint*this->maxRelatedCount;
-    PointIndex relative_i = 0;
-    while (relative_i < this->maxRelatedCount)
-    {
-        if (baseColumn[relative_i] == EMPTY_VALUE)
-        {
-            baseColumn[relative_i] = relative;
-            break;
-        } else
-        {
-
-        }
-    }
+    return chewTypeUsed;
 }
 */
 
-PointGraph::~PointGraph()
-{
-    /*if ( ! connections )
-        return;
-
-    delete [] connections;
-    connections =  nullptr;*/
-}
-
 } // namespace Core
@@ -5,12 +5,20 @@
 #include <QVector>
 #include "qmatrix4x4.h"
 #include "qvector3d.h"
+#include "pointrange.h"
+#include "pointtransform.h"
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <numeric>
+#include <vector>
 
 
 namespace Utils
 {
     class Loader; // forward declaration
+    class MeshCache;
 }
 
 namespace Core {
@@ -27,31 +35,196 @@ enum Status
 typedef unsigned int PointIndex; // integer type that points to an array of vertices
 typedef unsigned int FaceIndex;
 
+/**
+ * @brief Limits the threads used by parallel mesh processing
+ *
+ * Work runs on the global QThreadPool, which is limited as well.
+ *
+ * @param threadCount 0 to use as many threads as there are cores
+ */
+void setMaxThreads(int threadCount);
+int maxThreads();
+
+/**
+ * @brief Splits items 0 to itemCount-1 into consecutive ranges and calls work(first, last) for each, in parallel
+ *
+ * Ranges hold at least minRangeSize items unless there are fewer items. Returns
+ * when all ranges are done. With a single thread allowed, work runs once in the
+ * calling thread for all items.
+ */
+void forRanges(int itemCount, const std::function<void(int first, int last)>& work, int minRangeSize = 1 << 14);
+int rangeCount(int itemCount, int minRangeSize = 1 << 14); // number of ranges forRanges() splits items into
+
 
 /*!
-    \brief Keeps connections between points
+    \brief Lists of indices stored flat, in compressed sparse row layout
+
+    List i holds values[offsets[i]] up to values[offsets[i+1]], so all lists
+    take two allocations however many they are. Lists are sorted and have no
+    duplicates. Fill with build(), read with operator[].
 */
-struct PointGraph
+template <typename T>
+class Adjacency
 {
-    QVector<QVector<PointIndex>> connections; // for each point holds an array of point this is connected to - TODO: set default size to 0
-    int pointCount = 0;  // 0 is an invalid value if PointGraph has been initialized
+public:
+    /// Read only range over the values of a single list
+    class List
+    {
+        const T* first;
+        const T* last;
+
+    public:
+        List(const T* first, const T* last) : first(first), last(last) {}
+
+        const T* begin() const { return first; }
+        const T* end() const { return last; }
+        int size() const { return int(last - first); }
+        bool isEmpty() const { return first == last; }
+        const T& operator[](int i) const { return first[i]; }
+        bool contains(T value) const { return std::binary_search(first, last, value); }
+    };
 
-    // non-qt implementation
-    //PointIndex* connections = nullptr; // a 2X2 array owned by PointGraph
-    //int maxRelatedCount = 0; // same for relatedCount
+    /// Receives the values of the lists while build() runs. Values can come in any order and from several threads at once.
+    class Builder
+    {
+        friend class Adjacency;
+
+        std::atomic<quint32>* counters; // counting pass: values of each list, filling pass: where the next value of each list goes
+        T* values = nullptr; // set for the filling pass
+        bool concurrent; // false if put() is called from a single thread, which saves the cost of atomic increments
+
+        Builder(std::atomic<quint32>* counters, bool concurrent) : counters(counters), concurrent(concurrent) {}
+
+        quint32 increment(int list)
+        {
+            if (concurrent)
+                return counters[list].fetch_add(1, std::memory_order_relaxed);
+            const quint32 count = counters[list].load(std::memory_order_relaxed);
+            counters[list].store(count + 1, std::memory_order_relaxed);
+            return count;
+        }
+
+    public:
+        void put(int list, T value)
+        {
+            if (values)
+                values[increment(list)] = value;
+            else
+                increment(list);
+        }
+    };
+
+    int size() const { return offsets.empty() ? 0 : int(offsets.size() - 1); } // number of lists
+    bool isEmpty() const { return offsets.empty(); }
+    size_t valueCount() const { return values.size(); }
+    List operator[](int list) const { return List(values.data() + offsets[list], values.data() + offsets[list + 1]); }
+    void clear();
 
     /**
-     * @brief Size 2X2 array containing the connections
-     * @param pointCount number of points in the mesh
-     * @param relatedCount number of joints eash point has
+     * @brief Replaces all lists with the values produced from a number of items
+     *
+     * produce(builder, first, last) is called for ranges of items from several
+     * threads, twice over: once to count the values and once to store them.
+     * It should call builder.put(list, value) for items first to last-1 the
+     * same way both times. Duplicate values of a list are dropped. Lists are
+     * sorted, so the result doesn't depend on the number of threads.
+     *
+     * @param listCount number of lists, put() accepts lists 0 to listCount-1
+     * @param itemCount number of items, e.g. faces, that values come from
+     * @param produce callable taking an Adjacency::Builder& and an item range
      */
-    void resize(size_t pointCount/*, size_t relatedCount*/);
-    void putPair(PointIndex m, PointIndex n);
+    template <typename Producer>
+    void build(int listCount, int itemCount, Producer produce);
 
-    void clear();
-    ~PointGraph();
+    // flat storage, e.g. to save it
+    const std::vector<quint32>& rawOffsets() const { return offsets; }
+    const std::vector<T>& rawValues() const { return values; }
+    void assign(const quint32* offsets, size_t offsetCount, const T* values, size_t valueCount); // copies flat storage that is known to be valid
+
+private:
+    std::vector<quint32> offsets; // listCount+1 entries, empty if there are no lists
+    std::vector<T> values;
 };
 
+template <typename T>
+void Adjacency<T>::clear()
+{
+    std::vector<quint32>().swap(offsets);
+    std::vector<T>().swap(values);
+}
+
+template <typename T>
+template <typename Producer>
+void Adjacency<T>::build(int listCount, int itemCount, Producer produce)
+{
+    clear();
+    if (listCount <= 0)
+        return;
+
+    // count the values of each list, then place them. Both passes run over ranges of items in parallel.
+    std::unique_ptr<std::atomic<quint32>[]> counters(new std::atomic<quint32>[size_t(listCount)]());
+    Builder builder(counters.get(), rangeCount(itemCount) > 1);
+    forRanges(itemCount, [&builder, &produce](int first, int last) { produce(builder, first, last); });
+
+    std::vector<quint32> starts(size_t(listCount) + 1);
+    starts[0] = 0;
+    for (int list = 0; list < listCount; list++)
+    {
+        starts[list + 1] = starts[list] + counters[list].load(std::memory_order_relaxed);
+        counters[list].store(starts[list], std::memory_order_relaxed);
+    }
+
+    std::vector<T> placed(starts.back());
+    builder.values = placed.data();
+    forRanges(itemCount, [&builder, &produce](int first, int last) { produce(builder, first, last); });
+    counters.reset();
+
+    // values of a list were placed in any order. Sort them and drop duplicates, then close the gaps left by these.
+    std::vector<quint32> uniqueCounts(listCount);
+    forRanges(listCount, [&placed, &starts, &uniqueCounts](int first, int last) {
+        for (int list = first; list < last; list++)
+        {
+            T* begin = placed.data() + starts[list];
+            T* end = placed.data() + starts[list + 1];
+            std::sort(begin, end);
+            uniqueCounts[list] = quint32(std::unique(begin, end) - begin);
+        }
+    }, 1 << 12);
+
+    offsets.resize(size_t(listCount) + 1);
+    offsets[0] = 0;
+    std::partial_sum(uniqueCounts.begin(), uniqueCounts.end(), offsets.begin() + 1);
+    if (offsets.back() == starts.back())
+    {
+        values.swap(placed);
+        return;
+    }
+    if (rangeCount(listCount) == 1)
+    {
+        // lists only move towards the front, so a single thread can close the gaps in place
+        for (int list = 0; list < listCount; list++)
+            std::copy(placed.data() + starts[list], placed.data() + starts[list] + (offsets[list + 1] - offsets[list]), placed.data() + offsets[list]);
+        placed.resize(offsets.back());
+        placed.shrink_to_fit();
+        values.swap(placed);
+        return;
+    }
+    values.resize(offsets.back());
+    forRanges(listCount, [this, &placed, &starts](int first, int last) {
+        for (int list = first; list < last; list++)
+            std::copy(placed.data() + starts[list], placed.data() + starts[list] + (offsets[list + 1] - offsets[list]), values.data() + offsets[list]);
+    });
+}
+
+template <typename T>
+void Adjacency<T>::assign(const quint32* offsets, size_t offsetCount, const T* values, size_t valueCount)
+{
+    this->offsets.assign(offsets, offsets + offsetCount);
+    this->values.assign(values, values + valueCount);
+}
+
+typedef Adjacency<PointIndex> PointGraph; // for each point, the points it shares an edge with
+
 template <int pc> // pc -> PointCount
 class Face
 {
@@ -64,28 +237,85 @@ public:
 typedef Face<3> Triangle;
 
 
+/*!
+    \brief Half-edges of a triangle mesh, grouped by the edge they lie on
+
+    Half-edge h runs from corner h%3 of face h/3 to the next corner of that
+    face. The table is built in linear time: half-edges are bucketed by their
+    lower point index and each bucket, about as large as the valence of its
+    point, is sorted by the upper point index and the half-edge index. Edges
+    come out ordered by their lower and then their upper point, whatever the
+    number of threads.
+*/
+class EdgeTable
+{
+public:
+    typedef quint32 HalfEdgeIndex;
+    static const HalfEdgeIndex NO_TWIN = ~HalfEdgeIndex(0);
+
+    void build(const QVector<Triangle>& faces, int pointCount);
+    void clear();
+    bool isEmpty() const { return edgeStarts.empty(); }
+
+    int edgeCount() const { return edgeStarts.empty() ? 0 : int(edgeStarts.size() - 1); }
+    /// Half-edges lying on an edge. Boundary edges have one, non-manifold edges more than two.
+    Adjacency<HalfEdgeIndex>::List edge(int edge_i) const
+    {
+        return Adjacency<HalfEdgeIndex>::List(order.data() + edgeStarts[edge_i], order.data() + edgeStarts[edge_i + 1]);
+    }
+    /// Opposite half-edge of h if exactly two faces share its edge with opposite winding, NO_TWIN otherwise
+    HalfEdgeIndex twin(HalfEdgeIndex h) const { return twins[h]; }
+
+    static FaceIndex face(HalfEdgeIndex h) { return h / 3; }
+    static int corner(HalfEdgeIndex h) { return h % 3; }
+    static PointIndex from(const QVector<Triangle>& faces, HalfEdgeIndex h) { return faces[face(h)].points[corner(h)]; }
+    static PointIndex to(const QVector<Triangle>& faces, HalfEdgeIndex h) { return faces[face(h)].points[(corner(h) + 1) % Triangle::PointCount]; }
+
+private:
+    std::vector<HalfEdgeIndex> order; // half-edges, those of the same edge next to each other
+    std::vector<quint32> edgeStarts; // edge i spans order[edgeStarts[i]] up to order[edgeStarts[i+1]]
+    std::vector<HalfEdgeIndex> twins;
+};
+
+
 /*!
     \brief Data model for a mesh
 
     Keeps primary point and face data as well as processed data on the mesh.
+    Processed (secondary) data is built on first access and kept until the
+    primary data it comes from changes. Whoever changes points or faces should
+    call pointsChanged() or facesChanged() afterwards. Secondary data is built
+    in place, so a SourceArrays shouldn't be read from several threads before
+    the data they need has been built.
 */
 struct SourceArrays
 {
     // primary source data
     QVector<QVector3D> points;
     QVector<Triangle> faces;
-    // secondary source data
-    PointGraph graph;
-    QVector<QVector<FaceIndex>> pointFaces; // for each point there is an array of faces. Point and face indices point to 'points' and 'faces' arrays respectively.
-    QVector<QVector<FaceIndex>> faceFaces;  // tells which faces are adjacent to a face. Faces indices point to 'faces' array.
+    QVector<QVector3D> normals; // per face normals as found in the source file. Empty if the source had none.
+
+    // secondary source data. The point graph and all face adjacency are derived from the edge table.
+    const EdgeTable& edgeTable() const;
+    const PointGraph& graph() const;
+    const Adjacency<FaceIndex>& pointFaces() const; // for each point there is an array of faces. Point and face indices point to 'points' and 'faces' arrays respectively.
+    const Adjacency<FaceIndex>& faceFaces() const;  // tells which faces are adjacent to a face, sharing at least a point. Faces indices point to 'faces' array.
+    const Adjacency<FaceIndex>& edgeFaces() const;  // faces sharing an edge with a face. Unlike faceFaces, the face itself and faces touching it at a single point are left out.
+    void releaseEdgeTable();                        // frees the edge table once what is needed has been derived from it
+    const QVector<QVector3D>& faceNormals() const;  // faceNormal() of every face
+
+    void pointsChanged(); // drops secondary data that depends on point positions
+    void facesChanged();  // drops all secondary data. Call when faces or the number of points change.
+
+    /// Maps points and normals in bulk. Face normals that are built get mapped along instead of dropped.
+    void transform(const AffineTransform& transform);
 
     void clear()
     {
         points.clear();
         faces.clear();
-        graph.clear();
-        pointFaces.clear();
-        faceFaces.clear();
+        normals.clear();
+        facesChanged();
     }
 
     QVector3D faceNormal(FaceIndex faceIndex) const
@@ -100,6 +330,27 @@ struct SourceArrays
         QVector3D n = QVector3D::normal(v1,v2);
         return n;
     }
+
+    friend class Utils::MeshCache; // saves and restores secondary data
+
+private:
+    enum SecondaryData
+    {
+        SECONDARY_GRAPH = 1,
+        SECONDARY_POINTFACES = 2,
+        SECONDARY_FACEFACES = 4,
+        SECONDARY_EDGEFACES = 8,
+        SECONDARY_FACENORMALS = 16,
+        SECONDARY_EDGETABLE = 32
+    };
+
+    mutable unsigned int built = 0; // SecondaryData flags of what is up to date
+    mutable EdgeTable edgeTableData;
+    mutable PointGraph graphData;
+    mutable Adjacency<FaceIndex> pointFacesData;
+    mutable Adjacency<FaceIndex> faceFacesData;
+    mutable Adjacency<FaceIndex> edgeFacesData;
+    mutable QVector<QVector3D> faceNormalsData;
 };
 
 /*!
@@ -217,6 +468,14 @@ public:
 
 class VertexBufferDraft;
 
+/*!
+    \brief Turns source arrays into vertex buffer data
+
+    The iteration type and action are chosen at run time but resolved once per
+    pumpAll(): each combination is a separate template instantiation whose loop
+    writes straight into a block reserved for the whole output, either with
+    VertexBufferDraft::reserveBlock() or with reserveFloats() on a plain target.
+*/
 class VertexIterator
 {
 public:
@@ -234,10 +493,9 @@ public:
         ACTION_PUSH_FACEID,
         ACTION_PUSH_NORMAL,
         ACTION_CALLBACK_POINT, // just invoke the callback passing each point
+        ACTION_PUSH_POINT_FACEID, // the point followed by the encoded id of its face, for interleaved buffers
     };
 
-    typedef bool (VertexIterator::*Pump_cb)(); // typedef a member function pointer for pumpBy*() members
-    //typedef void (*PointCallback)(const QVector3D& point);
     typedef std::function<void(QVector3D& point)> PointCallback; // a callback type to be used when iterating over points
 
     VertexIterator(SourceArrays& sourceArrays, Type type, ActionType actionType, PointCallback pointCallback);
@@ -248,45 +506,22 @@ public:
     // iterator within face id lookup table that appends to a VertexBufferDraft
     VertexIterator(SourceArrays& sa, QVector<FaceIndex>* faceIds, VertexBufferDraft& bufferDraft, Type type=ITERATE_TRIANGLES, ActionType actionType=ACTION_PUSH_POINT);
 
-    void init();
-    ~VertexIterator();
+    void setFaceIdOffset(FaceIndex offset); // added to face indices pushed by ACTION_PUSH_FACEID and ACTION_PUSH_POINT_FACEID
 
-    bool pumpByFace();
-    bool pumpByPoint();
-    bool pumpByFaceOnly();
-    bool pump();
     void pumpAll();
-    Pump_cb pumpFunction;
 
 private:
 
     SourceArrays& sourceArrays;
     const QVector<FaceIndex>* faceIds = nullptr;
 
-    Indexer<FaceIndex>* faceIndexer = nullptr;
-    Indexer<int>* pointIndexer = nullptr;
-    // variables for iterating over faces and points
-    FaceIndex faceIndex;
-    int infaceIndex;
-    int pointIndex;     // index to .points array
-
     Type type;
     ActionType actionType;
-
-    typedef void (VertexIterator::*Action_cb)(); // action callback type
-    void action_pushFacePoint(); /// Push a QVector3D point determined from faceIndec/infaceIndex to target after converting it to 3 floats.
-    void action_pushFaceId();
-    void action_pushPoint(); /// Push a QVector3D point from mesh.points into target after converting it to 3 floats.
-    void action_pushNormal();
-    void action_callbackFacePoint();
-    void action_callbackPoint();
-    Action_cb actionFunction;
     PointCallback pointCallback;
 
     QVector<float>* targetArray;
     VertexBufferDraft* bufferDraft;
-    void setAction(ActionType t);
-
+    FaceIndex faceIdOffset = 0;
 };
 
 
@@ -342,13 +577,15 @@ public:
 
 
     Mesh();
-    QVector<QVector3D>& getPoints(); // use for pushing points onto 'points' vector
-    void chew(ChewType chewType); // processes primary point and face data to product higher level secondary mesh data like a graph of points, faces adjacent to points etc.
+    QVector<QVector3D>& getPoints(); // use for pushing points onto 'points' vector. Call facesChanged() when done.
+    void chew(ChewType chewType); // builds secondary mesh data like a graph of points, faces adjacent to points etc. now rather than on first access. Frees the edge table afterwards.
     //ChewType chewType(); // returns the chew type used for processing vertex info
     void swallow(Core::VertexBufferDraft& targetDraft);
     void generateMetrics();
+    void setBounds(const QVector3D& minPoint, const QVector3D& maxPoint); // sets bounding box and metrics derived from it
 
     friend class Utils::Loader;
+    friend class Utils::MeshCache; // restores chewed meshes
 
 protected:
 
@@ -360,11 +597,20 @@ private:
 QVector3D hideIntInVector3D(unsigned int i);
 unsigned int unhideIntFromVector3D(QVector3D& v, bool normalized=false);
 
+/// Grows target by floatCount floats and returns where they start, for the caller to fill
+inline float* reserveFloats(QVector<float>& target, int floatCount)
+{
+    const int offset = target.size();
+    target.resize(offset + floatCount);
+    return target.data() + offset;
+}
 
 /*!
  * \brief The VertexBufferDraft class
  *
  * A QVector with blocks of vertex data and supplementary information for these blocks.
+ * Blocks are added with reserveBlock(): the writer states the exact size of its
+ * block up front and fills the returned floats directly.
  */
 class VertexBufferDraft
 {
@@ -387,17 +633,6 @@ private:
     QVector<RegisteredInfo> registeredInfo;
     QVector<float> data;
 
-    void startCountingPumped()
-    {
-        registeredInfo.append(RegisteredInfo(data.size()));
-    }
-
-    void stopCountingPumped()
-    {
-        RegisteredInfo& info = registeredInfo.last();
-        info.size = data.size() - info.offset;
-    }
-
 public:
 
     void clear()
@@ -407,18 +642,37 @@ public:
         data.clear();
     }
 
-    QVector<float>* registerForFrame(const SourceArrays* mesh)
+    // makes room for floatCount floats in total, so that blocks of a frame don't reallocate as they are reserved
+    void reserve(int floatCount)
+    {
+        data.reserve(floatCount);
+    }
+
+    /// Registers mesh with a block of exactly floatCount floats and returns where the block starts, for the caller to fill.
+    /// Returns nullptr if the mesh is already registered.
+    float* reserveBlock(const SourceArrays* mesh, int floatCount)
     {
         if (registeredMeshes.contains(mesh))
             return nullptr;
 
         registeredMeshes.append(mesh);
+        RegisteredInfo info(data.size());
+        info.size = floatCount;
+        registeredInfo.append(info);
+        return reserveFloats(data, floatCount);
+    }
 
+    // registers a block of vertex data that was already built elsewhere, e.g. on a worker thread. Returns false if the mesh is already registered.
+    bool appendBlock(const SourceArrays* mesh, const QVector<float>& block)
+    {
+        if (registeredMeshes.contains(mesh))
+            return false;
 
-        return &data;
+        std::copy(block.constBegin(), block.constEnd(), reserveBlock(mesh, block.size()));
+        return true;
     }
 
-    const QVector<float>& getData()
+    const QVector<float>& getData() const
     {
         return data;
     }
@@ -434,8 +688,6 @@ public:
 
         return &registeredInfo[infoIndex];
     }
-
-    friend void VertexIterator::pumpAll();
 };
 
 class Camera
@@ -0,0 +1,524 @@
+#include "meshcache.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <QtEndian>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+namespace Utils {
+
+namespace {
+
+static_assert(sizeof(QVector3D) == 3*sizeof(float), "QVector3D is expected to be three packed floats");
+static_assert(sizeof(Core::Triangle) == 3*sizeof(Core::PointIndex), "Triangle is expected to be three packed indices");
+
+const char FILE_MAGIC[8] = {'S', 'T', 'L', 'O', 'M', 'E', 'S', 'H'};
+const quint32 BYTE_ORDER_MARK = 0x01020304; // written natively. Entries of a host with the other byte order read it reversed.
+const qint64 SECTION_ALIGNMENT = 64;
+const qint64 HASH_CHUNK_SIZE = 4 << 20;
+
+enum SectionKind
+{
+    SECTION_POINTS,             // 3 floats per point
+    SECTION_FACES,              // 3 point indices per face
+    SECTION_NORMALS,            // 3 floats per face, or empty
+    SECTION_BOUNDS,             // min and max point, 6 floats
+    SECTION_GRAPH_OFFSETS,      // point count + 1 offsets into SECTION_GRAPH. Adjacency sections are empty if not built.
+    SECTION_GRAPH,              // connected points
+    SECTION_POINTFACES_OFFSETS, // point count + 1 offsets into SECTION_POINTFACES
+    SECTION_POINTFACES,
+    SECTION_FACEFACES_OFFSETS,  // face count + 1 offsets into SECTION_FACEFACES
+    SECTION_FACEFACES,
+    SECTION_EDGEFACES_OFFSETS,  // face count + 1 offsets into SECTION_EDGEFACES
+    SECTION_EDGEFACES,
+    SECTION_KIND_COUNT
+};
+
+const quint64 SECTION_ELEMENT_SIZE[SECTION_KIND_COUNT] = {
+    sizeof(float), sizeof(Core::PointIndex), sizeof(float), sizeof(float),
+    sizeof(quint32), sizeof(Core::PointIndex),
+    sizeof(quint32), sizeof(Core::FaceIndex),
+    sizeof(quint32), sizeof(Core::FaceIndex),
+    sizeof(quint32), sizeof(Core::FaceIndex)
+};
+
+struct FileHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrderMark;
+    quint64 key;
+    quint64 fileSize; // tells truncated entries apart
+    quint32 partCount;
+    quint32 sectionCount; // entries of the section table that follows the header
+    quint32 reserved[6];
+};
+
+static_assert(sizeof(FileHeader) == 64, "FileHeader is expected to be 64 bytes");
+
+inline qint64 aligned(qint64 pos)
+{
+    return (pos + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+// xxHash64 primes and round
+const quint64 PRIME1 = 0x9E3779B185EBCA87ULL;
+const quint64 PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+const quint64 PRIME3 = 0x165667B19E3779F9ULL;
+const quint64 PRIME4 = 0x85EBCA77C2B2AE63ULL;
+const quint64 PRIME5 = 0x27D4EB2F165667C5ULL;
+
+inline quint64 rotl(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline quint64 hashRound(quint64 acc, quint64 input)
+{
+    acc += input * PRIME2;
+    return rotl(acc, 31) * PRIME1;
+}
+
+inline quint64 mergeRound(quint64 acc, quint64 value)
+{
+    acc ^= hashRound(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+inline quint64 avalanche(quint64 h)
+{
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    return h ^ (h >> 32);
+}
+
+/// xxHash64 of a block of bytes
+quint64 hashBytes(const uchar* p, qint64 length, quint64 seed)
+{
+    const uchar* end = p + length;
+    quint64 h;
+    if (length >= 32)
+    {
+        quint64 v1 = seed + PRIME1 + PRIME2;
+        quint64 v2 = seed + PRIME2;
+        quint64 v3 = seed;
+        quint64 v4 = seed - PRIME1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = hashRound(v1, qFromLittleEndian<quint64>(p));
+            v2 = hashRound(v2, qFromLittleEndian<quint64>(p + 8));
+            v3 = hashRound(v3, qFromLittleEndian<quint64>(p + 16));
+            v4 = hashRound(v4, qFromLittleEndian<quint64>(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    } else
+    {
+        h = seed + PRIME5;
+    }
+    h += quint64(length);
+
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ hashRound(0, qFromLittleEndian<quint64>(p)), 27) * PRIME1 + PRIME4;
+    if (p + 4 <= end)
+    {
+        h = rotl(h ^ (quint64(qFromLittleEndian<quint32>(p)) * PRIME1), 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+
+    return avalanche(h);
+}
+
+/// Copies mapped offsets and values into an adjacency. Returns false if they are out of range or a list isn't sorted.
+template <typename T>
+bool restore(const quint32* offsets, quint64 offsetCount, const T* values, quint64 valueCount, quint64 listCount, quint64 valueLimit, Core::Adjacency<T>& adjacency)
+{
+    adjacency.clear();
+    if (offsetCount == 0)
+        return valueCount == 0;
+    if (offsetCount != listCount + 1 || offsets[0] != 0 || offsets[listCount] != valueCount)
+        return false;
+
+    for (quint64 list_i = 0; list_i < listCount; list_i++)
+    {
+        if (offsets[list_i + 1] < offsets[list_i])
+            return false;
+        const T* first = values + offsets[list_i];
+        const T* last = values + offsets[list_i + 1];
+        if (first != last && last[-1] >= valueLimit)
+            return false;
+        if (std::adjacent_find(first, last, [](T a, T b) { return a >= b; }) != last)
+            return false;
+    }
+    adjacency.assign(offsets, size_t(offsetCount), values, size_t(valueCount));
+    return true;
+}
+
+} // anonymous namespace
+
+struct MeshCache::SectionEntry
+{
+    quint32 part;
+    quint32 kind;
+    quint64 offset; // from the start of the file, a multiple of SECTION_ALIGNMENT
+    quint64 byteSize;
+};
+
+MeshCache::MeshCache(QString directory)
+    : directory(directory)
+{
+
+}
+
+MeshCache::~MeshCache()
+{
+    close();
+}
+
+QString MeshCache::defaultDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/meshes";
+}
+
+bool MeshCache::hashFile(QString filename, quint64& hash, const std::function<bool()>& cancelled)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = file.size();
+    QByteArray content;
+    const uchar* data = size > 0 ? file.map(0, size) : nullptr;
+    if (data == nullptr && size > 0)
+    {
+        content = file.readAll(); // mapping is not supported for this file
+        if (content.size() != size)
+            return false;
+        data = reinterpret_cast<const uchar*>(content.constData());
+    }
+
+    // chunks are hashed on the thread pool and then merged in order
+    const int chunkCount = int((size + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE);
+    QVector<quint64> chunkHashes(chunkCount);
+    QVector<int> chunkIndices(chunkCount);
+    std::iota(chunkIndices.begin(), chunkIndices.end(), 0);
+    std::atomic<bool> stopped(false);
+    QtConcurrent::blockingMap(chunkIndices, [&](int chunk_i) {
+        if (stopped || (cancelled && cancelled()))
+        {
+            stopped = true;
+            return;
+        }
+        const qint64 first = qint64(chunk_i) * HASH_CHUNK_SIZE;
+        chunkHashes[chunk_i] = hashBytes(data + first, std::min(HASH_CHUNK_SIZE, size - first), quint64(chunk_i));
+    });
+    if (stopped)
+        return false;
+
+    quint64 h = quint64(size) * PRIME5;
+    for (quint64 chunkHash : chunkHashes)
+        h = mergeRound(h, chunkHash);
+    hash = avalanche(h);
+    return true;
+}
+
+quint64 MeshCache::mixKey(quint64 key, quint64 value)
+{
+    return avalanche(mergeRound(key, value));
+}
+
+QString MeshCache::entryPath(quint64 key) const
+{
+    return QString("%1/%2.mesh").arg(directory).arg(key, 16, 16, QChar('0'));
+}
+
+bool MeshCache::open(quint64 key)
+{
+    static_assert(sizeof(SectionEntry) == 24, "SectionEntry is expected to be 24 bytes");
+    close();
+    error.clear();
+
+    file.setFileName(entryPath(key));
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = file.errorString();
+        return false;
+    }
+    mappedSize = file.size();
+    if (mappedSize < qint64(sizeof(FileHeader)) || (mapped = file.map(0, mappedSize)) == nullptr)
+    {
+        error = "Can't map cache entry";
+        close();
+        return false;
+    }
+
+    FileHeader header;
+    memcpy(&header, mapped, sizeof(header));
+    if (memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FORMAT_VERSION
+        || header.byteOrderMark != BYTE_ORDER_MARK || header.key != key || header.fileSize != quint64(mappedSize)
+        || quint64(mappedSize) < sizeof(FileHeader) + quint64(header.sectionCount) * sizeof(SectionEntry))
+    {
+        error = "Stale or damaged cache entry";
+        close();
+        return false;
+    }
+
+    parts = int(header.partCount);
+    sectionsByPart.fill(nullptr, parts * SECTION_KIND_COUNT);
+    const SectionEntry* sections = reinterpret_cast<const SectionEntry*>(mapped + sizeof(FileHeader));
+    for (quint32 section_i = 0; section_i < header.sectionCount; section_i++)
+    {
+        const SectionEntry& section = sections[section_i];
+        if (section.part >= header.partCount || section.kind >= SECTION_KIND_COUNT
+            || section.offset % SECTION_ALIGNMENT != 0 || section.byteSize % SECTION_ELEMENT_SIZE[section.kind] != 0
+            || section.offset > quint64(mappedSize) || section.byteSize > quint64(mappedSize) - section.offset)
+        {
+            error = "Damaged cache entry";
+            close();
+            return false;
+        }
+        sectionsByPart[int(section.part) * SECTION_KIND_COUNT + int(section.kind)] = &section;
+    }
+
+    // entries are pruned least recently used first
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    return true;
+}
+
+void MeshCache::close()
+{
+    if (mapped != nullptr)
+        file.unmap(const_cast<uchar*>(mapped));
+    file.close();
+    mapped = nullptr;
+    mappedSize = 0;
+    parts = 0;
+    sectionsByPart.clear();
+}
+
+int MeshCache::partCount() const
+{
+    return parts;
+}
+
+template <typename T>
+bool MeshCache::section(int part_i, int kind, const T*& values, quint64& count) const
+{
+    const SectionEntry* entry = sectionsByPart[part_i * SECTION_KIND_COUNT + kind];
+    if (entry == nullptr)
+        return false;
+
+    values = reinterpret_cast<const T*>(mapped + entry->offset);
+    count = entry->byteSize / sizeof(T);
+    return true;
+}
+
+bool MeshCache::readPart(int part_i, Core::Mesh& mesh) const
+{
+    mesh.clear();
+    if (part_i < 0 || part_i >= parts)
+        return false;
+
+    const float* points;
+    const Core::PointIndex* faces;
+    const float* normals;
+    const float* bounds;
+    const quint32* graphOffsets;
+    const Core::PointIndex* graph;
+    const quint32* pointFacesOffsets;
+    const Core::FaceIndex* pointFaces;
+    const quint32* faceFacesOffsets;
+    const Core::FaceIndex* faceFaces;
+    const quint32* edgeFacesOffsets;
+    const Core::FaceIndex* edgeFaces;
+    quint64 pointFloats, faceIndices, normalFloats, boundFloats;
+    quint64 graphOffsetCount, graphCount, pointFacesOffsetCount, pointFacesCount, faceFacesOffsetCount, faceFacesCount, edgeFacesOffsetCount, edgeFacesCount;
+    bool ok = section(part_i, SECTION_POINTS, points, pointFloats)
+        && section(part_i, SECTION_FACES, faces, faceIndices)
+        && section(part_i, SECTION_NORMALS, normals, normalFloats)
+        && section(part_i, SECTION_BOUNDS, bounds, boundFloats)
+        && section(part_i, SECTION_GRAPH_OFFSETS, graphOffsets, graphOffsetCount)
+        && section(part_i, SECTION_GRAPH, graph, graphCount)
+        && section(part_i, SECTION_POINTFACES_OFFSETS, pointFacesOffsets, pointFacesOffsetCount)
+        && section(part_i, SECTION_POINTFACES, pointFaces, pointFacesCount)
+        && section(part_i, SECTION_FACEFACES_OFFSETS, faceFacesOffsets, faceFacesOffsetCount)
+        && section(part_i, SECTION_FACEFACES, faceFaces, faceFacesCount)
+        && section(part_i, SECTION_EDGEFACES_OFFSETS, edgeFacesOffsets, edgeFacesOffsetCount)
+        && section(part_i, SECTION_EDGEFACES, edgeFaces, edgeFacesCount);
+
+    const quint64 pointCount = pointFloats / 3;
+    const quint64 faceCount = faceIndices / 3;
+    ok = ok && pointFloats % 3 == 0 && faceIndices % 3 == 0 && boundFloats == 6
+        && (normalFloats == 0 || normalFloats == faceIndices)
+        && pointCount <= quint64(std::numeric_limits<int>::max()) && faceCount <= quint64(std::numeric_limits<int>::max())
+        && std::all_of(faces, faces + faceIndices, [pointCount](Core::PointIndex point_i) { return point_i < pointCount; });
+    if (!ok)
+        return false;
+
+    // empty vectors have no data() to copy to
+    mesh.facesChanged(); // nothing built for the previous content survives
+    mesh.points.resize(int(pointCount));
+    if (pointFloats > 0)
+        memcpy(mesh.points.data(), points, pointFloats * sizeof(float));
+    mesh.faces.resize(int(faceCount));
+    if (faceIndices > 0)
+        memcpy(mesh.faces.data(), faces, faceIndices * sizeof(Core::PointIndex));
+    mesh.normals.resize(int(normalFloats / 3));
+    if (normalFloats > 0)
+        memcpy(mesh.normals.data(), normals, normalFloats * sizeof(float));
+
+    ok = restore(graphOffsets, graphOffsetCount, graph, graphCount, pointCount, pointCount, mesh.graphData)
+        && restore(pointFacesOffsets, pointFacesOffsetCount, pointFaces, pointFacesCount, pointCount, faceCount, mesh.pointFacesData)
+        && restore(faceFacesOffsets, faceFacesOffsetCount, faceFaces, faceFacesCount, faceCount, faceCount, mesh.faceFacesData)
+        && restore(edgeFacesOffsets, edgeFacesOffsetCount, edgeFaces, edgeFacesCount, faceCount, faceCount, mesh.edgeFacesData);
+    if (!ok)
+    {
+        mesh.clear();
+        return false;
+    }
+
+    // secondary data that wasn't saved is built when it's first needed
+    mesh.built = (mesh.graphData.isEmpty() ? 0 : Core::SourceArrays::SECONDARY_GRAPH)
+        | (mesh.pointFacesData.isEmpty() ? 0 : Core::SourceArrays::SECONDARY_POINTFACES)
+        | (mesh.faceFacesData.isEmpty() ? 0 : Core::SourceArrays::SECONDARY_FACEFACES)
+        | (mesh.edgeFacesData.isEmpty() ? 0 : Core::SourceArrays::SECONDARY_EDGEFACES);
+    mesh.chewTypeUsed = mesh.graphData.isEmpty() ? 0 : Core::Mesh::CHEW_GRAPH;
+    mesh.setBounds(QVector3D(bounds[0], bounds[1], bounds[2]), QVector3D(bounds[3], bounds[4], bounds[5]));
+    return true;
+}
+
+bool MeshCache::store(quint64 key, const QVector<const Core::Mesh*>& meshes)
+{
+    error.clear();
+    if (!QDir().mkpath(directory))
+    {
+        error = QString("Can't create cache directory %1").arg(directory);
+        return false;
+    }
+
+    // section data is written straight from the meshes
+    struct PendingSection
+    {
+        SectionEntry entry;
+        const void* data;
+    };
+    QVector<PendingSection> pending;
+    auto addSection = [&pending](int part_i, int kind, const void* data, quint64 byteSize) {
+        PendingSection section = {{quint32(part_i), quint32(kind), 0, byteSize}, data};
+        pending.append(section);
+    };
+    std::vector<float> bounds(meshes.size() * 6);
+
+    for (int part_i = 0; part_i < meshes.size(); part_i++)
+    {
+        const Core::Mesh& mesh = *meshes[part_i];
+        float* partBounds = &bounds[part_i * 6];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            partBounds[axis] = mesh.minPoint[axis];
+            partBounds[3 + axis] = mesh.maxPoint[axis];
+        }
+
+        auto addAdjacency = [&addSection, part_i](int offsetsKind, const Core::Adjacency<quint32>& adjacency) {
+            addSection(part_i, offsetsKind, adjacency.rawOffsets().data(), adjacency.rawOffsets().size() * sizeof(quint32));
+            addSection(part_i, offsetsKind + 1, adjacency.rawValues().data(), adjacency.rawValues().size() * sizeof(quint32));
+        };
+
+        addSection(part_i, SECTION_POINTS, mesh.points.constData(), quint64(mesh.points.size()) * sizeof(QVector3D));
+        addSection(part_i, SECTION_FACES, mesh.faces.constData(), quint64(mesh.faces.size()) * sizeof(Core::Triangle));
+        addSection(part_i, SECTION_NORMALS, mesh.normals.constData(), quint64(mesh.normals.size()) * sizeof(QVector3D));
+        addSection(part_i, SECTION_BOUNDS, partBounds, 6 * sizeof(float));
+        addAdjacency(SECTION_GRAPH_OFFSETS, mesh.graphData);
+        addAdjacency(SECTION_POINTFACES_OFFSETS, mesh.pointFacesData);
+        addAdjacency(SECTION_FACEFACES_OFFSETS, mesh.faceFacesData);
+        addAdjacency(SECTION_EDGEFACES_OFFSETS, mesh.edgeFacesData);
+    }
+
+    // place sections after the header and the section table
+    qint64 pos = aligned(qint64(sizeof(FileHeader) + pending.size() * sizeof(SectionEntry)));
+    for (PendingSection& section : pending)
+    {
+        section.entry.offset = quint64(pos);
+        pos = aligned(pos + qint64(section.entry.byteSize));
+    }
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FORMAT_VERSION;
+    header.byteOrderMark = BYTE_ORDER_MARK;
+    header.key = key;
+    header.fileSize = quint64(pos);
+    header.partCount = quint32(meshes.size());
+    header.sectionCount = quint32(pending.size());
+
+    const QString path = entryPath(key);
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly))
+    {
+        error = out.errorString();
+        return false;
+    }
+
+    const char padding[SECTION_ALIGNMENT] = {};
+    bool ok = out.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+    for (const PendingSection& section : pending)
+        ok = ok && out.write(reinterpret_cast<const char*>(&section.entry), sizeof(SectionEntry)) == sizeof(SectionEntry);
+    for (const PendingSection& section : pending)
+    {
+        const qint64 paddingSize = qint64(section.entry.offset) - out.pos();
+        ok = ok && out.write(padding, paddingSize) == paddingSize;
+        ok = ok && out.write(static_cast<const char*>(section.data), qint64(section.entry.byteSize)) == qint64(section.entry.byteSize);
+    }
+    const qint64 paddingSize = pos - out.pos();
+    ok = ok && out.write(padding, paddingSize) == paddingSize;
+    if (!ok || !out.commit())
+    {
+        error = out.errorString();
+        out.cancelWriting();
+        return false;
+    }
+
+    prune(path);
+    return true;
+}
+
+/// Removes the least recently used entries until the cache fits in maxCacheBytes
+void MeshCache::prune(const QString& keep)
+{
+    const QFileInfoList entries = QDir(directory).entryInfoList(QStringList() << "*.mesh", QDir::Files, QDir::Time);
+    qint64 total = 0;
+    for (const QFileInfo& entry : entries)
+    {
+        total += entry.size();
+        if (total > maxCacheBytes && entry.absoluteFilePath() != QFileInfo(keep).absoluteFilePath())
+        {
+            qInfo() << "removing cache entry" << entry.fileName();
+            QFile::remove(entry.absoluteFilePath());
+            total -= entry.size();
+        }
+    }
+}
+
+QString MeshCache::errorString() const
+{
+    return error;
+}
+
+} // namespace Utils
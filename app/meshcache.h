@@ -0,0 +1,103 @@
+#ifndef UTILS_MESHCACHE_H
+#define UTILS_MESHCACHE_H
+
+#include "mesh.h"
+#include <QFile>
+#include <QString>
+#include <QVector>
+#include <functional>
+
+namespace Utils {
+
+/*!
+ * \brief On-disk cache of welded and chewed meshes
+ *
+ * Entries are keyed by a hash of the source file content and hold, for each
+ * part, the points, faces, normals and bounds, along with the point graph,
+ * pointFaces, faceFaces and edgeFaces if these had been built when the entry
+ * was stored. Adjacency lists are stored in their flat form, as an array of
+ * offsets followed by the sorted values, and every section is aligned so that
+ * the mapped file can be read in place. Opening an entry maps it and
+ * checks its header; parts are then copied into meshes without any parsing or
+ * welding.
+ *
+ * Entries written by another version of the format are treated as misses.
+ */
+class MeshCache
+{
+public:
+    static const quint32 FORMAT_VERSION = 5; // bump whenever the layout or the meaning of a section changes
+
+    explicit MeshCache(QString directory = defaultDirectory());
+    ~MeshCache();
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator=(const MeshCache&) = delete;
+
+    static QString defaultDirectory(); // "meshes" under the cache location of the application
+
+    /**
+     * @brief Hashes the content of a file, in parallel chunks
+     *
+     * The hash depends only on the content, not on the number of threads.
+     * cancelled, if set, is checked before each chunk.
+     *
+     * @return false if the file can't be read or hashing was cancelled
+     */
+    static bool hashFile(QString filename, quint64& hash, const std::function<bool()>& cancelled = std::function<bool()>());
+    static quint64 mixKey(quint64 key, quint64 value); // key of a variant of an entry, e.g. one loaded with other options
+
+    QString entryPath(quint64 key) const;
+
+    /**
+     * @brief Maps the entry for key, if there is a valid one
+     *
+     * Closes any entry opened before. On success use partCount() and
+     * readPart() and then close().
+     */
+    bool open(quint64 key);
+    void close();
+    int partCount() const;
+
+    /**
+     * @brief Copies a part of the open entry into a mesh
+     *
+     * Sets mesh bounds as well, there's no need for generateMetrics().
+     * Safe to call from several threads at once, as long as each call gets
+     * its own mesh.
+     *
+     * @return false if the part is damaged. The mesh is cleared then.
+     */
+    bool readPart(int part_i, Core::Mesh& mesh) const;
+
+    /**
+     * @brief Writes an entry for key holding the given parts
+     *
+     * Parts should have their metrics generated. The entry replaces any
+     * previous one atomically. Entries that haven't been used for long are
+     * removed to keep the cache below maxCacheBytes.
+     */
+    bool store(quint64 key, const QVector<const Core::Mesh*>& parts);
+
+    QString errorString() const;
+
+    qint64 maxCacheBytes = qint64(4) << 30;
+
+private:
+    struct SectionEntry;
+
+    QString directory;
+    QString error;
+    QFile file;
+    const uchar* mapped = nullptr;
+    qint64 mappedSize = 0;
+    int parts = 0;
+    QVector<const SectionEntry*> sectionsByPart; // SECTION_KIND_COUNT entries per part, nullptr for missing ones
+
+    template <typename T>
+    bool section(int part_i, int kind, const T*& values, quint64& count) const;
+    void prune(const QString& keep);
+};
+
+} // namespace Utils
+
+#endif // UTILS_MESHCACHE_H
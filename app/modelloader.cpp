@@ -0,0 +1,329 @@
+#include "modelloader.h"
+#include "loader.h"
+#include "meshcache.h"
+#include "writer.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMetaObject>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <numeric>
+
+
+ModelLoader::Result::Result()
+    : model(new Model())
+{
+}
+
+ModelLoader::Result::~Result()
+{
+    delete model;
+}
+
+ModelLoader::ModelLoader(QObject* parent)
+    : QObject(parent), latestRequest(0), faceIdVertices(true)
+{
+    qRegisterMetaType<ModelLoader::PreviewPtr>();
+    qRegisterMetaType<ModelLoader::ResultPtr>();
+    qRegisterMetaType<ModelLoader::PartsPtr>();
+    cachePool.setMaxThreadCount(1);
+}
+
+ModelLoader::~ModelLoader()
+{
+    cancel(); // an entry that isn't being written yet is dropped
+    cachePool.waitForDone();
+}
+
+quint64 ModelLoader::request(QString filename, float weldTolerance)
+{
+    quint64 requestId = ++latestRequest;
+    QMetaObject::invokeMethod(this, "load", Qt::QueuedConnection, Q_ARG(QString, filename), Q_ARG(quint64, requestId), Q_ARG(float, weldTolerance));
+    return requestId;
+}
+
+void ModelLoader::cancel()
+{
+    ++latestRequest; // any running request is no longer the latest one
+}
+
+bool ModelLoader::isCurrent(quint64 requestId) const
+{
+    return requestId == latestRequest;
+}
+
+void ModelLoader::setFaceIdVertices(bool build)
+{
+    faceIdVertices = build;
+}
+
+void ModelLoader::save(QString filename, const Model& model, bool ascii)
+{
+    PartsPtr parts = copyParts(model);
+    QMetaObject::invokeMethod(this, "write", Qt::QueuedConnection, Q_ARG(QString, filename), Q_ARG(ModelLoader::PartsPtr, parts), Q_ARG(bool, ascii));
+}
+
+void ModelLoader::write(QString filename, ModelLoader::PartsPtr parts, bool ascii)
+{
+    QVector<const Core::Mesh*> meshes;
+    int faceCount = 0;
+    for (const Core::Mesh& part : *parts)
+    {
+        meshes.append(&part);
+        faceCount += part.faces.size();
+    }
+
+    Utils::Writer writer;
+    if (writer.writeStl(filename, meshes, ascii ? Utils::Writer::FORMAT_ASCII : Utils::Writer::FORMAT_BINARY))
+        emit saved(filename, faceCount);
+    else
+        emit saveFailed(filename, writer.errorString());
+}
+
+void ModelLoader::load(QString filename, quint64 requestId, float weldTolerance)
+{
+    if (!isCurrent(requestId))
+        return; // superseded while still queued
+
+    QElapsedTimer timer;
+    timer.start();
+
+    emit progress(requestId, 0, tr("Reading"));
+    Utils::resetPeakResidentBytes();
+    ResultPtr result(new Result);
+    Model& model = *result->model;
+
+    Utils::Loader::Options options;
+    options.weldTolerance = weldTolerance;
+    const Utils::Loader::CancelCheck cancelled = [this, requestId]() { return !isCurrent(requestId); };
+
+    // a cache entry of the same content and options skips reading and welding
+    quint64 cacheKey = 0;
+    const bool cacheable = Utils::MeshCache::hashFile(filename, cacheKey, cancelled);
+    if (!isCurrent(requestId))
+        return;
+    if (options.weldTolerance > 0)
+    {
+        quint32 toleranceBits;
+        memcpy(&toleranceBits, &options.weldTolerance, sizeof(toleranceBits));
+        cacheKey = Utils::MeshCache::mixKey(cacheKey, toleranceBits);
+    }
+    Utils::MeshCache cache;
+    const bool cached = cacheable && loadCached(cache, cacheKey, requestId, model);
+    if (!isCurrent(requestId))
+        return;
+    if (!cached)
+    {
+        if (!loadSource(filename, requestId, options, cancelled, *result))
+            return;
+
+        if (cacheable)
+            storeInBackground(filename, requestId, cacheKey, model);
+    }
+
+    // face ids are known now. Build vertex buffers of the parts, then put them one after the other.
+    const int partCount = model.parts.size();
+    const QVector<ModelMesh*>& parts = model.parts;
+    model.numberFaces();
+    model.mergeMetrics();
+    if (faceIdVertices)
+    {
+        emit progress(requestId, 85, tr("Building buffers"));
+        QVector<int> partIndices(partCount);
+        std::iota(partIndices.begin(), partIndices.end(), 0);
+        QVector<Core::VertexBufferDraft> triangleDrafts(partCount);
+        QtConcurrent::blockingMap(partIndices, [&](int part_i) {
+            if (isCurrent(requestId))
+                parts[part_i]->swallow(triangleDrafts[part_i]);
+        });
+        if (!isCurrent(requestId))
+            return;
+        int floatCount = 0;
+        for (const Core::VertexBufferDraft& draft : triangleDrafts)
+            floatCount += draft.getData().size();
+        result->triangleBuffer.reserve(floatCount);
+        for (int part_i = 0; part_i < partCount; part_i++)
+            result->triangleBuffer.appendBlock(parts[part_i], triangleDrafts[part_i].getData());
+    }
+
+    qInfo() << "loaded" << filename << (cached ? "from cache:" : ":") << partCount << "parts," << model.faceCount() << "faces in"
+            << timer.elapsed() << "ms, peak RSS:" << Utils::peakResidentBytes()/(1024*1024) << "MiB";
+
+    emit progress(requestId, 100, tr("Done"));
+    emit finished(requestId, result);
+}
+
+/// Shallow copies of the parts of model. Points and faces are shared until either side changes them, so model can move on right away.
+ModelLoader::PartsPtr ModelLoader::copyParts(const Model& model)
+{
+    PartsPtr parts(new QVector<Core::Mesh>(model.parts.size()));
+    for (int part_i = 0; part_i < model.parts.size(); part_i++)
+    {
+        const ModelMesh& source = *model.parts[part_i];
+        Core::Mesh& part = (*parts)[part_i];
+        part.points = source.points;
+        part.faces = source.faces;
+        part.normals = source.normals;
+        part.setBounds(source.minPoint, source.maxPoint);
+    }
+    return parts;
+}
+
+/**
+ * Stores the parts of model under cacheKey along with their adjacency, on cachePool. The parts are
+ * copied with copyParts(), so that the model can go to its new owner right away. Gives up if requestId
+ * is superseded before the entry is written.
+ */
+void ModelLoader::storeInBackground(QString filename, quint64 requestId, quint64 cacheKey, const Model& model)
+{
+    PartsPtr parts = copyParts(model);
+
+    QtConcurrent::run(&cachePool, [this, filename, requestId, cacheKey, parts]() {
+        QVector<int> partIndices(parts->size());
+        std::iota(partIndices.begin(), partIndices.end(), 0);
+        QtConcurrent::blockingMap(partIndices, [&](int part_i) {
+            if (isCurrent(requestId))
+                (*parts)[part_i].chew(Core::Mesh::CHEW_GRAPH);
+        });
+        if (!isCurrent(requestId))
+            return;
+
+        QVector<const Core::Mesh*> entryParts;
+        for (const Core::Mesh& part : *parts)
+            entryParts.append(&part);
+        Utils::MeshCache cache;
+        if (!cache.store(cacheKey, entryParts))
+            qWarning() << "failed to cache" << filename << ":" << cache.errorString();
+    });
+}
+
+/// Fills model with the parts of a cache entry. Returns false if there's no usable entry for key.
+bool ModelLoader::loadCached(Utils::MeshCache& cache, quint64 key, quint64 requestId, Model& model)
+{
+    if (!cache.open(key))
+        return false;
+
+    const int partCount = cache.partCount();
+    QVector<ModelMesh*> parts;
+    for (int part_i = 0; part_i < partCount; part_i++)
+        parts.append(new ModelMesh());
+    model.setParts(parts);
+
+    QVector<int> partIndices(partCount);
+    std::iota(partIndices.begin(), partIndices.end(), 0);
+    std::atomic<bool> damaged(false);
+    QtConcurrent::blockingMap(partIndices, [&](int part_i) {
+        if (isCurrent(requestId) && !cache.readPart(part_i, *parts[part_i]))
+            damaged = true;
+    });
+    cache.close();
+
+    if (damaged)
+    {
+        qWarning() << "ignoring damaged cache entry" << cache.entryPath(key);
+        model.clear();
+        return false;
+    }
+    return true;
+}
+
+/// Reads, welds and measures the solids of filename as parts of the result model. Emits failed() and returns false on error. Also returns false once cancelled.
+bool ModelLoader::loadSource(QString filename, quint64 requestId, const Utils::Loader::Options& options,
+                             const Utils::Loader::CancelCheck& cancelled, Result& result)
+{
+    Model& model = *result.model;
+    Utils::Loader loader;
+    QSharedPointer<Utils::Loader::Soup> soup(new Utils::Loader::Soup); // shared with the preview
+    try
+    {
+        if (!loader.readSoup(filename, *soup, cancelled))
+            return false;
+    } catch (const std::exception& e)
+    {
+        qWarning() << "failed to load" << filename << ":" << e.what();
+        if (isCurrent(requestId))
+            emit failed(requestId, QString::fromLocal8Bit(e.what()));
+        return false;
+    }
+    if (!isCurrent(requestId))
+        return false;
+    emit previewReady(requestId, buildPreview(soup));
+
+    // each solid becomes a part. Parts are welded and measured at the same time. Adjacency is left for the cache and for when it's needed.
+    const int partCount = soup->solidCount();
+    QVector<ModelMesh*> parts;
+    for (int part_i = 0; part_i < partCount; part_i++)
+        parts.append(new ModelMesh());
+    model.setParts(parts);
+
+    QVector<int> partIndices(partCount);
+    std::iota(partIndices.begin(), partIndices.end(), 0);
+    QVector<QString> errors(partCount);
+    std::atomic<int> partsDone(0);
+    std::atomic<qint64> mergedPoints(0);
+
+    emit progress(requestId, 20, tr("Welding"));
+    QtConcurrent::blockingMap(partIndices, [&](int part_i) {
+        if (!isCurrent(requestId))
+            return;
+
+        ModelMesh& part = *parts[part_i];
+        try
+        {
+            mergedPoints += Utils::Loader::weldSolid(*soup, part_i, part, options, cancelled);
+        } catch (const std::exception& e)
+        {
+            errors[part_i] = QString::fromLocal8Bit(e.what());
+            part.clear();
+            return;
+        }
+        part.generateMetrics();
+        emit progress(requestId, 20 + 60*(++partsDone)/partCount, tr("Welding"));
+    });
+    if (!isCurrent(requestId))
+        return false;
+    for (const QString& error : errors)
+    {
+        if (!error.isEmpty())
+        {
+            emit failed(requestId, error);
+            return false;
+        }
+    }
+
+    result.mergedPoints = mergedPoints;
+    qInfo() << "read" << filename << "in" << loader.lastStats().readMs << "ms," << result.mergedPoints << "points merged by tolerance";
+    return true;
+}
+
+/// Triangles straight from the soup and a bounding box to place them
+ModelLoader::PreviewPtr ModelLoader::buildPreview(const QSharedPointer<const Utils::Loader::Soup>& soup)
+{
+    PreviewPtr preview(new Preview);
+    preview->soup = soup;
+    const std::vector<float>& cornerCoords = soup->cornerCoords;
+    const size_t floatCount = cornerCoords.size();
+
+    float maxfloat = std::numeric_limits<float>::max();
+    QVector3D minPoint(maxfloat, maxfloat, maxfloat);
+    QVector3D maxPoint(-maxfloat, -maxfloat, -maxfloat);
+    for (size_t i = 0; i + 3 <= floatCount; i += 3)
+    {
+        const float* c = &cornerCoords[i];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            minPoint[axis] = std::min(minPoint[axis], c[axis]);
+            maxPoint[axis] = std::max(maxPoint[axis], c[axis]);
+        }
+    }
+    if (floatCount == 0)
+        minPoint = maxPoint = QVector3D();
+
+    preview->minPoint = minPoint;
+    preview->maxPoint = maxPoint;
+    return preview;
+}
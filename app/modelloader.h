@@ -0,0 +1,111 @@
+#ifndef MODELLOADER_H
+#define MODELLOADER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+#include <QVector3D>
+#include <atomic>
+#include <vector>
+
+#include "app.h"
+#include "loader.h"
+
+namespace Utils
+{
+    class MeshCache; // forward declaration
+}
+
+/*!
+ * \brief Loads stl files into a Model on a worker thread
+ *
+ * Move to a QThread and use request() from the owning thread. The load, weld,
+ * metrics and vertex buffer stages run in the worker. Welded parts are kept in
+ * a Utils::MeshCache, so that reopening a file skips all but the vertex buffer
+ * stage. Entries include the adjacency. It is built and stored in the
+ * background once the model has been handed over, so neither holds up the
+ * first frame. The model itself builds adjacency when it's first used. Each
+ * solid of the file becomes a part and parts are processed in parallel on the
+ * global thread pool.
+ * Results are emitted as signals tagged with the request id so that stale ones
+ * can be told apart.
+ *
+ * save() writes the parts of a model to an stl file in the worker as well, so
+ * that big files don't freeze the user interface.
+ *
+ * A newer request or cancel() supersedes the running one. Hashing, reading and
+ * welding check for it as they go, the other stages are abandoned at their
+ * next boundary. A superseded request emits nothing more. Storing its cache entry is
+ * abandoned as well, unless the entry is already being written.
+ */
+class ModelLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    /// Unwelded triangles ready to draw while the rest of the pipeline runs. Shares the soup with the loader instead of copying it, so drop it once it's uploaded.
+    struct Preview
+    {
+        QSharedPointer<const Utils::Loader::Soup> soup; // draw soup->cornerCoords, 3 points per triangle, 3 floats per point
+        QVector3D minPoint;
+        QVector3D maxPoint;
+    };
+
+    /// Finished model along with its vertex buffer drafts. Parts are registered one after the other.
+    struct Result
+    {
+        Model* model; // owned by Result until taken
+        Core::VertexBufferDraft triangleBuffer; // points with face ids for picking, empty unless face id vertices are on. The model itself is drawn indexed from its parts.
+        qint64 mergedPoints = 0; // points merged because of the weld tolerance. 0 when taken from the cache.
+
+        Result();
+        ~Result();
+    };
+
+    typedef QSharedPointer<Preview> PreviewPtr;
+    typedef QSharedPointer<Result> ResultPtr;
+    typedef QSharedPointer<QVector<Core::Mesh>> PartsPtr; // shallow copies of the parts of a model
+
+    explicit ModelLoader(QObject* parent = nullptr);
+    ~ModelLoader();
+
+    // thread safe
+    quint64 request(QString filename, float weldTolerance = 0); // queues loading of filename and returns the id of the request
+    void cancel();
+    bool isCurrent(quint64 requestId) const;
+    void setFaceIdVertices(bool build); // whether results come with triangleBuffer. Picking needs it where the id pass can't tell faces apart by itself.
+    void save(QString filename, const Model& model, bool ascii); // queues writing the parts of model. Call from the thread which owns model.
+
+public slots:
+    void load(QString filename, quint64 requestId, float weldTolerance);
+    void write(QString filename, ModelLoader::PartsPtr parts, bool ascii);
+
+signals:
+    void progress(quint64 requestId, int percent, QString stage);
+    void previewReady(quint64 requestId, ModelLoader::PreviewPtr preview);
+    void finished(quint64 requestId, ModelLoader::ResultPtr result);
+    void failed(quint64 requestId, QString message);
+    void saved(QString filename, int faceCount);
+    void saveFailed(QString filename, QString message);
+
+private:
+    std::atomic<quint64> latestRequest;
+    std::atomic<bool> faceIdVertices;
+
+    bool loadCached(Utils::MeshCache& cache, quint64 key, quint64 requestId, Model& model);
+    bool loadSource(QString filename, quint64 requestId, const Utils::Loader::Options& options,
+                    const Utils::Loader::CancelCheck& cancelled, Result& result);
+    void storeInBackground(QString filename, quint64 requestId, quint64 cacheKey, const Model& model);
+    static PartsPtr copyParts(const Model& model);
+    static PreviewPtr buildPreview(const QSharedPointer<const Utils::Loader::Soup>& soup);
+
+    QThreadPool cachePool; // builds and stores cache entries, one at a time. Last, so that it's done before the rest goes.
+};
+
+Q_DECLARE_METATYPE(ModelLoader::PreviewPtr)
+Q_DECLARE_METATYPE(ModelLoader::ResultPtr)
+Q_DECLARE_METATYPE(ModelLoader::PartsPtr)
+
+#endif // MODELLOADER_H
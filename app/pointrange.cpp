@@ -0,0 +1,147 @@
+#include "pointrange.h"
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CORE_SSE_KERNEL
+#include <xmmintrin.h>
+#endif
+
+// AVX needs a runtime check. GCC and Clang can compile a single function for it.
+#if defined(CORE_SSE_KERNEL) && (defined(__GNUC__) || defined(__clang__))
+#define CORE_AVX_KERNEL
+#include <immintrin.h>
+#endif
+
+namespace Core {
+
+namespace {
+
+typedef void (*PointRangeFunction)(const float* coords, size_t count, float* lowest, float* highest);
+
+// A NaN coordinate fails every comparison, so std::min and std::max keep the value so far. The vector
+// kernels take the value so far as the second operand of min and max, which is what they return then too.
+void pointRangeScalar(const float* coords, size_t count, float* lowest, float* highest)
+{
+    for (size_t i = 0; i < count; i++, coords += 3)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            lowest[axis] = std::min(lowest[axis], coords[axis]);
+            highest[axis] = std::max(highest[axis], coords[axis]);
+        }
+    }
+}
+
+// folds the lanes of three consecutive registers. Lane j of them holds a coordinate of axis j % 3.
+void mergeLanes(const float* lows, const float* highs, int laneCount, float* lowest, float* highest)
+{
+    for (int lane = 0; lane < laneCount; lane++)
+    {
+        lowest[lane % 3] = std::min(lowest[lane % 3], lows[lane]);
+        highest[lane % 3] = std::max(highest[lane % 3], highs[lane]);
+    }
+}
+
+#ifdef CORE_SSE_KERNEL
+void pointRangeSse(const float* coords, size_t count, float* lowest, float* highest)
+{
+    // 4 points are 3 registers of coordinates. Each lane always gets the same axis, so no shuffling is needed.
+    __m128 low0 = _mm_set1_ps(std::numeric_limits<float>::max()), low1 = low0, low2 = low0;
+    __m128 high0 = _mm_set1_ps(std::numeric_limits<float>::lowest()), high1 = high0, high2 = high0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, coords += 12)
+    {
+        const __m128 a = _mm_loadu_ps(coords);
+        const __m128 b = _mm_loadu_ps(coords + 4);
+        const __m128 c = _mm_loadu_ps(coords + 8);
+        low0 = _mm_min_ps(a, low0);
+        low1 = _mm_min_ps(b, low1);
+        low2 = _mm_min_ps(c, low2);
+        high0 = _mm_max_ps(a, high0);
+        high1 = _mm_max_ps(b, high1);
+        high2 = _mm_max_ps(c, high2);
+    }
+
+    float lows[12], highs[12];
+    _mm_storeu_ps(lows, low0);
+    _mm_storeu_ps(lows + 4, low1);
+    _mm_storeu_ps(lows + 8, low2);
+    _mm_storeu_ps(highs, high0);
+    _mm_storeu_ps(highs + 4, high1);
+    _mm_storeu_ps(highs + 8, high2);
+    mergeLanes(lows, highs, 12, lowest, highest);
+    pointRangeScalar(coords, count - i, lowest, highest);
+}
+#endif
+
+#ifdef CORE_AVX_KERNEL
+__attribute__((target("avx")))
+void pointRangeAvx(const float* coords, size_t count, float* lowest, float* highest)
+{
+    // 8 points are 3 registers of coordinates
+    __m256 low0 = _mm256_set1_ps(std::numeric_limits<float>::max()), low1 = low0, low2 = low0;
+    __m256 high0 = _mm256_set1_ps(std::numeric_limits<float>::lowest()), high1 = high0, high2 = high0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8, coords += 24)
+    {
+        const __m256 a = _mm256_loadu_ps(coords);
+        const __m256 b = _mm256_loadu_ps(coords + 8);
+        const __m256 c = _mm256_loadu_ps(coords + 16);
+        low0 = _mm256_min_ps(a, low0);
+        low1 = _mm256_min_ps(b, low1);
+        low2 = _mm256_min_ps(c, low2);
+        high0 = _mm256_max_ps(a, high0);
+        high1 = _mm256_max_ps(b, high1);
+        high2 = _mm256_max_ps(c, high2);
+    }
+
+    float lows[24], highs[24];
+    _mm256_storeu_ps(lows, low0);
+    _mm256_storeu_ps(lows + 8, low1);
+    _mm256_storeu_ps(lows + 16, low2);
+    _mm256_storeu_ps(highs, high0);
+    _mm256_storeu_ps(highs + 8, high1);
+    _mm256_storeu_ps(highs + 16, high2);
+    mergeLanes(lows, highs, 24, lowest, highest);
+    pointRangeScalar(coords, count - i, lowest, highest);
+}
+#endif
+
+struct Kernel
+{
+    PointRangeFunction function;
+    const char* name;
+};
+
+// picks the widest kernel the CPU runs, once
+const Kernel& pointRangeDispatch()
+{
+    static const Kernel kernel = []() -> Kernel {
+#ifdef CORE_AVX_KERNEL
+        if (__builtin_cpu_supports("avx"))
+            return Kernel{pointRangeAvx, "avx"};
+#endif
+#ifdef CORE_SSE_KERNEL
+        return Kernel{pointRangeSse, "sse"};
+#else
+        return Kernel{pointRangeScalar, "scalar"};
+#endif
+    }();
+    return kernel;
+}
+
+} // anonymous namespace
+
+void pointRange(const QVector3D* points, size_t count, float* lowest, float* highest)
+{
+    static_assert(sizeof(QVector3D) == 3 * sizeof(float), "points are read as packed coordinates");
+    pointRangeDispatch().function(reinterpret_cast<const float*>(points), count, lowest, highest);
+}
+
+const char* pointRangeKernel()
+{
+    return pointRangeDispatch().name;
+}
+
+} // namespace Core
@@ -0,0 +1,24 @@
+#ifndef CORE_POINTRANGE_H
+#define CORE_POINTRANGE_H
+
+#include <QVector3D>
+#include <cstddef>
+
+namespace Core {
+
+/**
+ * @brief Widens lowest and highest so that they include count points
+ *
+ * lowest and highest hold a value per axis. Points are read in place, as
+ * packed coordinates. Runs an AVX or SSE kernel when the CPU has one and plain
+ * C++ otherwise. NaN coordinates are skipped by all of them, so the result
+ * doesn't depend on the kernel. Pass the largest float as lowest and the
+ * lowest float as highest to get the range of the points alone.
+ */
+void pointRange(const QVector3D* points, size_t count, float* lowest, float* highest);
+
+const char* pointRangeKernel(); // name of the kernel pointRange() runs on this CPU
+
+} // namespace Core
+
+#endif // CORE_POINTRANGE_H
@@ -0,0 +1,163 @@
+#include "pointtransform.h"
+#include "mesh.h"
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CORE_SSE_KERNEL
+#include <xmmintrin.h>
+#endif
+
+namespace Core {
+
+static_assert(sizeof(QVector3D) == 3 * sizeof(float), "kernels read QVector3D arrays as packed floats");
+
+AffineTransform::AffineTransform()
+{
+    for (int row = 0; row < 3; row++)
+    {
+        for (int column = 0; column < 3; column++)
+            linear[row][column] = (row == column) ? 1.0f : 0.0f;
+        translation[row] = 0.0f;
+    }
+}
+
+AffineTransform::AffineTransform(const QMatrix4x4& matrix)
+{
+    for (int row = 0; row < 3; row++)
+    {
+        for (int column = 0; column < 3; column++)
+            linear[row][column] = matrix(row, column);
+        translation[row] = matrix(row, 3);
+    }
+}
+
+AffineTransform AffineTransform::normalTransform() const
+{
+    // row i of the cofactor matrix is the cross product of the other two rows, so that
+    // cross(M*a, M*b) == C*cross(a, b) even for mirroring transforms
+    const float (&m)[3][3] = linear;
+    AffineTransform result;
+    for (int row = 0; row < 3; row++)
+    {
+        const float* a = m[(row + 1) % 3];
+        const float* b = m[(row + 2) % 3];
+        result.linear[row][0] = a[1] * b[2] - a[2] * b[1];
+        result.linear[row][1] = a[2] * b[0] - a[0] * b[2];
+        result.linear[row][2] = a[0] * b[1] - a[1] * b[0];
+    }
+    return result;
+}
+
+QVector3D AffineTransform::map(const QVector3D& point) const
+{
+    float mapped[3];
+    for (int row = 0; row < 3; row++)
+        mapped[row] = linear[row][0] * point.x() + linear[row][1] * point.y() + linear[row][2] * point.z() + translation[row];
+    return QVector3D(mapped[0], mapped[1], mapped[2]);
+}
+
+namespace {
+
+// Maps points and optionally normalizes them. The SSE path does the same operations in the same
+// order, so every point gets the same result whichever path and range it falls into.
+template <bool normalize>
+void transformScalar(const AffineTransform& t, float* coords, int first, int last)
+{
+    for (int point_i = first; point_i < last; point_i++)
+    {
+        float* p = coords + 3 * point_i;
+        float mapped[3];
+        for (int row = 0; row < 3; row++)
+            mapped[row] = t.linear[row][0] * p[0] + t.linear[row][1] * p[1] + t.linear[row][2] * p[2] + t.translation[row];
+        if (normalize)
+        {
+            const float length = std::sqrt(mapped[0] * mapped[0] + mapped[1] * mapped[1] + mapped[2] * mapped[2]);
+            for (int row = 0; row < 3; row++)
+                mapped[row] = (length > 0.0f) ? mapped[row] / length : 0.0f;
+        }
+        p[0] = mapped[0];
+        p[1] = mapped[1];
+        p[2] = mapped[2];
+    }
+}
+
+#ifdef CORE_SSE_KERNEL
+/*
+ * Four points are three registers of packed coordinates:
+ *   a = x0 y0 z0 x1, b = y1 z1 x2 y2, c = z2 x3 y3 z3
+ * They are shuffled into one register per axis, mapped with a broadcast of
+ * every matrix element and shuffled back.
+ */
+template <bool normalize>
+void transformSse(const AffineTransform& t, float* coords, int first, int last)
+{
+    __m128 m[3][3], translation[3];
+    for (int row = 0; row < 3; row++)
+    {
+        for (int column = 0; column < 3; column++)
+            m[row][column] = _mm_set1_ps(t.linear[row][column]);
+        translation[row] = _mm_set1_ps(t.translation[row]);
+    }
+
+    int point_i = first;
+    for (; point_i + 4 <= last; point_i += 4)
+    {
+        float* p = coords + 3 * point_i;
+        const __m128 a = _mm_loadu_ps(p);
+        const __m128 b = _mm_loadu_ps(p + 4);
+        const __m128 c = _mm_loadu_ps(p + 8);
+
+        const __m128 in[3] = {
+            _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 0, 3, 2)), _MM_SHUFFLE(3, 0, 3, 0)),
+            _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)),
+            _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0))
+        };
+        __m128 out[3];
+        for (int row = 0; row < 3; row++)
+        {
+            out[row] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[row][0], in[0]), _mm_mul_ps(m[row][1], in[1])),
+                                             _mm_mul_ps(m[row][2], in[2])),
+                                  translation[row]);
+        }
+        if (normalize)
+        {
+            const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(out[0], out[0]), _mm_mul_ps(out[1], out[1])), _mm_mul_ps(out[2], out[2])));
+            const __m128 nonZero = _mm_cmpgt_ps(length, _mm_setzero_ps());
+            for (int row = 0; row < 3; row++)
+                out[row] = _mm_and_ps(nonZero, _mm_div_ps(out[row], length));
+        }
+
+        _mm_storeu_ps(p, _mm_shuffle_ps(_mm_shuffle_ps(out[0], out[1], _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(out[2], out[0], _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(p + 4, _mm_shuffle_ps(_mm_shuffle_ps(out[1], out[2], _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(out[0], out[1], _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(p + 8, _mm_shuffle_ps(_mm_shuffle_ps(out[2], out[0], _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(out[1], out[2], _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+    }
+    transformScalar<normalize>(t, coords, point_i, last);
+}
+#endif
+
+template <bool normalize>
+void transformAll(const AffineTransform& t, QVector3D* points, int count)
+{
+    float* coords = reinterpret_cast<float*>(points);
+    forRanges(count, [&t, coords](int first, int last) {
+#ifdef CORE_SSE_KERNEL
+        transformSse<normalize>(t, coords, first, last);
+#else
+        transformScalar<normalize>(t, coords, first, last);
+#endif
+    });
+}
+
+} // anonymous namespace
+
+void transformPoints(const AffineTransform& transform, QVector3D* points, int count)
+{
+    transformAll<false>(transform, points, count);
+}
+
+void transformNormals(const AffineTransform& normalTransform, QVector3D* normals, int count)
+{
+    transformAll<true>(normalTransform, normals, count);
+}
+
+} // namespace Core
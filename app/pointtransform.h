@@ -0,0 +1,40 @@
+#ifndef CORE_POINTTRANSFORM_H
+#define CORE_POINTTRANSFORM_H
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+namespace Core {
+
+/*!
+ * \brief Linear map plus translation, the affine part of a QMatrix4x4
+ *
+ * A point p maps to linear * p + translation. Unlike QMatrix4x4::map() there
+ * is no fourth row and no perspective divide.
+ */
+struct AffineTransform
+{
+    float linear[3][3]; // [row][column]
+    float translation[3];
+
+    AffineTransform();
+    explicit AffineTransform(const QMatrix4x4& matrix); // the projective row of matrix is ignored
+
+    /// Maps face normals along with the points: the cofactor matrix of the linear part, without translation. Results need normalizing.
+    AffineTransform normalTransform() const;
+    QVector3D map(const QVector3D& point) const;
+};
+
+/**
+ * @brief Maps count points in place, in parallel
+ *
+ * Runs an SSE kernel on four points at a time where available.
+ */
+void transformPoints(const AffineTransform& transform, QVector3D* points, int count);
+
+/// Maps count normals in place and scales them back to unit length. Zero normals stay zero.
+void transformNormals(const AffineTransform& normalTransform, QVector3D* normals, int count);
+
+} // namespace Core
+
+#endif // CORE_POINTTRANSFORM_H
@@ -27,7 +27,17 @@ void RenderState::setupProgram()
 
 void RenderState::addAttribute(const char* name, QOpenGLBuffer& vbo, const void* offset)
 {
-    attributes.append({name, vbo, offset});
+    attributes.append({name, vbo, 3, GL_FLOAT, false, 0, offset});
+}
+
+void RenderState::addAttribute(const char* name, QOpenGLBuffer& vbo, int tupleSize, GLenum type, bool normalized, int stride, int offset)
+{
+    attributes.append({name, vbo, tupleSize, type, normalized, stride, reinterpret_cast<const void*>(qintptr(offset))});
+}
+
+void RenderState::setIndexBuffer(QOpenGLBuffer& ibo)
+{
+    indexBuffer = &ibo;
 }
 
 void RenderState::setupVao()
@@ -37,16 +47,23 @@ void RenderState::setupVao()
     vao.create();
     vao.bind();
 
+    // attributes of an interleaved buffer follow each other, so the buffer is bound once for all of them
+    QOpenGLBuffer* bound = nullptr;
     for (int attr_i=0; attr_i < attributes.size(); attr_i++)
     {
         Attribute& attr = attributes[attr_i];
-        QOpenGLBuffer& vbo = attr.vbo;
-
-        vbo.bind();
+        if (bound != &attr.vbo)
+        {
+            attr.vbo.bind();
+            bound = &attr.vbo;
+        }
         f->glEnableVertexAttribArray(attr_i);
-        f->glVertexAttribPointer(attr_i, 3, GL_FLOAT, GL_FALSE, 0 * sizeof(GLfloat),attr.offset); // use three floats and no stride by convention
-        vbo.release();
+        f->glVertexAttribPointer(attr_i, attr.tupleSize, attr.type, attr.normalized ? GL_TRUE : GL_FALSE, attr.stride, attr.offset);
     }
+    if (bound)
+        bound->release();
+    if (indexBuffer)
+        indexBuffer->bind(); // stays bound to the vao, so it must not be released before the vao is
     vao.release();
 }
 
@@ -62,3 +79,49 @@ void RenderState::cleanup()
 }
 
 
+
+bool IntegerTarget::create(const QSize& size, GLenum colorFormat)
+{
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+
+    destroy();
+    f->glGenFramebuffers(1, &framebuffer);
+    f->glGenRenderbuffers(1, &colorBuffer);
+    f->glGenRenderbuffers(1, &depthBuffer);
+    targetSize = size;
+
+    f->glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    f->glRenderbufferStorage(GL_RENDERBUFFER, colorFormat, size.width(), size.height());
+    f->glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    f->glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size.width(), size.height());
+    f->glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    // the caller binds its own framebuffer again afterwards
+    f->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    if (f->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+void IntegerTarget::destroy()
+{
+    if (!framebuffer)
+        return;
+
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+    f->glDeleteFramebuffers(1, &framebuffer);
+    f->glDeleteRenderbuffers(1, &colorBuffer);
+    f->glDeleteRenderbuffers(1, &depthBuffer);
+    framebuffer = colorBuffer = depthBuffer = 0;
+    targetSize = QSize();
+}
+
+void IntegerTarget::bind()
+{
+    QOpenGLContext::currentContext()->functions()->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
@@ -5,6 +5,7 @@
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLFunctions>
+#include <QSize>
 
 
 
@@ -19,22 +20,52 @@ public:
     QOpenGLShaderProgram* program = nullptr; // public for easier access
     QOpenGLVertexArrayObject vao; // same here
 
+    /// Where an attribute is found in a vertex buffer and what it's made of, as in glVertexAttribPointer
     struct Attribute
     {
         const char* name; // attribute name as written in the vertex shader
         QOpenGLBuffer& vbo;
-        const void* offset;
+        int tupleSize; // components per vertex
+        GLenum type; // of each component
+        bool normalized; // integer components are mapped to [0,1] or [-1,1]
+        int stride; // bytes from one vertex to the next. 0 for tightly packed.
+        const void* offset; // of the first component in the buffer
     };
 
     QVector<Attribute> attributes;
+    QOpenGLBuffer* indexBuffer = nullptr; // element buffer recorded in the vao, for glDrawElements. None for glDrawArrays.
 
     void setVShader(const char* vshader);
     void setFShader(const char* fshader);
     void setupProgram();
-    void addAttribute(const char* name, QOpenGLBuffer& vbo, const void* offset = 0);
+    void addAttribute(const char* name, QOpenGLBuffer& vbo, const void* offset = 0); // three packed floats
+    void addAttribute(const char* name, QOpenGLBuffer& vbo, int tupleSize, GLenum type, bool normalized, int stride, int offset);
+    void setIndexBuffer(QOpenGLBuffer& ibo);
     void setupVao();
     void cleanup();
 
 };
 
+/*!
+ * \brief Offscreen framebuffer of integer pixels with a depth buffer
+ *
+ * For the face id pass. QOpenGLFramebufferObject can't allocate integer color
+ * formats such as GL_R32UI, so the color and depth buffers are renderbuffers
+ * set up here.
+ */
+class IntegerTarget
+{
+    GLuint framebuffer = 0;
+    GLuint colorBuffer = 0;
+    GLuint depthBuffer = 0;
+    QSize targetSize;
+
+public:
+    bool create(const QSize& size, GLenum colorFormat); // replaces any buffers there were. Returns false if the result can't be rendered to.
+    void destroy();
+    void bind();
+    bool isCreated() const { return framebuffer != 0; }
+    QSize size() const { return targetSize; }
+};
+
 #endif // RENDERING_H
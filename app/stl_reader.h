@@ -128,11 +128,32 @@
 #define __H__STL_READER
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#ifdef _WIN32
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
 #ifdef STL_READER_NO_EXCEPTIONS
   #define STL_READER_THROW(msg) return false;
   #define STL_READER_COND_THROW(cond, msg) if(cond) return false;
@@ -222,6 +243,116 @@ bool ReadStlFile_BINARY(const char* filename,
                         TIndexContainer1& trisOut,
                         TIndexContainer2& solidRangesOut);
 
+/// Tells long running reads and welds to stop early
+/** Called now and then, possibly from several threads at once. Once it returns
+ * true, the function it was passed to returns false as soon as possible and
+ * leaves its output in an unspecified state. An empty check never cancels.
+ */
+typedef std::function<bool ()> CancelCheck;
+
+/// Reads an ASCII or binary stl file into a triangle soup
+/** Same as ReadStlFile, but triangle corners are not identified with each other.
+ * Use WeldStlSoup to obtain the output of ReadStlFile from the soup. Reading and
+ * welding separately allows callers to write the welded mesh straight into their
+ * own storage.
+ *
+ * \param filename  [in] The name of the file which shall be read
+ *
+ * \param cornerCoordsOut [out] On termination, it has size numFaces * 9. Each triple
+ *                              of entries forms the coordinate of a triangle corner,
+ *                              each three consecutive corners form a triangle.
+ *
+ * \param normalsOut  [out] Face normals, see ReadStlFile.
+ *
+ * \param solidRangesOut  [out] Triangle ranges of individual solids, see ReadStlFile.
+ *
+ * \param cancelled  [in] Stops reading early, see CancelCheck.
+ *
+ * \returns true if the file was successfully read into the provided container,
+ *          false if it was cancelled.
+ */
+template <class TNumberContainer1, class TNumberContainer2, class TIndexContainer>
+bool ReadStlFileSoup(const char* filename,
+                     TNumberContainer1& cornerCoordsOut,
+                     TNumberContainer2& normalsOut,
+                     TIndexContainer& solidRangesOut,
+                     const CancelCheck& cancelled = CancelCheck());
+
+/// Reads an ASCII stl file into a triangle soup
+/** \copydetails ReadStlFileSoup
+ * \sa ReadStlFileSoup, ReadStlFile_ASCII
+ */
+template <class TNumberContainer1, class TNumberContainer2, class TIndexContainer>
+bool ReadStlFileSoup_ASCII(const char* filename,
+                           TNumberContainer1& cornerCoordsOut,
+                           TNumberContainer2& normalsOut,
+                           TIndexContainer& solidRangesOut,
+                           const CancelCheck& cancelled = CancelCheck());
+
+/// Reads a binary stl file into a triangle soup
+/** \copydetails ReadStlFileSoup
+ * \todo  support systems with big endianess
+ * \sa    ReadStlFileSoup, ReadStlFile_BINARY
+ */
+template <class TNumberContainer1, class TNumberContainer2, class TIndexContainer>
+bool ReadStlFileSoup_BINARY(const char* filename,
+                            TNumberContainer1& cornerCoordsOut,
+                            TNumberContainer2& normalsOut,
+                            TIndexContainer& solidRangesOut,
+                            const CancelCheck& cancelled = CancelCheck());
+
+/// Identifies matching corners of a triangle soup
+/** Writes the unique corner coordinates of the soup to coordsOut and the
+ * triangle corner indices to trisOut, with the layout described in ReadStlFile.
+ * Degenerated triangles are removed. normalsInOut and solidRangesInOut are
+ * updated accordingly, so that they keep matching the triangles in trisOut.
+ *
+ * \param cornerCoords  [in] Soup as produced by ReadStlFileSoup.
+ * \param coordsOut [out] Unique coordinates, numVertices * 3 entries.
+ * \param normalsInOut  [in, out] Face normals, one triple per triangle.
+ * \param trisOut [out] Triangle corner indices, numFaces * 3 entries.
+ * \param solidRangesInOut  [in, out] Triangle ranges of individual solids.
+ * \param cancelled  [in] Stops welding early, see CancelCheck.
+ *
+ * \returns true if the soup was welded successfully, false if it was cancelled.
+ */
+template <class TNumberContainer1, class TNumberContainer2, class TNumberContainer3,
+          class TIndexContainer1, class TIndexContainer2>
+bool WeldStlSoup(const TNumberContainer1& cornerCoords,
+                 TNumberContainer2& coordsOut,
+                 TNumberContainer3& normalsInOut,
+                 TIndexContainer1& trisOut,
+                 TIndexContainer2& solidRangesInOut,
+                 const CancelCheck& cancelled = CancelCheck());
+
+/// Identifies corners of a triangle soup which are closer than a tolerance
+/** Same as WeldStlSoup, but corners whose distance is at most tolerance are
+ * welded as well, e.g. to close gaps left by coordinates which were rounded
+ * differently. Welding is transitive, so that tolerances close to the size of
+ * triangles collapse them. A tolerance of 0 or less welds equal coordinates only.
+ *
+ * \param tolerance  [in] Largest distance of corners which are welded.
+ *
+ * \param numMergedOut  [out] If not NULL, receives the number of vertices which
+ *                            were merged on top of those with equal coordinates.
+ */
+template <class TNumberContainer1, class TNumberContainer2, class TNumberContainer3,
+          class TIndexContainer1, class TIndexContainer2>
+bool WeldStlSoup(const TNumberContainer1& cornerCoords,
+                 TNumberContainer2& coordsOut,
+                 TNumberContainer3& normalsInOut,
+                 TIndexContainer1& trisOut,
+                 TIndexContainer2& solidRangesInOut,
+                 const double tolerance,
+                 size_t* numMergedOut = NULL,
+                 const CancelCheck& cancelled = CancelCheck());
+
+/// Limits the number of threads used for reading and welding
+/** \param maxThreads  [in] Largest number of threads of a single call. 0, the
+ *                        default, uses as many as there are hardware threads.
+ */
+inline void SetMaxWorkerThreads(const size_t maxThreads);
+
 /// Determines whether a stl file has ASCII format
 /** The underlying mechanism is simply checks whether the provided file starts
  * with the keyword solid. This should work for many stl files, but may
@@ -419,96 +550,945 @@ private:
 
 namespace stl_reader_impl {
 
-  // a coordinate triple with an additional index. The index is required
-  // for RemoveDoubles, so that triangles can be reindexed properly.
-  template <typename number_t, typename index_t>
-  struct CoordWithIndex {
-    number_t data[3];
-    index_t index;
+  // read-only memory mapping of a whole file. The readers decode the file
+  // contents in place instead of streaming them through an ifstream.
+  class MappedFile {
+  public:
+    MappedFile () : m_data (NULL), m_size (0)
+    #ifdef _WIN32
+      , m_file (INVALID_HANDLE_VALUE), m_mapping (NULL)
+    #endif
+    {}
 
-    bool operator == (const CoordWithIndex& c) const
-    {
-      return (c[0] == data[0]) && (c[1] == data[1]) && (c[2] == data[2]);
-    }
+    ~MappedFile ()  {close ();}
 
-    bool operator != (const CoordWithIndex& c) const
+    // maps the given file. Returns false if the file couldn't be opened or mapped.
+    // An empty file is mapped successfully with data() == NULL and size() == 0.
+    bool open (const char* filename)
     {
-      return (c[0] != data[0]) || (c[1] != data[1]) || (c[2] != data[2]);
+      close ();
+
+    #ifdef _WIN32
+      m_file = CreateFileA (filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      if(m_file == INVALID_HANDLE_VALUE)
+        return false;
+
+      LARGE_INTEGER size;
+      if(!GetFileSizeEx (m_file, &size)){
+        close ();
+        return false;
+      }
+
+      m_size = static_cast<size_t> (size.QuadPart);
+      if(m_size == 0)
+        return true;
+
+      m_mapping = CreateFileMappingA (m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+      if(m_mapping == NULL){
+        close ();
+        return false;
+      }
+
+      m_data = static_cast<const char*> (MapViewOfFile (m_mapping, FILE_MAP_READ, 0, 0, 0));
+      if(m_data == NULL){
+        close ();
+        return false;
+      }
+    #else
+      int fd = ::open (filename, O_RDONLY);
+      if(fd == -1)
+        return false;
+
+      struct stat st;
+      if(fstat (fd, &st) != 0){
+        ::close (fd);
+        return false;
+      }
+
+      m_size = static_cast<size_t> (st.st_size);
+      if(m_size > 0){
+        void* addr = mmap (NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr == MAP_FAILED){
+          ::close (fd);
+          m_size = 0;
+          return false;
+        }
+        m_data = static_cast<const char*> (addr);
+        posix_madvise (addr, m_size, POSIX_MADV_SEQUENTIAL);
+      }
+
+    //  the mapping stays valid after the descriptor is closed
+      ::close (fd);
+    #endif
+
+      return true;
     }
 
-    bool operator < (const CoordWithIndex& c) const
+    void close ()
     {
-      return (data[0] < c[0])
-          || (data[0] == c[0] && data[1] < c[1])
-          || (data[0] == c[0] && data[1] == c[1] && data[2] < c[2]);
+    #ifdef _WIN32
+      if(m_data)
+        UnmapViewOfFile (m_data);
+      if(m_mapping)
+        CloseHandle (m_mapping);
+      if(m_file != INVALID_HANDLE_VALUE)
+        CloseHandle (m_file);
+      m_mapping = NULL;
+      m_file = INVALID_HANDLE_VALUE;
+    #else
+      if(m_data)
+        munmap (const_cast<char*> (m_data), m_size);
+    #endif
+      m_data = NULL;
+      m_size = 0;
     }
 
-    inline number_t& operator [] (const size_t i)   {return data[i];}
-    inline number_t operator [] (const size_t i) const  {return data[i];}
+    const char* data () const   {return m_data;}
+    size_t size () const        {return m_size;}
+
+  private:
+    MappedFile (const MappedFile&);
+    MappedFile& operator = (const MappedFile&);
+
+    const char* m_data;
+    size_t      m_size;
+  #ifdef _WIN32
+    HANDLE      m_file;
+    HANDLE      m_mapping;
+  #endif
   };
 
-  // sorts the array coordsWithIndexInOut and copies unique indices to coordsOut.
-  // Triangle-corners are re-indexed on the fly and degenerated triangles are removed.
-  template <class TNumberContainer, class TIndexContainer>
-  void RemoveDoubles (TNumberContainer& uniqueCoordsOut,
-                      TIndexContainer& trisInOut,
-                      std::vector <CoordWithIndex<
-                        typename TNumberContainer::value_type,
-                        typename TIndexContainer::value_type> >
-                        &coordsWithIndexInOut)
+  // upper bound on the number of worker threads set by SetMaxWorkerThreads, 0 if there is none
+  inline std::atomic<size_t>& MaxWorkerThreads ()
   {
-    using namespace std;
+    static std::atomic<size_t> maxThreads (0);
+    return maxThreads;
+  }
+
+  // returns true if cancelled is set and tells to stop
+  inline bool IsCancelled (const CancelCheck& cancelled)
+  {
+    return cancelled && cancelled ();
+  }
+
+  // returns the number of worker threads to use for a job of the given size.
+  // Small jobs are not split, so that thread creation doesn't dominate.
+  inline size_t NumWorkerThreads (const size_t workSize, const size_t minWorkPerThread)
+  {
+    size_t numThreads = std::thread::hardware_concurrency();
+    if(numThreads == 0)
+      numThreads = 1;
+    if(MaxWorkerThreads () > 0)
+      numThreads = std::min<size_t> (numThreads, MaxWorkerThreads ());
+
+    const size_t byWork = workSize / minWorkPerThread;
+    return std::max<size_t> (1, std::min (numThreads, byWork));
+  }
+
+  // runs task(i) for each i in [0, numTasks), each on its own thread. The calling
+  // thread executes task(0). Returns true if all tasks returned true. If tasks
+  // throw, the exception of the task with the lowest index is rethrown.
+  template <class TTask>
+  bool RunTasks (const size_t numTasks, const TTask& task)
+  {
+    std::vector<char> results (numTasks, 0);
+    #ifndef STL_READER_NO_EXCEPTIONS
+    std::vector<std::exception_ptr> errors (numTasks);
+    #endif
+
+    auto runTask = [&](const size_t i) {
+      #ifndef STL_READER_NO_EXCEPTIONS
+      try {
+        results[i] = task (i);
+      } catch (...) {
+        errors[i] = std::current_exception ();
+      }
+      #else
+      results[i] = task (i);
+      #endif
+    };
+
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < numTasks; ++i)
+      threads.push_back (std::thread (runTask, i));
+
+    if(numTasks > 0)
+      runTask (0);
+
+    for(size_t i = 0; i < threads.size(); ++i)
+      threads[i].join ();
+
+    #ifndef STL_READER_NO_EXCEPTIONS
+    for(size_t i = 0; i < numTasks; ++i){
+      if(errors[i])
+        std::rethrow_exception (errors[i]);
+    }
+    #endif
+
+    return std::find (results.begin(), results.end(), 0) == results.end();
+  }
 
-    typedef typename TNumberContainer::value_type number_t;
-    typedef typename TIndexContainer::value_type  index_t;
 
-    sort (coordsWithIndexInOut.begin(), coordsWithIndexInOut.end());
-  
-  //  first count unique indices
-    index_t numUnique = 1;
-    for(size_t i = 1; i < coordsWithIndexInOut.size(); ++i){
-      if(coordsWithIndexInOut[i] != coordsWithIndexInOut[i - 1])
-        ++numUnique;
+  // returns a hash of the given coordinate triple. Coordinates which compare
+  // equal yield equal hashes (in particular -0 and +0).
+  template <typename number_t>
+  inline unsigned int HashCoord (const number_t* c)
+  {
+    static const unsigned long long primes[3] = {
+      0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL};
+
+    unsigned long long h = 0;
+    for(int i = 0; i < 3; ++i){
+      const number_t v = (c[i] == 0) ? number_t(0) : c[i];
+      unsigned long long bits = 0;
+      memcpy (&bits, &v, std::min (sizeof(v), sizeof(bits)));
+      h ^= (bits + i) * primes[i];
+      h = (h << 27) | (h >> 37);
     }
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return static_cast<unsigned int> (h);
+  }
 
+  template <typename number_t>
+  inline bool CoordsEqual (const number_t* a, const number_t* b)
+  {
+    return (a[0] == b[0]) && (a[1] == b[1]) && (a[2] == b[2]);
+  }
+
+  // numbers the representative corners of rep in order of their first occurrence,
+  // copies their coordinates to uniqueCoordsOut and re-indexes trisInOut accordingly.
+  // rep[c] <= c has to hold for all corners c. Degenerated triangles are removed,
+  // together with their normals, and solid ranges are adjusted to the remaining
+  // triangles. rangeBegins splits the corners into one range per worker thread.
+  // Returns the number of unique corners.
+  template <typename number_t, typename index_t, class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+  size_t WeldRepresentatives (std::vector<index_t>& rep,
+                              const number_t* coords,
+                              const std::vector<size_t>& rangeBegins,
+                              TNumberContainer1& uniqueCoordsOut,
+                              TIndexContainer1& trisInOut,
+                              TNumberContainer2& normalsInOut,
+                              TIndexContainer2& solidRangesInOut)
+  {
+    using namespace std;
+
+    const size_t numThreads = rangeBegins.size() - 1;
+    const size_t numCorners = rangeBegins[numThreads];
+
+  //  number unique corners in order of their first occurrence
+    vector<size_t> uniqueBegins (numThreads + 1, 0);
+    RunTasks (numThreads, [&](const size_t r) {
+      size_t n = 0;
+      for(size_t c = rangeBegins[r]; c < rangeBegins[r + 1]; ++c)
+        n += (rep[c] == c);
+      uniqueBegins[r + 1] = n;
+      return true;
+    });
+    for(size_t r = 0; r < numThreads; ++r)
+      uniqueBegins[r + 1] += uniqueBegins[r];
+    const size_t numUnique = uniqueBegins[numThreads];
+
+    vector<index_t> newIndex (numCorners);
     uniqueCoordsOut.resize (numUnique * 3);
-    vector<index_t> newIndex (coordsWithIndexInOut.size());
-
-  //  copy unique coordinates to 'uniqueCoordsOut' and create an index-map
-  //  'newIndex', which allows to re-index triangles later on.
-    index_t curInd = 0;
-    newIndex[0] = 0;
-    for(index_t i = 0; i < 3; ++i)
-      uniqueCoordsOut[i] = coordsWithIndexInOut[0][i];
-
-    for(size_t i = 1; i < coordsWithIndexInOut.size(); ++i){
-      const CoordWithIndex <number_t, index_t> c = coordsWithIndexInOut[i];
-      if(c != coordsWithIndexInOut[i - 1]){
-        ++curInd;
-        for(index_t j = 0; j < 3; ++j)
-          uniqueCoordsOut[curInd * 3 + j] = coordsWithIndexInOut[i][j];
+    RunTasks (numThreads, [&](const size_t r) {
+      size_t curInd = uniqueBegins[r];
+      for(size_t c = rangeBegins[r]; c < rangeBegins[r + 1]; ++c){
+        if(rep[c] == c){
+          for(size_t j = 0; j < 3; ++j)
+            uniqueCoordsOut[curInd * 3 + j] = coords[c * 3 + j];
+          newIndex[c] = static_cast<index_t> (curInd++);
+        }
+      }
+      return true;
+    });
+
+  //  representatives always precede their doubles, so their new index is known by now
+    RunTasks (numThreads, [&](const size_t r) {
+      for(size_t c = rangeBegins[r]; c < rangeBegins[r + 1]; ++c){
+        if(rep[c] != c)
+          newIndex[c] = newIndex[rep[c]];
       }
+      return true;
+    });
 
-      newIndex[c.index] = static_cast<index_t> (curInd);
-    }
+    vector<index_t> ().swap (rep);
 
   //  re-index triangles, so that they refer to 'uniqueCoordsOut'
-  //  make sure to only add triangles which refer to three different indices
-    index_t numUniqueTriInds = 0;
-    for(index_t i = 0; i < trisInOut.size(); i+=3){
-      int ni[3];
-      for(int j = 0; j < 3; ++j)
-        ni[j] = newIndex[trisInOut[i+j]];
-
-      if((ni[0] != ni[1]) && (ni[0] != ni[2]) && (ni[1] != ni[2])){
+    const size_t numTris = trisInOut.size() / 3;
+    vector<char> degenerated (numThreads, 0);
+    RunTasks (numThreads, [&](const size_t r) {
+      for(size_t t = numTris / numThreads * r + min (r, numTris % numThreads),
+                 tEnd = numTris / numThreads * (r + 1) + min (r + 1, numTris % numThreads);
+          t < tEnd; ++t)
+      {
+        index_t ni[3];
         for(int j = 0; j < 3; ++j)
-          trisInOut[numUniqueTriInds + j] = ni[j];
-        numUniqueTriInds += 3;
+          ni[j] = newIndex[trisInOut[t * 3 + j]];
+        for(int j = 0; j < 3; ++j)
+          trisInOut[t * 3 + j] = ni[j];
+        if((ni[0] == ni[1]) || (ni[0] == ni[2]) || (ni[1] == ni[2]))
+          degenerated[r] = 1;
+      }
+      return true;
+    });
+
+  //  make sure to only keep triangles which refer to three different indices
+    if(find (degenerated.begin(), degenerated.end(), 1) != degenerated.end()){
+      const bool hasNormals = (normalsInOut.size() == numTris * 3);
+      const size_t numSolidInds = solidRangesInOut.size();
+      size_t solidInd = 0;
+      size_t numUniqueTris = 0;
+      for(size_t t = 0; t < numTris; ++t){
+        while(solidInd < numSolidInds && size_t(solidRangesInOut[solidInd]) <= t)
+          solidRangesInOut[solidInd++] = static_cast<typename TIndexContainer2::value_type> (numUniqueTris);
+
+        const index_t ni[3] = {trisInOut[t * 3], trisInOut[t * 3 + 1], trisInOut[t * 3 + 2]};
+        if((ni[0] != ni[1]) && (ni[0] != ni[2]) && (ni[1] != ni[2])){
+          for(int j = 0; j < 3; ++j){
+            trisInOut[numUniqueTris * 3 + j] = ni[j];
+            if(hasNormals)
+              normalsInOut[numUniqueTris * 3 + j] = normalsInOut[t * 3 + j];
+          }
+          ++numUniqueTris;
+        }
+      }
+      while(solidInd < numSolidInds)
+        solidRangesInOut[solidInd++] = static_cast<typename TIndexContainer2::value_type> (numUniqueTris);
+
+      trisInOut.resize (numUniqueTris * 3);
+      if(hasNormals)
+        normalsInOut.resize (numUniqueTris * 3);
+    }
+
+    return numUnique;
+  }
+
+  // welds triangle corners with equal coordinates and copies the unique coordinates
+  // to uniqueCoordsOut. cornerCoords holds three entries for each corner referenced
+  // by trisInOut. Triangles are re-indexed and degenerated triangles are removed,
+  // together with their normals. Solid ranges are adjusted to the remaining triangles.
+  //
+  // Corners are partitioned by the upper bits of their coordinate hash, then each
+  // partition is welded with its own hash table, so all steps run on all cores.
+  // Unique vertices are numbered in order of their first occurrence, which makes
+  // the result independent of the number of threads.
+  //
+  // cancelled is checked in between the steps. Returns false if it stopped the weld.
+  template <class TCornerContainer, class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+  bool RemoveDoubles (TNumberContainer1& uniqueCoordsOut,
+                      TIndexContainer1& trisInOut,
+                      const TCornerContainer& cornerCoords,
+                      TNumberContainer2& normalsInOut,
+                      TIndexContainer2& solidRangesInOut,
+                      const CancelCheck& cancelled)
+  {
+    using namespace std;
+
+    typedef typename TCornerContainer::value_type number_t;
+    typedef typename TIndexContainer1::value_type index_t;
+
+    const size_t numCorners = cornerCoords.size() / 3;
+    const number_t* coords = cornerCoords.empty() ? NULL : &cornerCoords[0];
+
+    const size_t numThreads = NumWorkerThreads (numCorners, 1 << 16);
+    vector<size_t> rangeBegins (numThreads + 1);
+    for(size_t i = 0; i <= numThreads; ++i)
+      rangeBegins[i] = numCorners / numThreads * i + min (i, numCorners % numThreads);
+
+  //  about 16k corners per partition, so that a partition's table stays in cache
+    unsigned int partitionBits = 0;
+    while(partitionBits < 16 && (size_t(1) << partitionBits) * (1 << 14) < numCorners)
+      ++partitionBits;
+    const size_t numPartitions = size_t(1) << partitionBits;
+
+  //  hash all corners and count them per range and partition
+    vector<unsigned int> hashes (numCorners);
+    vector<size_t> counts (numThreads * numPartitions, 0);
+    RunTasks (numThreads, [&](const size_t r) {
+      size_t* rangeCounts = &counts[r * numPartitions];
+      for(size_t c = rangeBegins[r]; c < rangeBegins[r + 1]; ++c){
+        const unsigned int h = HashCoord (coords + 3 * c);
+        hashes[c] = h;
+        ++rangeCounts[partitionBits ? (h >> (32 - partitionBits)) : 0];
+      }
+      return true;
+    });
+    if(IsCancelled (cancelled))
+      return false;
+
+  //  scatter corner indices to their partitions. Within each partition,
+  //  corners stay in ascending order.
+    vector<size_t> partitionBegins (numPartitions + 1, 0);
+    vector<size_t> offsets (numThreads * numPartitions);
+    size_t offset = 0;
+    for(size_t p = 0; p < numPartitions; ++p){
+      partitionBegins[p] = offset;
+      for(size_t r = 0; r < numThreads; ++r){
+        offsets[r * numPartitions + p] = offset;
+        offset += counts[r * numPartitions + p];
+      }
+    }
+    partitionBegins[numPartitions] = offset;
+
+    vector<index_t> partitioned (numCorners);
+    RunTasks (numThreads, [&](const size_t r) {
+      size_t* rangeOffsets = &offsets[r * numPartitions];
+      for(size_t c = rangeBegins[r]; c < rangeBegins[r + 1]; ++c){
+        const unsigned int h = hashes[c];
+        partitioned[rangeOffsets[partitionBits ? (h >> (32 - partitionBits)) : 0]++] = static_cast<index_t> (c);
+      }
+      return true;
+    });
+    if(IsCancelled (cancelled))
+      return false;
+
+  //  weld each partition. rep[c] receives the first corner with the same coordinates as c.
+    vector<index_t> rep (numCorners);
+    RunTasks (numThreads, [&](const size_t r) {
+      const index_t empty = numeric_limits<index_t>::max();
+      vector<index_t> table;
+      for(size_t p = r; p < numPartitions; p += numThreads){
+        const size_t partSize = partitionBegins[p + 1] - partitionBegins[p];
+        size_t tableSize = 16;
+        while(tableSize < 2 * partSize)
+          tableSize *= 2;
+        const size_t mask = tableSize - 1;
+        table.assign (tableSize, empty);
+
+        for(size_t i = partitionBegins[p]; i < partitionBegins[p + 1]; ++i){
+          const index_t c = partitioned[i];
+          size_t slot = hashes[c] & mask;
+          while(true){
+            if(table[slot] == empty){
+              table[slot] = c;
+              rep[c] = c;
+              break;
+            }
+            if(hashes[table[slot]] == hashes[c]
+               && CoordsEqual (coords + 3 * size_t(table[slot]), coords + 3 * size_t(c)))
+            {
+              rep[c] = table[slot];
+              break;
+            }
+            slot = (slot + 1) & mask;
+          }
+        }
+      }
+      return true;
+    });
+
+    vector<index_t> ().swap (partitioned);
+    vector<unsigned int> ().swap (hashes);
+    if(IsCancelled (cancelled))
+      return false;
+
+    WeldRepresentatives (rep, coords, rangeBegins, uniqueCoordsOut, trisInOut, normalsInOut, solidRangesInOut);
+    return true;
+  }
+
+  // returns a hash of the grid cell with the given integer coordinates
+  inline unsigned int HashCell (const long long* cell)
+  {
+    unsigned long long h = 0x9E3779B97F4A7C15ULL;
+    for(int i = 0; i < 3; ++i){
+      h ^= static_cast<unsigned long long> (cell[i]) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+      h *= 0xBF58476D1CE4E5B9ULL;
+    }
+    h ^= h >> 31;
+    return static_cast<unsigned int> (h);
+  }
+
+  // returns the representative of corner c in the union find forest 'parent'.
+  // Parents always have lower indices than their children, so that concurrent
+  // path halving and linking never form a cycle.
+  template <typename index_t>
+  inline index_t FindRoot (std::atomic<index_t>* parent, index_t c)
+  {
+    while(true){
+      index_t p = parent[c].load (std::memory_order_relaxed);
+      if(p == c)
+        return c;
+      const index_t gp = parent[p].load (std::memory_order_relaxed);
+      if(gp != p)
+        parent[c].compare_exchange_weak (p, gp, std::memory_order_relaxed);
+      c = gp;
+    }
+  }
+
+  // joins the sets of corners a and b. The lower root becomes the root of both.
+  template <typename index_t>
+  inline void UniteRoots (std::atomic<index_t>* parent, index_t a, index_t b)
+  {
+    while(true){
+      a = FindRoot (parent, a);
+      b = FindRoot (parent, b);
+      if(a == b)
+        return;
+      if(b < a)
+        std::swap (a, b);
+      index_t expected = b;
+      if(parent[b].compare_exchange_strong (expected, a, std::memory_order_relaxed))
+        return;
+    }
+  }
+
+  // same as RemoveDoubles, but corners closer than 'tolerance' are welded as well.
+  // Welding is transitive: corners of a chain whose links are shorter than the
+  // tolerance end up as a single vertex, placed at the first corner of the chain.
+  //
+  // Corners are put into a uniform grid with cells of four times the tolerance,
+  // stored as one hash table per partition of cells. Equal corners are identified
+  // while the tables are built. Each distinct corner is then compared with those of
+  // its own cell and of the neighbour cells it is close to, and close pairs are
+  // joined in a lock free union find forest. Sets are identified by their lowest
+  // corner, so the result does not depend on the number of threads.
+  //
+  // numMergedOut receives the number of vertices that were merged beyond those with
+  // equal coordinates. cancelled is checked in between the steps. Returns false if it
+  // stopped the weld.
+  template <class TCornerContainer, class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+  bool RemoveDoublesTolerant (TNumberContainer1& uniqueCoordsOut,
+                              TIndexContainer1& trisInOut,
+                              const TCornerContainer& cornerCoords,
+                              TNumberContainer2& normalsInOut,
+                              TIndexContainer2& solidRangesInOut,
+                              const double tolerance,
+                              size_t& numMergedOut,
+                              const CancelCheck& cancelled)
+  {
+    using namespace std;
+
+    typedef typename TCornerContainer::value_type number_t;
+    typedef typename TIndexContainer1::value_type index_t;
+
+    const size_t numCorners = cornerCoords.size() / 3;
+    const number_t* coords = cornerCoords.empty() ? NULL : &cornerCoords[0];
+    const double tolerance2 = tolerance * tolerance;
+    const double cellSize = 4 * tolerance; // a corner is close to at most one border per axis
+    const double cellLimit = 4.6e18; // keeps cell coordinates and their neighbours within long long
+
+    const size_t numThreads = NumWorkerThreads (numCorners, 1 << 16);
+    vector<size_t> rangeBegins (numThreads + 1);
+    for(size_t i = 0; i <= numThreads; ++i)
+      rangeBegins[i] = numCorners / numThreads * i + min (i, numCorners % numThreads);
+
+    unsigned int partitionBits = 0;
+    while(partitionBits < 16 && (size_t(1) << partitionBits) * (1 << 14) < numCorners)
+      ++partitionBits;
+    const size_t numPartitions = size_t(1) << partitionBits;
+
+  //  find the cell of each corner and count corners per range and partition
+    vector<long long> cells (numCorners * 3);
+    vector<unsigned int> hashes (numCorners);
+    vector<size_t> counts (numThreads * numPartitions, 0);
+    RunTasks (numThreads, [&](const size_t r) {
+      size_t* rangeCounts = &counts[r * numPartitions];
+      for(size_t c = rangeBegins[r]; c < rangeBegins[r + 1]; ++c){
+        for(int j = 0; j < 3; ++j){
+          const double cell = floor (double(coords[c * 3 + j]) / cellSize);
+          cells[c * 3 + j] = static_cast<long long> (max (-cellLimit, min (cellLimit, cell)));
+        }
+        const unsigned int h = HashCell (&cells[c * 3]);
+        hashes[c] = h;
+        ++rangeCounts[partitionBits ? (h >> (32 - partitionBits)) : 0];
+      }
+      return true;
+    });
+    if(IsCancelled (cancelled))
+      return false;
+
+    vector<size_t> partitionBegins (numPartitions + 1, 0);
+    vector<size_t> offsets (numThreads * numPartitions);
+    size_t offset = 0;
+    for(size_t p = 0; p < numPartitions; ++p){
+      partitionBegins[p] = offset;
+      for(size_t r = 0; r < numThreads; ++r){
+        offsets[r * numPartitions + p] = offset;
+        offset += counts[r * numPartitions + p];
+      }
+    }
+    partitionBegins[numPartitions] = offset;
+
+    vector<index_t> partitioned (numCorners);
+    RunTasks (numThreads, [&](const size_t r) {
+      size_t* rangeOffsets = &offsets[r * numPartitions];
+      for(size_t c = rangeBegins[r]; c < rangeBegins[r + 1]; ++c){
+        const unsigned int h = hashes[c];
+        partitioned[rangeOffsets[partitionBits ? (h >> (32 - partitionBits)) : 0]++] = static_cast<index_t> (c);
+      }
+      return true;
+    });
+    if(IsCancelled (cancelled))
+      return false;
+
+  //  build the cell tables. Corners with equal coordinates are represented by the
+  //  lowest of them and only representatives are put into the cells: a slot holds
+  //  the last representative of a cell and cellNext links each one to the previous
+  //  one of the same cell. Partitions are small enough for their tables to stay in cache.
+    const index_t empty = numeric_limits<index_t>::max();
+    vector<size_t> tableBegins (numPartitions + 1, 0);
+    for(size_t p = 0; p < numPartitions; ++p){
+      size_t tableSize = 16;
+      while(tableSize < 2 * (partitionBegins[p + 1] - partitionBegins[p]))
+        tableSize *= 2;
+      tableBegins[p + 1] = tableBegins[p] + tableSize;
+    }
+    vector<index_t> tables (tableBegins[numPartitions], empty);
+    vector<index_t> cellNext (numCorners, empty);
+    vector<index_t> exactRep (numCorners);
+    vector<size_t> exactUniques (numThreads, 0);
+
+    auto sameCell = [&](const index_t a, const long long* cell) {
+      return cells[a * 3] == cell[0] && cells[a * 3 + 1] == cell[1] && cells[a * 3 + 2] == cell[2];
+    };
+
+    RunTasks (numThreads, [&](const size_t r) {
+      for(size_t p = r; p < numPartitions; p += numThreads){
+        index_t* table = &tables[tableBegins[p]];
+        const size_t mask = tableBegins[p + 1] - tableBegins[p] - 1;
+        for(size_t i = partitionBegins[p]; i < partitionBegins[p + 1]; ++i){
+          const index_t c = partitioned[i];
+          size_t slot = hashes[c] & mask;
+          while(table[slot] != empty && !sameCell (table[slot], &cells[c * 3]))
+            slot = (slot + 1) & mask;
+
+          index_t o = table[slot];
+          while(o != empty && !CoordsEqual (coords + 3 * size_t(c), coords + 3 * size_t(o)))
+            o = cellNext[o];
+          if(o != empty){
+            exactRep[c] = o; // corners come in ascending order, so o is the lowest one
+          } else {
+            exactRep[c] = c;
+            cellNext[c] = table[slot];
+            table[slot] = c;
+            ++exactUniques[r];
+          }
+        }
+      }
+      return true;
+    });
+
+    vector<index_t> ().swap (partitioned);
+    if(IsCancelled (cancelled))
+      return false;
+
+  //  join each representative with the lower representatives in reach. Their doubles
+  //  have the same neighbourhood and simply follow them. Neighbour cells are only
+  //  visited on the sides where the corner is closer to the border than the tolerance.
+    std::unique_ptr<atomic<index_t>[]> parent (new atomic<index_t>[numCorners]);
+    for(size_t c = 0; c < numCorners; ++c)
+      parent[c].store (static_cast<index_t> (c), memory_order_relaxed);
+
+    RunTasks (numThreads, [&](const size_t r) {
+      for(size_t c = rangeBegins[r]; c < rangeBegins[r + 1]; ++c){
+        if(exactRep[c] != c)
+          continue;
+
+        const number_t* cc = coords + 3 * c;
+        const long long* cell = &cells[c * 3];
+        int lower[3], upper[3];
+        for(int j = 0; j < 3; ++j){
+          const double inCell = double(cc[j]) / cellSize - double(cell[j]); // in [0, 1) unless rounded
+          lower[j] = (inCell < 0.3) ? -1 : 0;
+          upper[j] = (inCell > 0.7) ? 1 : 0;
+        }
+
+        for(int dx = lower[0]; dx <= upper[0]; ++dx)
+        for(int dy = lower[1]; dy <= upper[1]; ++dy)
+        for(int dz = lower[2]; dz <= upper[2]; ++dz){
+          const long long neighbour[3] = {cell[0] + dx, cell[1] + dy, cell[2] + dz};
+          const unsigned int h = HashCell (neighbour);
+          const size_t p = partitionBits ? (h >> (32 - partitionBits)) : 0;
+          const index_t* table = &tables[tableBegins[p]];
+          const size_t mask = tableBegins[p + 1] - tableBegins[p] - 1;
+          size_t slot = h & mask;
+          while(table[slot] != empty && !sameCell (table[slot], neighbour))
+            slot = (slot + 1) & mask;
+
+          for(index_t o = table[slot]; o != empty; o = cellNext[o]){
+            if(o >= c)
+              continue;
+            const number_t* oc = coords + 3 * size_t(o);
+            const double d[3] = {double(cc[0]) - oc[0], double(cc[1]) - oc[1], double(cc[2]) - oc[2]};
+            if(d[0] * d[0] + d[1] * d[1] + d[2] * d[2] <= tolerance2)
+              UniteRoots (parent.get(), static_cast<index_t> (c), o);
+          }
+        }
+      }
+      return true;
+    });
+
+    vector<index_t> ().swap (tables);
+    vector<index_t> ().swap (cellNext);
+    vector<unsigned int> ().swap (hashes);
+    vector<long long> ().swap (cells);
+    if(IsCancelled (cancelled))
+      return false;
+
+  //  the root of each set is its lowest corner, which is a representative
+    vector<index_t> rep (numCorners);
+    RunTasks (numThreads, [&](const size_t r) {
+      for(size_t c = rangeBegins[r]; c < rangeBegins[r + 1]; ++c)
+        rep[c] = FindRoot (parent.get(), exactRep[c]);
+      return true;
+    });
+    parent.reset ();
+    vector<index_t> ().swap (exactRep);
+
+    const size_t numExactUnique = accumulate (exactUniques.begin(), exactUniques.end(), size_t(0));
+    const size_t numUnique = WeldRepresentatives (rep, coords, rangeBegins, uniqueCoordsOut, trisInOut, normalsInOut, solidRangesInOut);
+    numMergedOut = numExactUnique - numUnique;
+    return true;
+  }
+
+  // whitespace as understood by the classic locale (and thus by the former
+  // istringstream based tokenizer)
+  inline bool IsSpace (const char c)
+  {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+  }
+
+  // parses the number at the beginning of the token [tok, tokEnd) with the
+  // same result as atof, but without allocating. Plain decimal numbers which
+  // can be converted exactly with a single floating point operation are handled
+  // inline, everything else is delegated to strtod.
+  inline double ParseNumber (const char* tok, const char* tokEnd)
+  {
+    static const double powersOf10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    const char* p = tok;
+    bool negative = false;
+    if(p < tokEnd && (*p == '-' || *p == '+')){
+      negative = (*p == '-');
+      ++p;
+    }
+
+    unsigned long long mantissa = 0;
+    int numDigits = 0;      // significant digits accumulated in mantissa
+    int exponent = 0;
+    bool anyDigits = false;
+
+    for(; p < tokEnd && *p >= '0' && *p <= '9'; ++p){
+      anyDigits = true;
+      if(mantissa == 0 && *p == '0')
+        continue;
+      mantissa = mantissa * 10 + (*p - '0');
+      ++numDigits;
+    }
+
+    if(p < tokEnd && *p == '.'){
+      for(++p; p < tokEnd && *p >= '0' && *p <= '9'; ++p){
+        anyDigits = true;
+        --exponent;
+        if(mantissa == 0 && *p == '0')
+          continue;
+        mantissa = mantissa * 10 + (*p - '0');
+        ++numDigits;
+      }
+    }
+
+    if(anyDigits && p < tokEnd && (*p == 'e' || *p == 'E')){
+      const char* e = p + 1;
+      bool negativeExp = false;
+      if(e < tokEnd && (*e == '-' || *e == '+')){
+        negativeExp = (*e == '-');
+        ++e;
+      }
+      if(e < tokEnd && *e >= '0' && *e <= '9'){
+        int expValue = 0;
+        for(; e < tokEnd && *e >= '0' && *e <= '9'; ++e){
+          if(expValue < 100000)
+            expValue = expValue * 10 + (*e - '0');
+        }
+        exponent += negativeExp ? -expValue : expValue;
+        p = e;
+      }
+    }
+
+    const bool exact = anyDigits && p == tokEnd && numDigits <= 15
+                       && exponent >= -22 && exponent <= 22;
+    if(exact){
+      double value = static_cast<double> (mantissa);
+      if(exponent < 0)
+        value /= powersOf10[-exponent];
+      else
+        value *= powersOf10[exponent];
+      return negative ? -value : value;
+    }
+
+  //  rare or malformed input: hand a zero terminated copy to strtod.
+  //  Tokens which don't fit into the buffer are rare enough to be allocated.
+    char buffer[128];
+    const size_t len = tokEnd - tok;
+    if(len >= sizeof(buffer))
+      return strtod (std::string (tok, tokEnd).c_str(), NULL);
+    memcpy (buffer, tok, len);
+    buffer[len] = 0;
+    return strtod (buffer, NULL);
+  }
+
+  // returns the 1-based number of the line which starts at lineBegin
+  inline size_t LineNumber (const char* fileBegin, const char* lineBegin)
+  {
+    return std::count (fileBegin, lineBegin, '\n') + 1;
+  }
+
+  // returns true if the first token of the line [lineBegin, lineEnd) equals keyword
+  inline bool LineStartsWith (const char* lineBegin, const char* lineEnd, const char* keyword)
+  {
+    const char* p = lineBegin;
+    while(p < lineEnd && IsSpace (*p))
+      ++p;
+    const size_t len = strlen (keyword);
+    return static_cast<size_t> (lineEnd - p) >= len
+        && memcmp (p, keyword, len) == 0
+        && (p + len == lineEnd || IsSpace (p[len]));
+  }
+
+  // returns the beginning of the first line at or behind pos whose first
+  // token is 'facet'. Returns end if there is no such line.
+  inline const char* FindFacetLine (const char* fileBegin, const char* pos, const char* end)
+  {
+  //  move to the beginning of the next line, unless pos already is at one
+    if(pos > fileBegin && pos[-1] != '\n'){
+      const char* nl = static_cast<const char*> (memchr (pos, '\n', end - pos));
+      pos = nl ? nl + 1 : end;
+    }
+
+    while(pos < end){
+      const char* nl = static_cast<const char*> (memchr (pos, '\n', end - pos));
+      const char* lineEnd = nl ? nl : end;
+      if(LineStartsWith (pos, lineEnd, "facet"))
+        return pos;
+      pos = nl ? nl + 1 : end;
+    }
+    return end;
+  }
+
+  // the output of parsing a part of an ASCII stl file
+  template <typename number_t, typename index_t>
+  struct AsciiChunk {
+    std::vector<number_t> coords;       // nine entries per triangle
+    std::vector<number_t> normals;      // three entries per triangle
+    std::vector<index_t>  solidBegins;  // number of triangles read before each 'solid' line
+  };
+
+  // parses the lines of an ASCII stl file in [begin, end) into a triangle soup.
+  // The range has to start at the beginning of a line. fileBegin is only used to
+  // compute line numbers for error messages. Returns false if cancelled stopped it.
+  template <typename number_t, typename index_t>
+  bool ParseAsciiChunk (const char* filename,
+                        const char* fileBegin,
+                        const char* begin,
+                        const char* end,
+                        AsciiChunk<number_t, index_t>& chunk,
+                        const CancelCheck& cancelled)
+  {
+    const int maxTokens = 5;
+    const char* tokBegin[maxTokens];
+    const char* tokEnd[maxTokens];
+    size_t numFaceVrts = 0;
+    number_t normal[3] = {0, 0, 0};
+    size_t numLines = 0;
+
+    const char* lineBegin = begin;
+    while(lineBegin < end)
+    {
+      if((++numLines & 0xFFFF) == 0 && IsCancelled (cancelled))
+        return false;
+
+      const char* nl = static_cast<const char*> (memchr (lineBegin, '\n', end - lineBegin));
+      const char* lineEnd = nl ? nl : end;
+
+    //  tokenize the line. Only the first tokens are of interest.
+      int tokenCount = 0;
+      for(const char* p = lineBegin; p < lineEnd;){
+        while(p < lineEnd && IsSpace (*p))
+          ++p;
+        if(p == lineEnd)
+          break;
+        const char* t = p;
+        while(p < lineEnd && !IsSpace (*p))
+          ++p;
+        if(tokenCount < maxTokens){
+          tokBegin[tokenCount] = t;
+          tokEnd[tokenCount] = p;
+        }
+        ++tokenCount;
       }
+
+      if(tokenCount > 0)
+      {
+        const char* tok = tokBegin[0];
+        const size_t tokLen = tokEnd[0] - tokBegin[0];
+
+        if(tokLen == 6 && memcmp (tok, "vertex", 6) == 0){
+          STL_READER_COND_THROW(tokenCount < 4,
+            "ERROR while reading from " << filename <<
+            ": vertex not specified correctly in line " << LineNumber (fileBegin, lineBegin));
+
+        //  read the position
+          for(size_t i = 0; i < 3; ++i)
+            chunk.coords.push_back (static_cast<number_t> (ParseNumber (tokBegin[i+1], tokEnd[i+1])));
+          ++numFaceVrts;
+        }
+        else if(tok[0] == 'f' && tokLen == 5 && memcmp (tok, "facet", 5) == 0)
+        {
+          STL_READER_COND_THROW(tokenCount < 5,
+            "ERROR while reading from " << filename <<
+            ": triangle not specified correctly in line " << LineNumber (fileBegin, lineBegin));
+
+          STL_READER_COND_THROW(tokEnd[1] - tokBegin[1] != 6 || memcmp (tokBegin[1], "normal", 6) != 0,
+            "ERROR while reading from " << filename <<
+            ": Missing normal specifier in line " << LineNumber (fileBegin, lineBegin));
+
+        //  read the normal
+          for(size_t i = 0; i < 3; ++i)
+            normal[i] = static_cast<number_t> (ParseNumber (tokBegin[i+2], tokEnd[i+2]));
+
+        //  drop vertices which were specified outside of a facet
+          chunk.coords.resize (chunk.normals.size() * 3);
+          numFaceVrts = 0;
+        }
+        else if(tokLen == 5 && memcmp (tok, "outer", 5) == 0){
+          STL_READER_COND_THROW ((tokenCount < 2) || tokEnd[1] - tokBegin[1] != 4
+                                 || memcmp (tokBegin[1], "loop", 4) != 0,
+            "ERROR while reading from " << filename <<
+            ": expecting outer loop in line " << LineNumber (fileBegin, lineBegin));
+        }
+        else if(tokLen == 8 && memcmp (tok, "endfacet", 8) == 0){
+          STL_READER_COND_THROW(numFaceVrts != 3,
+            "ERROR while reading from " << filename <<
+            ": bad number of vertices specified for face in line " << LineNumber (fileBegin, lineBegin));
+
+        //  the last three vertices form the triangle
+          const size_t triBegin = chunk.normals.size() * 3;
+          if(chunk.coords.size() != triBegin + 9){
+            std::copy (chunk.coords.end() - 9, chunk.coords.end(), chunk.coords.begin() + triBegin);
+            chunk.coords.resize (triBegin + 9);
+          }
+          for(size_t i = 0; i < 3; ++i)
+            chunk.normals.push_back (normal[i]);
+          numFaceVrts = 0;
+        }
+        else if(tokLen == 5 && memcmp (tok, "solid", 5) == 0){
+          chunk.solidBegins.push_back (static_cast<index_t> (chunk.normals.size() / 3));
+        }
+      }
+
+      lineBegin = lineEnd + 1;
     }
 
-    if(numUniqueTriInds < trisInOut.size())
-      trisInOut.resize (numUniqueTriInds);
+    chunk.coords.resize (chunk.normals.size() * 3);
+    return true;
   }
 }// end of namespace stl_reader_impl
 
@@ -535,175 +1515,252 @@ bool ReadStlFile_ASCII(const char* filename,
                        TNumberContainer2& normalsOut,
                        TIndexContainer1& trisOut,
                        TIndexContainer2& solidRangesOut)
+{
+  coordsOut.clear();
+  trisOut.clear();
+
+  std::vector<typename TNumberContainer1::value_type> cornerCoords;
+  if(!ReadStlFileSoup_ASCII(filename, cornerCoords, normalsOut, solidRangesOut))
+    return false;
+
+  return WeldStlSoup(cornerCoords, coordsOut, normalsOut, trisOut, solidRangesOut);
+}
+
+
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadStlFile_BINARY(const char* filename,
+                        TNumberContainer1& coordsOut,
+                        TNumberContainer2& normalsOut,
+                        TIndexContainer1& trisOut,
+                        TIndexContainer2& solidRangesOut)
+{
+  coordsOut.clear();
+  trisOut.clear();
+
+  std::vector<typename TNumberContainer1::value_type> cornerCoords;
+  if(!ReadStlFileSoup_BINARY(filename, cornerCoords, normalsOut, solidRangesOut))
+    return false;
+
+  return WeldStlSoup(cornerCoords, coordsOut, normalsOut, trisOut, solidRangesOut);
+}
+
+
+template <class TNumberContainer1, class TNumberContainer2, class TIndexContainer>
+bool ReadStlFileSoup(const char* filename,
+                     TNumberContainer1& cornerCoordsOut,
+                     TNumberContainer2& normalsOut,
+                     TIndexContainer& solidRangesOut,
+                     const CancelCheck& cancelled)
+{
+  if(StlFileHasASCIIFormat(filename))
+    return ReadStlFileSoup_ASCII(filename, cornerCoordsOut, normalsOut, solidRangesOut, cancelled);
+  else
+    return ReadStlFileSoup_BINARY(filename, cornerCoordsOut, normalsOut, solidRangesOut, cancelled);
+}
+
+
+template <class TNumberContainer1, class TNumberContainer2, class TIndexContainer>
+bool ReadStlFileSoup_ASCII(const char* filename,
+                           TNumberContainer1& cornerCoordsOut,
+                           TNumberContainer2& normalsOut,
+                           TIndexContainer& solidRangesOut,
+                           const CancelCheck& cancelled)
 {
   using namespace std;
   using namespace stl_reader_impl;
 
   typedef typename TNumberContainer1::value_type  number_t;
-  typedef typename TIndexContainer1::value_type index_t;
+  typedef typename TIndexContainer::value_type index_t;
 
-  coordsOut.clear();
+  cornerCoordsOut.clear();
   normalsOut.clear();
-  trisOut.clear();
   solidRangesOut.clear();
 
-  ifstream in(filename);
-  STL_READER_COND_THROW(!in, "Couldn't open file " << filename);
+  MappedFile file;
+  STL_READER_COND_THROW(!file.open(filename), "Couldn't open file " << filename);
+
+  const char* fileBegin = file.data();
+  const char* fileEnd = fileBegin + file.size();
+
+//  split the file into chunks which begin at 'facet' lines and parse them
+//  concurrently. Since the parser only carries state from a 'facet' line to
+//  its 'endfacet' line, the chunks can be parsed independently and joined in order.
+  const size_t numChunks = NumWorkerThreads (file.size(), 4 << 20);
+  vector<const char*> chunkBegins (numChunks + 1);
+  chunkBegins[0] = fileBegin;
+  chunkBegins[numChunks] = fileEnd;
+  for(size_t i = 1; i < numChunks; ++i){
+    const char* pos = max (chunkBegins[i - 1], fileBegin + file.size() / numChunks * i);
+    chunkBegins[i] = FindFacetLine (fileBegin, pos, fileEnd);
+  }
 
-  vector<CoordWithIndex <number_t, index_t> > coordsWithIndex;
+  vector<AsciiChunk <number_t, index_t> > chunks (numChunks);
+  const bool parsed = RunTasks (numChunks, [&](const size_t i) {
+    return ParseAsciiChunk (filename, fileBegin, chunkBegins[i], chunkBegins[i + 1], chunks[i], cancelled);
+  });
+  if(!parsed)
+    return false;
 
-  string buffer;
-  vector<string> tokens;
-  int lineCount = 1;
-  int maxNumTokens = 0;
-  size_t numFaceVrts = 0;
+//  join the chunks. Solid begins are offset by the number of triangles
+//  in the preceding chunks.
+  size_t numTris = 0;
+  for(size_t i = 0; i < numChunks; ++i)
+    numTris += chunks[i].normals.size() / 3;
 
-  while(!(in.eof() || in.fail()))
-  {
-  //  read the line and tokenize.
-  //  In order to reuse memory in between lines, 'tokens' won't be cleared.
-  //  Instead we count the number of tokens using 'tokenCount'.
-    getline(in, buffer);
+  cornerCoordsOut.resize (numTris * 9);
+  normalsOut.resize (numTris * 3);
 
-    istringstream line(buffer);
-    int tokenCount = 0;
-    while(!(line.eof() || line.fail())){
-      if(tokenCount >= maxNumTokens){
-        maxNumTokens = tokenCount + 1;
-        tokens.resize(maxNumTokens);
-      }
-      line >> tokens[tokenCount];
-      ++tokenCount;
-    }
+  size_t triOffset = 0;
+  for(size_t i = 0; i < numChunks; ++i){
+    AsciiChunk <number_t, index_t>& chunk = chunks[i];
+    const size_t numChunkTris = chunk.normals.size() / 3;
 
-    if(tokenCount > 0)
-    {
-      string& tok = tokens[0];
-      if(tok.compare("vertex") == 0){
-        if(tokenCount < 4){
-          STL_READER_THROW("ERROR while reading from " << filename <<
-            ": vertex not specified correctly in line " << lineCount);
-        }
-        
-      //  read the position
-        CoordWithIndex <number_t, index_t> c;
-        for(size_t i = 0; i < 3; ++i)
-          c[i] = static_cast<number_t> (atof(tokens[i+1].c_str()));
-        c.index = static_cast<index_t>(coordsWithIndex.size());
-        coordsWithIndex.push_back(c);
-        ++numFaceVrts;
-      }
-      else if(tok.compare("facet") == 0)
-      {
-        STL_READER_COND_THROW(tokenCount < 5,
-          "ERROR while reading from " << filename <<
-          ": triangle not specified correctly in line " << lineCount);
-        
-        STL_READER_COND_THROW(tokens[1].compare("normal") != 0,
-          "ERROR while reading from " << filename <<
-          ": Missing normal specifier in line " << lineCount);
-        
-      //  read the normal
-        for(size_t i = 0; i < 3; ++i)
-          normalsOut.push_back (static_cast<number_t> (atof(tokens[i+2].c_str())));
-
-        numFaceVrts = 0;
-      }
-      else if(tok.compare("outer") == 0){
-        STL_READER_COND_THROW ((tokenCount < 2) || (tokens[1].compare("loop") != 0),
-          "ERROR while reading from " << filename <<
-          ": expecting outer loop in line " << lineCount);
-      }
-      else if(tok.compare("endfacet") == 0){
-        STL_READER_COND_THROW(numFaceVrts != 3,
-          "ERROR while reading from " << filename <<
-          ": bad number of vertices specified for face in line " << lineCount);
-
-        trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 3));
-        trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 2));
-        trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 1));
-      }
-      else if(tok.compare("solid") == 0){
-        solidRangesOut.push_back(static_cast<index_t> (trisOut.size() / 3));
-      }
-    }
-    lineCount++;
-  }
+    for(size_t j = 0; j < chunk.coords.size(); ++j)
+      cornerCoordsOut[triOffset * 9 + j] = chunk.coords[j];
+
+    for(size_t j = 0; j < chunk.normals.size(); ++j)
+      normalsOut[triOffset * 3 + j] = chunk.normals[j];
+
+    for(size_t j = 0; j < chunk.solidBegins.size(); ++j)
+      solidRangesOut.push_back (static_cast<index_t> (triOffset + chunk.solidBegins[j]));
+
+    triOffset += numChunkTris;
 
-  solidRangesOut.push_back(static_cast<index_t> (trisOut.size() / 3));
+  //  release the chunk's memory early
+    chunk = AsciiChunk <number_t, index_t> ();
+  }
 
-  RemoveDoubles (coordsOut, trisOut, coordsWithIndex);
+  solidRangesOut.push_back(static_cast<index_t> (numTris));
 
   return true;
 }
 
 
-template <class TNumberContainer1, class TNumberContainer2,
-          class TIndexContainer1, class TIndexContainer2>
-bool ReadStlFile_BINARY(const char* filename,
-                        TNumberContainer1& coordsOut,
-                        TNumberContainer2& normalsOut,
-                        TIndexContainer1& trisOut,
-                        TIndexContainer2& solidRangesOut)
+template <class TNumberContainer1, class TNumberContainer2, class TIndexContainer>
+bool ReadStlFileSoup_BINARY(const char* filename,
+                            TNumberContainer1& cornerCoordsOut,
+                            TNumberContainer2& normalsOut,
+                            TIndexContainer& solidRangesOut,
+                            const CancelCheck& cancelled)
 {
   using namespace std;
   using namespace stl_reader_impl;
 
-  typedef typename TNumberContainer1::value_type  number_t;
-  typedef typename TIndexContainer1::value_type index_t;
+  typedef typename TIndexContainer::value_type index_t;
 
-  coordsOut.clear();
+  cornerCoordsOut.clear();
   normalsOut.clear();
-  trisOut.clear();
   solidRangesOut.clear();
 
-  ifstream in(filename, ios::binary);
-  STL_READER_COND_THROW(!in, "Couldnt open file " << filename);
+  MappedFile file;
+  STL_READER_COND_THROW(!file.open(filename), "Couldnt open file " << filename);
+  STL_READER_COND_THROW(file.size() < 84, "Error while parsing binary stl header in file " << filename);
 
-  char stl_header[80];
-  in.read(stl_header, 80);
-  STL_READER_COND_THROW(!in, "Error while parsing binary stl header in file " << filename);
+  const char* data = file.data();
 
   unsigned int numTris = 0;
-  in.read((char*)&numTris, 4);
-  STL_READER_COND_THROW(!in, "Couldnt determine number of triangles in binary stl file " << filename);
+  memcpy(&numTris, data + 80, 4);
 
-  vector<CoordWithIndex <number_t, index_t> > coordsWithIndex;
+//  each triangle is stored in a record of 50 bytes: 12 floats (normal and
+//  three corners) followed by a 2 byte attribute. Trailing bytes behind the
+//  last record are tolerated, a file which is too short is not.
+  const size_t expectedSize = 84 + 50 * static_cast<size_t>(numTris);
+  STL_READER_COND_THROW(file.size() < expectedSize,
+    "Number of triangles (" << numTris << ") doesn't match the size of binary stl file "
+    << filename << ": expected " << expectedSize << " bytes, found " << file.size());
+
+  cornerCoordsOut.resize (9 * static_cast<size_t>(numTris));
+  normalsOut.resize (3 * static_cast<size_t>(numTris));
+
+  const char* record = data + 84;
+  for(size_t tri = 0; tri < numTris; ++tri, record += 50){
+    if((tri & 0xFFFF) == 0xFFFF && IsCancelled (cancelled))
+      return false;
 
-  for(unsigned int tri = 0; tri < numTris; ++tri){
     float d[12];
-    in.read((char*)d, 12 * 4);
-    STL_READER_COND_THROW(!in, "Error while parsing trianlge in binary stl file " << filename);
-
-    for(int i = 0; i < 3; ++i)
-      normalsOut.push_back (d[i]);
-
-    for(size_t ivrt = 1; ivrt < 4; ++ivrt){
-      CoordWithIndex <number_t, index_t> c;
-      for(size_t i = 0; i < 3; ++i)
-        c[i] = d[ivrt * 3 + i];
-      c.index = static_cast<index_t>(coordsWithIndex.size());
-      coordsWithIndex.push_back(c);
-    }
+    memcpy(d, record, 12 * 4);
 
-    trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 3));
-    trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 2));
-    trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 1));
+    for(size_t i = 0; i < 3; ++i)
+      normalsOut[tri * 3 + i] = d[i];
 
-    char addData[2];
-    in.read(addData, 2);
-    STL_READER_COND_THROW(!in, "Error while parsing additional triangle data in binary stl file " << filename);
+    for(size_t i = 0; i < 9; ++i)
+      cornerCoordsOut[tri * 9 + i] = d[3 + i];
   }
 
   solidRangesOut.push_back(0);
-  solidRangesOut.push_back(static_cast<index_t> (trisOut.size() / 3));
+  solidRangesOut.push_back(static_cast<index_t> (numTris));
+
+  return true;
+}
+
+
+template <class TNumberContainer1, class TNumberContainer2, class TNumberContainer3,
+          class TIndexContainer1, class TIndexContainer2>
+bool WeldStlSoup(const TNumberContainer1& cornerCoords,
+                 TNumberContainer2& coordsOut,
+                 TNumberContainer3& normalsInOut,
+                 TIndexContainer1& trisOut,
+                 TIndexContainer2& solidRangesInOut,
+                 const CancelCheck& cancelled)
+{
+  typedef typename TIndexContainer1::value_type index_t;
+
+  const size_t numCorners = cornerCoords.size() / 3;
+  STL_READER_COND_THROW(numCorners >= static_cast<size_t>(std::numeric_limits<index_t>::max()),
+    "Too many triangles (" << numCorners / 3 << ") for the chosen index type");
 
-  RemoveDoubles (coordsOut, trisOut, coordsWithIndex);
+//  initially, each triangle refers to its own corners
+  trisOut.resize (numCorners);
+  for(size_t i = 0; i < numCorners; ++i)
+    trisOut[i] = static_cast<index_t> (i);
 
+  return stl_reader_impl::RemoveDoubles (coordsOut, trisOut, cornerCoords, normalsInOut, solidRangesInOut, cancelled);
+}
+
+
+template <class TNumberContainer1, class TNumberContainer2, class TNumberContainer3,
+          class TIndexContainer1, class TIndexContainer2>
+bool WeldStlSoup(const TNumberContainer1& cornerCoords,
+                 TNumberContainer2& coordsOut,
+                 TNumberContainer3& normalsInOut,
+                 TIndexContainer1& trisOut,
+                 TIndexContainer2& solidRangesInOut,
+                 const double tolerance,
+                 size_t* numMergedOut,
+                 const CancelCheck& cancelled)
+{
+  typedef typename TIndexContainer1::value_type index_t;
+
+  if(numMergedOut)
+    *numMergedOut = 0;
+  if(!(tolerance > 0))
+    return WeldStlSoup (cornerCoords, coordsOut, normalsInOut, trisOut, solidRangesInOut, cancelled);
+
+  const size_t numCorners = cornerCoords.size() / 3;
+  STL_READER_COND_THROW(numCorners >= static_cast<size_t>(std::numeric_limits<index_t>::max()),
+    "Too many triangles (" << numCorners / 3 << ") for the chosen index type");
+
+  trisOut.resize (numCorners);
+  for(size_t i = 0; i < numCorners; ++i)
+    trisOut[i] = static_cast<index_t> (i);
+
+  size_t numMerged = 0;
+  if(!stl_reader_impl::RemoveDoublesTolerant (coordsOut, trisOut, cornerCoords, normalsInOut,
+                                              solidRangesInOut, tolerance, numMerged, cancelled))
+    return false;
+  if(numMergedOut)
+    *numMergedOut = numMerged;
   return true;
 }
 
 
+inline void SetMaxWorkerThreads(const size_t maxThreads)
+{
+  stl_reader_impl::MaxWorkerThreads () = maxThreads;
+}
+
+
 inline bool StlFileHasASCIIFormat(const char* filename)
 {
   using namespace std;
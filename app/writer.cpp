@@ -0,0 +1,261 @@
+#include "writer.h"
+#include <QFuture>
+#include <QSaveFile>
+#include <QThread>
+#include <QtConcurrent>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace Utils {
+
+namespace {
+
+const int BINARY_HEADER_SIZE = 84; // 80 bytes of text and the triangle count
+const int BINARY_RECORD_SIZE = 50; // normal, three corners and a 2 byte attribute
+const int FACES_PER_TASK = 1 << 16;
+const qint64 BINARY_BATCH_SIZE = 64 << 20; // bytes encoded before they are written
+
+/// Range of faces of a mesh, encoded as a unit of work
+struct EncodeTask
+{
+    const Core::Mesh* mesh;
+    int mesh_i;
+    int firstFace;
+    int faceCount;
+    qint64 firstTriangle; // position of the first face in the output, counting the triangles of all meshes
+};
+
+QVector<EncodeTask> splitIntoTasks(const QVector<const Core::Mesh*>& meshes)
+{
+    QVector<EncodeTask> tasks;
+    qint64 triangle = 0;
+    for (int mesh_i = 0; mesh_i < meshes.size(); mesh_i++)
+    {
+        const Core::Mesh* mesh = meshes[mesh_i];
+        for (int first = 0; first < mesh->faces.size(); first += FACES_PER_TASK)
+        {
+            EncodeTask task = {mesh, mesh_i, first, std::min(FACES_PER_TASK, mesh->faces.size() - first), triangle};
+            tasks.append(task);
+            triangle += task.faceCount;
+        }
+    }
+    return tasks;
+}
+
+inline char* putFloat(char* out, float f)
+{
+    quint32 bits;
+    memcpy(&bits, &f, sizeof(bits));
+    qToLittleEndian<quint32>(bits, reinterpret_cast<uchar*>(out));
+    return out + sizeof(bits);
+}
+
+inline char* putVector(char* out, const QVector3D& v)
+{
+    out = putFloat(out, v.x());
+    out = putFloat(out, v.y());
+    return putFloat(out, v.z());
+}
+
+/// Encodes 50 byte records of the task's faces. 'out' receives the first record.
+void encodeBinary(const EncodeTask& task, char* out)
+{
+    const Core::Mesh& mesh = *task.mesh;
+    for (int face_i = task.firstFace; face_i < task.firstFace + task.faceCount; face_i++)
+    {
+        const Core::Triangle& face = mesh.faces[face_i];
+        out = putVector(out, mesh.faceNormal(face_i));
+        for (int corner_i = 0; corner_i < Core::Triangle::PointCount; corner_i++)
+            out = putVector(out, mesh.points[face.points[corner_i]]);
+        *out++ = 0; // attribute byte count
+        *out++ = 0;
+    }
+}
+
+inline void appendVector(QByteArray& out, const QVector3D& v)
+{
+    // QByteArray::number() ignores the locale. 9 digits bring back the very same float.
+    out += QByteArray::number(v.x(), 'g', 9);
+    out += ' ';
+    out += QByteArray::number(v.y(), 'g', 9);
+    out += ' ';
+    out += QByteArray::number(v.z(), 'g', 9);
+    out += '\n';
+}
+
+/// Encodes the facets of the task's faces as text
+void encodeAscii(const EncodeTask& task, QByteArray& out)
+{
+    const Core::Mesh& mesh = *task.mesh;
+    out.clear();
+    out.reserve(task.faceCount * 256);
+    for (int face_i = task.firstFace; face_i < task.firstFace + task.faceCount; face_i++)
+    {
+        const Core::Triangle& face = mesh.faces[face_i];
+        out += "facet normal ";
+        appendVector(out, mesh.faceNormal(face_i));
+        out += "  outer loop\n";
+        for (int corner_i = 0; corner_i < Core::Triangle::PointCount; corner_i++)
+        {
+            out += "    vertex ";
+            appendVector(out, mesh.points[face.points[corner_i]]);
+        }
+        out += "  endloop\nendfacet\n";
+    }
+}
+
+} // anonymous namespace
+
+Writer::Writer()
+{
+
+}
+
+bool Writer::writeStl(QString filename, const QVector<const Core::Mesh*>& meshes, Format format)
+{
+    error.clear();
+    return (format == FORMAT_ASCII) ? writeAscii(filename, meshes) : writeBinary(filename, meshes);
+}
+
+bool Writer::writeStl(QString filename, const Core::Mesh& mesh, Format format)
+{
+    return writeStl(filename, QVector<const Core::Mesh*>({&mesh}), format);
+}
+
+QString Writer::errorString() const
+{
+    return error;
+}
+
+bool Writer::writeBinary(QString filename, const QVector<const Core::Mesh*>& meshes)
+{
+    const QVector<EncodeTask> tasks = splitIntoTasks(meshes);
+    const qint64 triangleCount = tasks.isEmpty() ? 0 : tasks.last().firstTriangle + tasks.last().faceCount;
+    if (triangleCount > std::numeric_limits<quint32>::max())
+    {
+        error = QString("Too many triangles for a binary stl file: %1").arg(triangleCount);
+        return false;
+    }
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        error = file.errorString();
+        return false;
+    }
+
+    char header[BINARY_HEADER_SIZE];
+    memset(header, ' ', 80);
+    const char title[] = "binary stl written by STL optimizer"; // must not start with 'solid'
+    memcpy(header, title, sizeof(title) - 1);
+    qToLittleEndian<quint32>(quint32(triangleCount), reinterpret_cast<uchar*>(header + 80));
+    if (file.write(header, BINARY_HEADER_SIZE) != BINARY_HEADER_SIZE)
+    {
+        error = file.errorString();
+        return false;
+    }
+
+    // group tasks into batches of consecutive records
+    QVector<QVector<EncodeTask>> batches;
+    for (const EncodeTask& task : tasks)
+    {
+        if (batches.isEmpty()
+            || (task.firstTriangle + task.faceCount - batches.last().first().firstTriangle) * BINARY_RECORD_SIZE > BINARY_BATCH_SIZE)
+        {
+            batches.append(QVector<EncodeTask>());
+        }
+        batches.last().append(task);
+    }
+
+    // encode the next batch on the thread pool while the current one is written
+    QByteArray buffers[2];
+    QFuture<void> encoding;
+    auto startEncoding = [&](int batch_i) {
+        const QVector<EncodeTask>& batch = batches[batch_i];
+        const qint64 batchFirst = batch.first().firstTriangle;
+        QByteArray& buffer = buffers[batch_i % 2];
+        buffer.resize(int((batch.last().firstTriangle + batch.last().faceCount - batchFirst) * BINARY_RECORD_SIZE));
+        char* records = buffer.data();
+        encoding = QtConcurrent::map(batch, [records, batchFirst](const EncodeTask& task) {
+            encodeBinary(task, records + (task.firstTriangle - batchFirst) * BINARY_RECORD_SIZE);
+        });
+    };
+
+    if (!batches.isEmpty())
+        startEncoding(0);
+    for (int batch_i = 0; batch_i < batches.size(); batch_i++)
+    {
+        encoding.waitForFinished();
+        if (batch_i + 1 < batches.size())
+            startEncoding(batch_i + 1);
+
+        const QByteArray& buffer = buffers[batch_i % 2];
+        if (file.write(buffer) != buffer.size())
+        {
+            error = file.errorString();
+            encoding.waitForFinished();
+            return false;
+        }
+    }
+
+    if (!file.commit())
+    {
+        error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool Writer::writeAscii(QString filename, const QVector<const Core::Mesh*>& meshes)
+{
+    const QVector<EncodeTask> tasks = splitIntoTasks(meshes);
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        error = file.errorString();
+        return false;
+    }
+
+    // each mesh is a solid. Encode as many tasks at a time as there are threads, then write them in order.
+    const int batchSize = std::max(1, QThread::idealThreadCount());
+    QVector<QByteArray> outputs(batchSize);
+    for (int first = 0; first < tasks.size(); first += batchSize)
+    {
+        const int count = std::min(batchSize, tasks.size() - first);
+        QVector<int> batch(count);
+        for (int i = 0; i < count; i++)
+            batch[i] = i;
+        QtConcurrent::blockingMap(batch, [&](int i) {
+            encodeAscii(tasks[first + i], outputs[i]);
+        });
+
+        for (int i = 0; i < count; i++)
+        {
+            const EncodeTask& task = tasks[first + i];
+            const QByteArray solidName = "part_" + QByteArray::number(task.mesh_i + 1);
+            bool ok = true;
+            if (task.firstFace == 0)
+                ok = ok && file.write("solid " + solidName + "\n") > 0;
+            ok = ok && file.write(outputs[i]) == outputs[i].size();
+            if (task.firstFace + task.faceCount == task.mesh->faces.size())
+                ok = ok && file.write("endsolid " + solidName + "\n") > 0;
+            if (!ok)
+            {
+                error = file.errorString();
+                return false;
+            }
+        }
+    }
+
+    if (!file.commit())
+    {
+        error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+} // namespace Utils
@@ -0,0 +1,53 @@
+#ifndef UTILS_WRITER_H
+#define UTILS_WRITER_H
+
+#include "mesh.h"
+#include <QString>
+#include <QVector>
+
+namespace Utils {
+
+class Writer
+{
+public:
+    enum Format
+    {
+        FORMAT_BINARY,
+        FORMAT_ASCII
+    };
+
+    Writer();
+
+    /**
+     * @brief Writes meshes to an stl file
+     *
+     * Triangles are taken from the indexed points and faces of each mesh, with
+     * normals calculated from the points. Binary files hold the triangles of all
+     * meshes one after the other, ASCII files hold one solid per mesh.
+     *
+     * Triangles are encoded in parallel. Binary records are encoded in large
+     * batches, the next batch while the previous one is being written, so that
+     * the file is written with a few big writes.
+     *
+     * @param filename path and filename of the .stl file to write. Written through a QSaveFile,
+     *                 so an existing file is only replaced once the new one is complete and is
+     *                 left alone on failure.
+     * @param meshes meshes to write
+     * @param format binary or ASCII stl
+     * @return true on success. Use errorString() to find out what went wrong otherwise.
+     */
+    bool writeStl(QString filename, const QVector<const Core::Mesh*>& meshes, Format format = FORMAT_BINARY);
+    bool writeStl(QString filename, const Core::Mesh& mesh, Format format = FORMAT_BINARY);
+
+    QString errorString() const;
+
+private:
+    QString error;
+
+    bool writeBinary(QString filename, const QVector<const Core::Mesh*>& meshes);
+    bool writeAscii(QString filename, const QVector<const Core::Mesh*>& meshes);
+};
+
+} // namespace Utils
+
+#endif // UTILS_WRITER_H
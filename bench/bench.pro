@@ -0,0 +1,11 @@
+QT += testlib
+QT -= gui
+
+CONFIG += qt console warn_on depend_includepath testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+HEADERS += stlgenerator.h
+SOURCES +=  tst_benchloader.cpp \
+    stlgenerator.cpp
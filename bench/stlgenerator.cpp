@@ -0,0 +1,253 @@
+#include "stlgenerator.h"
+
+#include <QFile>
+#include <QByteArray>
+#include <QtEndian>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Bench {
+
+namespace {
+
+const int FLUSH_SIZE = 1 << 20; // bytes buffered before they are written
+
+/// Buffers triangles and writes them to an stl file in large blocks, until the requested number is reached
+class TriangleWriter
+{
+    QFile& file;
+    Format format;
+    QByteArray name;
+    QByteArray buffer;
+    int triangleCount;
+    int written = 0;
+    bool ok = true;
+
+    void flush()
+    {
+        ok = ok && file.write(buffer) == buffer.size();
+        buffer.clear();
+    }
+
+    void appendAscii(const char* prefix, const float v[3])
+    {
+        buffer += prefix;
+        for (int i = 0; i < 3; i++)
+        {
+            buffer += ' ';
+            buffer += QByteArray::number(v[i], 'g', 9);
+        }
+        buffer += '\n';
+    }
+
+public:
+    TriangleWriter(QFile& file, Format format, const QByteArray& name, int triangleCount)
+        : file(file), format(format), name(name), triangleCount(triangleCount)
+    {
+        buffer.reserve(FLUSH_SIZE + 1024);
+        if (format == FORMAT_BINARY)
+        {
+            QByteArray header(80, '\0');
+            header.replace(0, name.size(), name);
+            buffer += header;
+            quint32 count = qToLittleEndian(quint32(triangleCount));
+            buffer.append(reinterpret_cast<const char*>(&count), 4);
+        } else
+        {
+            buffer += "solid " + name + "\n";
+        }
+    }
+
+    bool full() const
+    {
+        return written >= triangleCount;
+    }
+
+    void add(const float a[3], const float b[3], const float c[3])
+    {
+        if (full())
+            return;
+
+        float normal[3] = {
+            (b[1]-a[1])*(c[2]-a[2]) - (b[2]-a[2])*(c[1]-a[1]),
+            (b[2]-a[2])*(c[0]-a[0]) - (b[0]-a[0])*(c[2]-a[2]),
+            (b[0]-a[0])*(c[1]-a[1]) - (b[1]-a[1])*(c[0]-a[0])
+        };
+        const float length = std::sqrt(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+        for (int i = 0; i < 3 && length > 0; i++)
+            normal[i] /= length;
+
+        if (format == FORMAT_BINARY)
+        {
+            // 50 byte record: normal, three corners, attribute
+            float d[12];
+            memcpy(d, normal, 3*sizeof(float));
+            memcpy(d+3, a, 3*sizeof(float));
+            memcpy(d+6, b, 3*sizeof(float));
+            memcpy(d+9, c, 3*sizeof(float));
+            buffer.append(reinterpret_cast<const char*>(d), sizeof(d));
+            buffer.append(2, '\0');
+        } else
+        {
+            appendAscii("facet normal", normal);
+            buffer += "  outer loop\n";
+            appendAscii("    vertex", a);
+            appendAscii("    vertex", b);
+            appendAscii("    vertex", c);
+            buffer += "  endloop\nendfacet\n";
+        }
+
+        written++;
+        if (buffer.size() >= FLUSH_SIZE)
+            flush();
+    }
+
+    bool finish()
+    {
+        if (format == FORMAT_ASCII)
+            buffer += "endsolid " + name + "\n";
+        flush();
+        return ok && full();
+    }
+};
+
+void generateGrid(TriangleWriter& writer, int triangleCount)
+{
+    // two triangles per grid square, one grid row at a time
+    const int side = int(std::ceil(std::sqrt(triangleCount / 2.0)));
+    for (int y = 0; y < side && !writer.full(); y++)
+    {
+        for (int x = 0; x < side && !writer.full(); x++)
+        {
+            const float z0 = std::sin(x * 0.05f);
+            const float z1 = std::sin((x+1) * 0.05f);
+            const float p00[3] = {float(x),   float(y),   z0};
+            const float p10[3] = {float(x+1), float(y),   z1};
+            const float p11[3] = {float(x+1), float(y+1), z1};
+            const float p01[3] = {float(x),   float(y+1), z0};
+
+            writer.add(p00, p10, p11);
+            writer.add(p00, p11, p01);
+        }
+    }
+}
+
+void generateSphere(TriangleWriter& writer, int triangleCount)
+{
+    // 4*rings*(rings-1) triangles with twice as many segments as rings
+    const float radius = 100.0f;
+    const int rings = std::max(2, int(std::ceil((1 + std::sqrt(1.0 + triangleCount)) / 2)));
+    const int segments = 2 * rings;
+    const double pi = 3.14159265358979323846;
+
+    auto point = [&](int ring, int segment, float p[3]) {
+        if (ring == 0 || ring == rings)
+        {
+            // poles are exact, so that they weld
+            p[0] = 0.0f;
+            p[1] = 0.0f;
+            p[2] = ring == 0 ? radius : -radius;
+            return;
+        }
+        const double theta = pi * ring / rings;
+        const double phi = 2 * pi * (segment % segments) / segments;
+        p[0] = float(radius * std::sin(theta) * std::cos(phi));
+        p[1] = float(radius * std::sin(theta) * std::sin(phi));
+        p[2] = float(radius * std::cos(theta));
+    };
+
+    float a[3], b[3], c[3], d[3];
+    for (int ring = 0; ring < rings && !writer.full(); ring++)
+    {
+        for (int segment = 0; segment < segments && !writer.full(); segment++)
+        {
+            point(ring, segment, a);
+            point(ring + 1, segment, b);
+            point(ring + 1, segment + 1, c);
+            point(ring, segment + 1, d);
+            if (ring != rings - 1)
+                writer.add(a, b, c);
+            if (ring != 0)
+                writer.add(a, c, d);
+        }
+    }
+}
+
+void generatePanels(TriangleWriter& writer, int triangleCount)
+{
+    // each panel is a 10x10 square cut into strips of two sliver triangles. Panels
+    // are laid out in 32x32 layers that are stacked along z.
+    const int strips = 64;
+    const float size = 10.0f;
+    const int panelCount = (triangleCount + 2*strips - 1) / (2*strips);
+    for (int panel = 0; panel < panelCount && !writer.full(); panel++)
+    {
+        const float x0 = (panel % 32) * (size + 2);
+        const float y0 = (panel / 32 % 32) * (size + 2);
+        const float z = (panel / 1024) * 2.0f;
+        for (int strip = 0; strip < strips && !writer.full(); strip++)
+        {
+            const float left = x0 + size * strip / strips;
+            const float right = x0 + size * (strip + 1) / strips;
+            const float bottomLeft[3] = {left, y0, z};
+            const float bottomRight[3] = {right, y0, z};
+            const float topRight[3] = {right, y0 + size, z};
+            const float topLeft[3] = {left, y0 + size, z};
+
+            writer.add(bottomLeft, bottomRight, topRight);
+            writer.add(bottomLeft, topRight, topLeft);
+        }
+    }
+}
+
+} // anonymous namespace
+
+QString shapeName(Shape shape)
+{
+    switch (shape)
+    {
+        case SHAPE_GRID:
+            return "grid";
+        case SHAPE_SPHERE:
+            return "sphere";
+        case SHAPE_PANELS:
+            return "panels";
+    }
+    return QString();
+}
+
+QString formatName(Format format)
+{
+    return format == FORMAT_BINARY ? "binary" : "ascii";
+}
+
+bool writeStl(const QString& filename, Shape shape, Format format, int triangleCount)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    TriangleWriter writer(file, format, "bench-" + shapeName(shape).toLatin1() + "-stl", triangleCount);
+    switch (shape)
+    {
+        case SHAPE_GRID:
+            generateGrid(writer, triangleCount);
+        break;
+        case SHAPE_SPHERE:
+            generateSphere(writer, triangleCount);
+        break;
+        case SHAPE_PANELS:
+            generatePanels(writer, triangleCount);
+        break;
+    }
+
+    return writer.finish();
+}
+
+bool writeBinaryGridStl(const QString& filename, int triangleCount)
+{
+    return writeStl(filename, SHAPE_GRID, FORMAT_BINARY, triangleCount);
+}
+
+} // namespace Bench
@@ -0,0 +1,44 @@
+#ifndef BENCH_STLGENERATOR_H
+#define BENCH_STLGENERATOR_H
+
+#include <QString>
+
+namespace Bench {
+
+enum Shape
+{
+    SHAPE_GRID,     // wavy square grid, two triangles per square
+    SHAPE_SPHERE,   // UV sphere. Rings meet at welded poles.
+    SHAPE_PANELS,   // CAD-like stack of flat panels made of long, thin triangles
+};
+
+enum Format
+{
+    FORMAT_BINARY,
+    FORMAT_ASCII
+};
+
+QString shapeName(Shape shape);
+QString formatName(Format format);
+
+/**
+ * @brief Writes a deterministic stl file of the given shape
+ *
+ * Neighbouring triangles share their corners, so the file exercises vertex
+ * welding the same way a real mesh does. The same arguments always produce
+ * the same file.
+ *
+ * @param filename path of the .stl file to create
+ * @param shape what the triangles look like
+ * @param format binary or ASCII stl
+ * @param triangleCount number of triangles to write
+ * @return false if the file could not be written
+ */
+bool writeStl(const QString& filename, Shape shape, Format format, int triangleCount);
+
+/// Same as writeStl() for a binary grid
+bool writeBinaryGridStl(const QString& filename, int triangleCount);
+
+} // namespace Bench
+
+#endif // BENCH_STLGENERATOR_H
@@ -0,0 +1,95 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "../app/stl_reader.h"
+#include "stlgenerator.h"
+
+/*
+ * Loader benchmarks. Mesh size and throughput target can be tuned with the
+ * STL_BENCH_TRIANGLES and STL_BENCH_TARGET_MBPS environment variables.
+ */
+class BenchLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchLoader();
+
+private slots:
+    void initTestCase();
+    void readBinary();
+    void readBinaryThroughput();
+
+private:
+    QTemporaryDir tempDir;
+    QString binaryFilename;
+    qint64 binaryFileSize = 0;
+    int triangleCount = 1000000;
+    double targetBinaryMBps = 400; // MB/s expected from the binary reader, weld included
+};
+
+BenchLoader::BenchLoader()
+{
+    bool ok;
+    int triangles = qEnvironmentVariableIntValue("STL_BENCH_TRIANGLES", &ok);
+    if (ok && triangles > 0)
+        triangleCount = triangles;
+
+    double target = qEnvironmentVariable("STL_BENCH_TARGET_MBPS").toDouble(&ok);
+    if (ok && target > 0)
+        targetBinaryMBps = target;
+}
+
+void BenchLoader::initTestCase()
+{
+    QVERIFY(tempDir.isValid());
+    binaryFilename = tempDir.filePath("grid-binary.stl");
+    QVERIFY(Bench::writeBinaryGridStl(binaryFilename, triangleCount));
+    binaryFileSize = QFileInfo(binaryFilename).size();
+    QCOMPARE(binaryFileSize, 84 + 50 * qint64(triangleCount));
+}
+
+void BenchLoader::readBinary()
+{
+    const QByteArray filename = binaryFilename.toLocal8Bit();
+    std::vector<float> coords, normals;
+    std::vector<unsigned int> tris, solids;
+
+    QBENCHMARK {
+        stl_reader::ReadStlFile_BINARY(filename.constData(), coords, normals, tris, solids);
+    }
+    QCOMPARE(int(normals.size()), 3 * triangleCount);
+}
+
+// Reports the binary reader throughput in bytes per second and warns when it drops below the target
+void BenchLoader::readBinaryThroughput()
+{
+    const QByteArray filename = binaryFilename.toLocal8Bit();
+    std::vector<float> coords, normals;
+    std::vector<unsigned int> tris, solids;
+
+    qint64 bestNs = std::numeric_limits<qint64>::max();
+    for (int run = 0; run < 3; run++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        stl_reader::ReadStlFile_BINARY(filename.constData(), coords, normals, tris, solids);
+        bestNs = std::min(bestNs, std::max<qint64>(timer.nsecsElapsed(), 1));
+    }
+
+    const double bytesPerSecond = binaryFileSize * 1e9 / bestNs;
+    const double mbps = bytesPerSecond / 1e6;
+    QTest::setBenchmarkResult(bytesPerSecond, QTest::BytesPerSecond);
+    qInfo() << "binary read throughput:" << mbps << "MB/s, target" << targetBinaryMBps << "MB/s";
+    if (mbps < targetBinaryMBps)
+        QWARN(qPrintable(QString("binary read throughput %1 MB/s is below the %2 MB/s target").arg(mbps).arg(targetBinaryMBps)));
+}
+
+QTEST_APPLESS_MAIN(BenchLoader)
+
+#include "tst_benchloader.moc"
@@ -0,0 +1,27 @@
+QT += testlib concurrent
+
+CONFIG += qt console warn_on depend_includepath testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+# revision recorded with each result, so that runs of different versions can be compared
+BENCH_REVISION = $$system(git -C $$PWD describe --always --dirty)
+!isEmpty(BENCH_REVISION): DEFINES += BENCH_REVISION=\\\"$$BENCH_REVISION\\\"
+
+INCLUDEPATH += ../app ../bench
+
+HEADERS += ../bench/stlgenerator.h \
+    ../app/app.h \
+    ../app/loader.h \
+    ../app/mesh.h \
+    ../app/pointrange.h \
+    ../app/pointtransform.h \
+    ../app/stl_reader.h
+SOURCES +=  tst_benchpipeline.cpp \
+    ../bench/stlgenerator.cpp \
+    ../app/app.cpp \
+    ../app/loader.cpp \
+    ../app/mesh.cpp \
+    ../app/pointrange.cpp \
+    ../app/pointtransform.cpp
@@ -0,0 +1,315 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "stl_reader.h"
+#include "loader.h"
+#include "app.h"
+#include "stlgenerator.h"
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+/*
+ * Benchmarks of the stages between an stl file and vertex buffer data, each
+ * timed on its own: reading, welding, loading, chewing, metrics and swallowing.
+ * Files are generated for every shape and size up to STL_BENCH_MAX_TRIANGLES
+ * (1M by default, sizes go up to 50M). The best time of each row is appended
+ * to the csv file named by STL_BENCH_RESULTS, tagged with STL_BENCH_VERSION or
+ * else the git revision the benchmark was built from. STL_BENCH_THREADS limits
+ * the threads of the parallel stages.
+ */
+class BenchPipeline : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchPipeline();
+
+private slots:
+    void initTestCase();
+    void readStlFile_data();
+    void readStlFile();
+    void removeDoubles_data();
+    void removeDoubles();
+    void loadStl_data();
+    void loadStl();
+    void chew_data();
+    void chew();
+    void generateMetrics_data();
+    void generateMetrics();
+    void swallow_data();
+    void swallow();
+
+private:
+    /// Best time of the iterations of a QBENCHMARK loop
+    struct BestTime
+    {
+        QElapsedTimer timer;
+        qint64 bestNs = std::numeric_limits<qint64>::max();
+
+        void start() { timer.start(); }
+        void stop() { bestNs = std::min(bestNs, std::max<qint64>(timer.nsecsElapsed(), 1)); }
+    };
+
+    QTemporaryDir tempDir;
+    QMap<QString, QString> files; // generated stl files by row name
+    QList<int> sizes;
+    QString resultsFilename = "bench-results.csv";
+    QString version = BENCH_REVISION;
+
+    void addRows(bool bothFormats);
+    QString stlFile(); // file of the current row, generated on first use
+    void loadMesh(Core::Mesh& mesh);
+    void record(const char* stage, const BestTime& time);
+};
+
+BenchPipeline::BenchPipeline()
+{
+    bool ok;
+    int maxTriangles = qEnvironmentVariableIntValue("STL_BENCH_MAX_TRIANGLES", &ok);
+    if (!ok || maxTriangles <= 0)
+        maxTriangles = 1000000;
+    for (int size : {10000, 100000, 1000000, 10000000, 50000000})
+        if (size <= maxTriangles)
+            sizes.append(size);
+
+    if (qEnvironmentVariableIsSet("STL_BENCH_RESULTS"))
+        resultsFilename = qEnvironmentVariable("STL_BENCH_RESULTS");
+    if (qEnvironmentVariableIsSet("STL_BENCH_VERSION"))
+        version = qEnvironmentVariable("STL_BENCH_VERSION");
+
+    const int threads = qEnvironmentVariableIntValue("STL_BENCH_THREADS", &ok);
+    if (ok && threads > 0)
+    {
+        Core::setMaxThreads(threads);
+        Utils::Loader::setMaxThreads(threads);
+    }
+}
+
+void BenchPipeline::initTestCase()
+{
+    QVERIFY(tempDir.isValid());
+    QVERIFY(!sizes.isEmpty());
+    // the loader logs every load, which would drown the benchmark output
+    QLoggingCategory::setFilterRules("default.debug=false\ndefault.info=false");
+
+    QFile results(resultsFilename);
+    const bool isNew = !results.exists() || results.size() == 0;
+    QVERIFY2(results.open(QIODevice::Append | QIODevice::Text), qPrintable(resultsFilename));
+    if (isNew)
+        results.write("timestamp,version,stage,shape,format,triangles,best_ms,mtriangles_per_s\n");
+}
+
+// Rows for every shape and size. Stages that don't depend on the file format only get binary rows.
+void BenchPipeline::addRows(bool bothFormats)
+{
+    QTest::addColumn<int>("shape");
+    QTest::addColumn<int>("format");
+    QTest::addColumn<int>("triangles");
+
+    const QList<Bench::Format> formats = bothFormats
+            ? QList<Bench::Format>{Bench::FORMAT_BINARY, Bench::FORMAT_ASCII}
+            : QList<Bench::Format>{Bench::FORMAT_BINARY};
+    for (Bench::Shape shape : {Bench::SHAPE_GRID, Bench::SHAPE_SPHERE, Bench::SHAPE_PANELS})
+        for (Bench::Format format : formats)
+            for (int size : sizes)
+            {
+                const QString name = QString("%1-%2-%3").arg(Bench::shapeName(shape)).arg(Bench::formatName(format)).arg(size);
+                QTest::newRow(qPrintable(name)) << int(shape) << int(format) << size;
+            }
+}
+
+QString BenchPipeline::stlFile()
+{
+    QFETCH(int, shape);
+    QFETCH(int, format);
+    QFETCH(int, triangles);
+
+    const QString name = QTest::currentDataTag();
+    if (!files.contains(name))
+    {
+        const QString filename = tempDir.filePath(name + ".stl");
+        if (!Bench::writeStl(filename, Bench::Shape(shape), Bench::Format(format), triangles))
+            return QString();
+        files.insert(name, filename);
+    }
+    return files.value(name);
+}
+
+void BenchPipeline::loadMesh(Core::Mesh& mesh)
+{
+    const QString filename = stlFile();
+    QVERIFY(!filename.isEmpty());
+    Utils::Loader loader;
+    loader.loadStl(filename, mesh);
+    QVERIFY(mesh.faces.size() > 0);
+}
+
+void BenchPipeline::record(const char* stage, const BestTime& time)
+{
+    QFETCH(int, shape);
+    QFETCH(int, format);
+    QFETCH(int, triangles);
+
+    const double ms = time.bestNs / 1e6;
+    const double mtrianglesPerSecond = triangles * 1e3 / time.bestNs;
+    QFile results(resultsFilename);
+    QVERIFY(results.open(QIODevice::Append | QIODevice::Text));
+    const QString line = QString("%1,%2,%3,%4,%5,%6,%7,%8\n")
+            .arg(QDateTime::currentDateTime().toString(Qt::ISODate))
+            .arg(version)
+            .arg(stage)
+            .arg(Bench::shapeName(Bench::Shape(shape)))
+            .arg(Bench::formatName(Bench::Format(format)))
+            .arg(triangles)
+            .arg(ms, 0, 'f', 3)
+            .arg(mtrianglesPerSecond, 0, 'f', 3);
+    results.write(line.toUtf8());
+}
+
+void BenchPipeline::readStlFile_data()
+{
+    addRows(true);
+}
+
+// Parsing and exact welding, as done by stl_reader::ReadStlFile
+void BenchPipeline::readStlFile()
+{
+    const QByteArray filename = stlFile().toLocal8Bit();
+    QVERIFY(!filename.isEmpty());
+    std::vector<float> coords, normals;
+    std::vector<unsigned int> tris, solids;
+
+    BestTime time;
+    QBENCHMARK {
+        time.start();
+        stl_reader::ReadStlFile(filename.constData(), coords, normals, tris, solids);
+        time.stop();
+    }
+    QFETCH(int, triangles);
+    QCOMPARE(int(normals.size()), 3 * triangles);
+    record("readStlFile", time);
+}
+
+void BenchPipeline::removeDoubles_data()
+{
+    addRows(false);
+}
+
+// Welding alone. RemoveDoubles is internal to stl_reader, so it is timed through WeldStlSoup on a soup read beforehand.
+void BenchPipeline::removeDoubles()
+{
+    const QByteArray filename = stlFile().toLocal8Bit();
+    QVERIFY(!filename.isEmpty());
+    std::vector<float> cornerCoords, soupNormals;
+    std::vector<unsigned int> soupSolids;
+    QVERIFY(stl_reader::ReadStlFileSoup(filename.constData(), cornerCoords, soupNormals, soupSolids));
+
+    std::vector<float> coords, normals;
+    std::vector<unsigned int> tris, solids;
+    BestTime time;
+    QBENCHMARK {
+        normals = soupNormals;
+        solids = soupSolids;
+        time.start();
+        stl_reader::WeldStlSoup(cornerCoords, coords, normals, tris, solids);
+        time.stop();
+    }
+    QCOMPARE(tris.size(), soupNormals.size());
+    record("removeDoubles", time);
+}
+
+void BenchPipeline::loadStl_data()
+{
+    addRows(true);
+}
+
+// Reading and welding into a Core::Mesh
+void BenchPipeline::loadStl()
+{
+    const QString filename = stlFile();
+    QVERIFY(!filename.isEmpty());
+    Utils::Loader loader;
+
+    BestTime time;
+    QBENCHMARK {
+        Core::Mesh mesh;
+        time.start();
+        loader.loadStl(filename, mesh);
+        time.stop();
+    }
+    record("loadStl", time);
+}
+
+void BenchPipeline::chew_data()
+{
+    addRows(false);
+}
+
+void BenchPipeline::chew()
+{
+    Core::Mesh loaded;
+    loadMesh(loaded);
+
+    BestTime time;
+    QBENCHMARK {
+        Core::Mesh mesh = loaded;
+        time.start();
+        mesh.chew(Core::Mesh::CHEW_GRAPH);
+        time.stop();
+    }
+    record("chew", time);
+}
+
+void BenchPipeline::generateMetrics_data()
+{
+    addRows(false);
+}
+
+void BenchPipeline::generateMetrics()
+{
+    Core::Mesh mesh;
+    loadMesh(mesh);
+
+    BestTime time;
+    QBENCHMARK {
+        mesh.pointsChanged(); // nothing built by an earlier pass may be reused
+        time.start();
+        mesh.generateMetrics();
+        time.stop();
+    }
+    record("generateMetrics", time);
+}
+
+void BenchPipeline::swallow_data()
+{
+    addRows(false);
+}
+
+// Filling vertex buffer drafts with triangle points and face ids
+void BenchPipeline::swallow()
+{
+    ModelMesh mesh;
+    loadMesh(mesh);
+
+    BestTime time;
+    QBENCHMARK {
+        Core::VertexBufferDraft triangleDraft;
+        time.start();
+        mesh.swallow(triangleDraft);
+        time.stop();
+    }
+    record("swallow", time);
+}
+
+QTEST_APPLESS_MAIN(BenchPipeline)
+
+#include "tst_benchpipeline.moc"
@@ -1,4 +1,8 @@
 TEMPLATE = subdirs
 
 SUBDIRS = app \
-    test
+    test \
+    testmesh \
+    testreader \
+    bench \
+    benchpipeline
@@ -0,0 +1,18 @@
+QT += testlib concurrent
+
+CONFIG += qt console warn_on depend_includepath testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../app
+
+HEADERS += ../app/mesh.h \
+    ../app/meshcache.h \
+    ../app/pointrange.h \
+    ../app/pointtransform.h
+SOURCES +=  tst_testmesh.cpp \
+    ../app/mesh.cpp \
+    ../app/meshcache.cpp \
+    ../app/pointrange.cpp \
+    ../app/pointtransform.cpp
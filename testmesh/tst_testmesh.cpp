@@ -0,0 +1,280 @@
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "mesh.h"
+#include "meshcache.h"
+
+typedef QVector<QVector<quint32>> Lists;
+
+// lists of an adjacency as nested vectors, so that QCOMPARE can show them
+static Lists toLists(const Core::Adjacency<quint32>& adjacency)
+{
+    Lists lists;
+    for (int list_i = 0; list_i < adjacency.size(); list_i++)
+    {
+        QVector<quint32> values;
+        for (quint32 value : adjacency[list_i])
+            values.append(value);
+        lists.append(values);
+    }
+    return lists;
+}
+
+static Core::Triangle triangle(Core::PointIndex a, Core::PointIndex b, Core::PointIndex c)
+{
+    Core::Triangle t;
+    t.points[0] = a;
+    t.points[1] = b;
+    t.points[2] = c;
+    return t;
+}
+
+// closed and consistently wound, so every edge has twins
+static void makeTetrahedron(Core::Mesh& mesh)
+{
+    mesh.points = {QVector3D(0, 0, 0), QVector3D(1, 0, 0), QVector3D(0, 1, 0), QVector3D(0, 0, 1)};
+    mesh.faces = {triangle(0, 2, 1), triangle(0, 1, 3), triangle(0, 3, 2), triangle(1, 2, 3)};
+}
+
+// faces 0 and 1 share the edge 1-2. Face 2 touches both at point 2 only.
+static void makeStrip(Core::Mesh& mesh)
+{
+    mesh.points = {QVector3D(0, 0, 0), QVector3D(1, 0, 0), QVector3D(0, 1, 0), QVector3D(1, 1, 0), QVector3D(-1, 2, 0), QVector3D(0, 2, 0)};
+    mesh.faces = {triangle(0, 1, 2), triangle(2, 1, 3), triangle(2, 4, 5)};
+    mesh.normals = {QVector3D(0, 0, 1), QVector3D(0, 0, 1), QVector3D(0, 0, 1)};
+}
+
+// three faces on the edge 0-1
+static void makeNonManifold(Core::Mesh& mesh)
+{
+    mesh.points = {QVector3D(0, 0, 0), QVector3D(1, 0, 0), QVector3D(0, 1, 0), QVector3D(0, -1, 0), QVector3D(0, 0, 1)};
+    mesh.faces = {triangle(0, 1, 2), triangle(1, 0, 3), triangle(0, 1, 4)};
+}
+
+// a grid of side x side squares, large enough to be split into several ranges. Some faces
+// are flipped or repeated, so that there are edges without twins and edges of three faces.
+static void makeGrid(Core::Mesh& mesh, int side)
+{
+    for (int y = 0; y <= side; y++)
+    {
+        for (int x = 0; x <= side; x++)
+            mesh.points.append(QVector3D(x, y, 0));
+    }
+    auto point = [side](int x, int y) { return Core::PointIndex(y * (side + 1) + x); };
+    for (int y = 0; y < side; y++)
+    {
+        for (int x = 0; x < side; x++)
+        {
+            mesh.faces.append(triangle(point(x, y), point(x + 1, y), point(x + 1, y + 1)));
+            if ((x * 7 + y) % 31 == 0)
+                mesh.faces.append(triangle(point(x + 1, y + 1), point(x, y), point(x, y + 1)));
+            else
+                mesh.faces.append(triangle(point(x, y), point(x + 1, y + 1), point(x, y + 1)));
+            if ((x + y * 5) % 53 == 0)
+                mesh.faces.append(triangle(point(x, y), point(x + 1, y), point(x + 1, y + 1)));
+        }
+    }
+}
+
+class TestMesh : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+    void test_adjacency_build();
+    void test_adjacency_empty();
+    void test_tetrahedron();
+    void test_strip();
+    void test_non_manifold();
+    void test_chew_threads_data();
+    void test_chew_threads();
+    void test_cache_round_trip();
+};
+
+void TestMesh::cleanup()
+{
+    Core::setMaxThreads(0);
+}
+
+// values come in any order and repeated. Lists come out sorted, without duplicates.
+void TestMesh::test_adjacency_build()
+{
+    Core::Adjacency<quint32> adjacency;
+    adjacency.build(4, 3, [](Core::Adjacency<quint32>::Builder& builder, int first, int last) {
+        for (int item = first; item < last; item++)
+        {
+            switch (item)
+            {
+                case 0: builder.put(2, 5); builder.put(0, 3); break;
+                case 1: builder.put(2, 1); builder.put(2, 5); break;
+                case 2: builder.put(0, 3); builder.put(0, 1); break;
+            }
+        }
+    });
+
+    QCOMPARE(adjacency.size(), 4);
+    QCOMPARE(adjacency.valueCount(), size_t(4));
+    QCOMPARE(toLists(adjacency), Lists({{1, 3}, {}, {1, 5}, {}}));
+    QVERIFY(adjacency[2].contains(5));
+    QVERIFY(!adjacency[2].contains(3));
+    QVERIFY(adjacency[1].isEmpty());
+    QCOMPARE(adjacency.rawOffsets(), std::vector<quint32>({0, 2, 2, 4, 4}));
+}
+
+void TestMesh::test_adjacency_empty()
+{
+    Core::Adjacency<quint32> adjacency;
+    adjacency.build(0, 0, [](Core::Adjacency<quint32>::Builder&, int, int) {});
+    QVERIFY(adjacency.isEmpty());
+    QCOMPARE(adjacency.size(), 0);
+
+    adjacency.build(2, 0, [](Core::Adjacency<quint32>::Builder&, int, int) {});
+    QCOMPARE(toLists(adjacency), Lists({{}, {}}));
+}
+
+void TestMesh::test_tetrahedron()
+{
+    Core::Mesh mesh;
+    makeTetrahedron(mesh);
+
+    QCOMPARE(toLists(mesh.graph()), Lists({{1, 2, 3}, {0, 2, 3}, {0, 1, 3}, {0, 1, 2}}));
+    QCOMPARE(toLists(mesh.pointFaces()), Lists({{0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3}}));
+    QCOMPARE(toLists(mesh.faceFaces()), Lists({{0, 1, 2, 3}, {0, 1, 2, 3}, {0, 1, 2, 3}, {0, 1, 2, 3}}));
+    QCOMPARE(toLists(mesh.edgeFaces()), Lists({{1, 2, 3}, {0, 2, 3}, {0, 1, 3}, {0, 1, 2}}));
+
+    const Core::EdgeTable& edges = mesh.edgeTable();
+    QCOMPARE(edges.edgeCount(), 6);
+    for (Core::EdgeTable::HalfEdgeIndex h = 0; h < 12; h++)
+    {
+        const Core::EdgeTable::HalfEdgeIndex twin = edges.twin(h);
+        QVERIFY(twin != Core::EdgeTable::NO_TWIN);
+        QCOMPARE(edges.twin(twin), h);
+        QCOMPARE(Core::EdgeTable::from(mesh.faces, twin), Core::EdgeTable::to(mesh.faces, h));
+        QCOMPARE(Core::EdgeTable::to(mesh.faces, twin), Core::EdgeTable::from(mesh.faces, h));
+    }
+}
+
+void TestMesh::test_strip()
+{
+    Core::Mesh mesh;
+    makeStrip(mesh);
+
+    QCOMPARE(toLists(mesh.graph()), Lists({{1, 2}, {0, 2, 3}, {0, 1, 3, 4, 5}, {1, 2}, {2, 5}, {2, 4}}));
+    QCOMPARE(toLists(mesh.pointFaces()), Lists({{0}, {0, 1}, {0, 1, 2}, {1}, {2}, {2}}));
+    QCOMPARE(toLists(mesh.faceFaces()), Lists({{0, 1, 2}, {0, 1, 2}, {0, 1, 2}}));
+    QCOMPARE(toLists(mesh.edgeFaces()), Lists({{1}, {0}, {}}));
+
+    // 1->2 of face 0 runs against 2->1 of face 1. Every other edge is on the boundary.
+    const Core::EdgeTable& edges = mesh.edgeTable();
+    QCOMPARE(edges.edgeCount(), 8);
+    for (Core::EdgeTable::HalfEdgeIndex h = 0; h < 9; h++)
+    {
+        const Core::EdgeTable::HalfEdgeIndex expected = (h == 1) ? 3 : (h == 3) ? 1 : Core::EdgeTable::NO_TWIN;
+        QCOMPARE(edges.twin(h), expected);
+    }
+}
+
+void TestMesh::test_non_manifold()
+{
+    Core::Mesh mesh;
+    makeNonManifold(mesh);
+
+    QCOMPARE(toLists(mesh.edgeFaces()), Lists({{1, 2}, {0, 2}, {0, 1}}));
+    QCOMPARE(toLists(mesh.faceFaces()), Lists({{0, 1, 2}, {0, 1, 2}, {0, 1, 2}}));
+    QCOMPARE(toLists(mesh.graph()), Lists({{1, 2, 3, 4}, {0, 2, 3, 4}, {0, 1}, {0, 1}, {0, 1}}));
+
+    const Core::EdgeTable& edges = mesh.edgeTable();
+    for (Core::EdgeTable::HalfEdgeIndex h = 0; h < 9; h++)
+        QCOMPARE(edges.twin(h), Core::EdgeTable::NO_TWIN);
+}
+
+void TestMesh::test_chew_threads_data()
+{
+    QTest::addColumn<int>("threads");
+    QTest::newRow("2 threads") << 2;
+    QTest::newRow("4 threads") << 4;
+    QTest::newRow("8 threads") << 8;
+}
+
+// chewing on several threads gives the same flat arrays as a serial run
+void TestMesh::test_chew_threads()
+{
+    QFETCH(int, threads);
+
+    Core::Mesh base;
+    makeGrid(base, 160);
+
+    Core::setMaxThreads(1);
+    Core::Mesh serial;
+    serial.points = base.points;
+    serial.faces = base.faces;
+    serial.chew(Core::Mesh::CHEW_GRAPH);
+
+    Core::setMaxThreads(threads);
+    QVERIFY(Core::rangeCount(base.faces.size()) > 1);
+    Core::Mesh parallel;
+    parallel.points = base.points;
+    parallel.faces = base.faces;
+    parallel.chew(Core::Mesh::CHEW_GRAPH);
+
+    QCOMPARE(parallel.graph().rawOffsets(), serial.graph().rawOffsets());
+    QCOMPARE(parallel.graph().rawValues(), serial.graph().rawValues());
+    QCOMPARE(parallel.pointFaces().rawOffsets(), serial.pointFaces().rawOffsets());
+    QCOMPARE(parallel.pointFaces().rawValues(), serial.pointFaces().rawValues());
+    QCOMPARE(parallel.faceFaces().rawOffsets(), serial.faceFaces().rawOffsets());
+    QCOMPARE(parallel.faceFaces().rawValues(), serial.faceFaces().rawValues());
+    QCOMPARE(parallel.edgeFaces().rawOffsets(), serial.edgeFaces().rawOffsets());
+    QCOMPARE(parallel.edgeFaces().rawValues(), serial.edgeFaces().rawValues());
+}
+
+// a chewed and an unchewed part come back as they went in. Adjacency that wasn't stored is built on demand.
+void TestMesh::test_cache_round_trip()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    Core::Mesh strip;
+    makeStrip(strip);
+    strip.generateMetrics();
+    strip.chew(Core::Mesh::CHEW_GRAPH);
+    Core::Mesh tetrahedron;
+    makeTetrahedron(tetrahedron);
+    tetrahedron.generateMetrics();
+
+    const quint64 key = 0x1234;
+    Utils::MeshCache cache(directory.path());
+    QVERIFY2(cache.store(key, {&strip, &tetrahedron}), qPrintable(cache.errorString()));
+    QVERIFY(!cache.open(key + 1));
+    QVERIFY2(cache.open(key), qPrintable(cache.errorString()));
+    QCOMPARE(cache.partCount(), 2);
+
+    const Core::Mesh* originals[2] = {&strip, &tetrahedron};
+    for (int part_i = 0; part_i < 2; part_i++)
+    {
+        const Core::Mesh& original = *originals[part_i];
+        Core::Mesh restored;
+        QVERIFY(cache.readPart(part_i, restored));
+
+        QCOMPARE(restored.points, original.points);
+        QCOMPARE(restored.normals, original.normals);
+        QCOMPARE(restored.faces.size(), original.faces.size());
+        for (int face_i = 0; face_i < original.faces.size(); face_i++)
+        {
+            for (int corner = 0; corner < 3; corner++)
+                QCOMPARE(restored.faces[face_i].points[corner], original.faces[face_i].points[corner]);
+        }
+        QCOMPARE(restored.minPoint, original.minPoint);
+        QCOMPARE(restored.maxPoint, original.maxPoint);
+
+        QCOMPARE(toLists(restored.graph()), toLists(original.graph()));
+        QCOMPARE(toLists(restored.pointFaces()), toLists(original.pointFaces()));
+        QCOMPARE(toLists(restored.faceFaces()), toLists(original.faceFaces()));
+        QCOMPARE(toLists(restored.edgeFaces()), toLists(original.edgeFaces()));
+    }
+    cache.close();
+}
+
+QTEST_APPLESS_MAIN(TestMesh)
+
+#include "tst_testmesh.moc"
@@ -0,0 +1,679 @@
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "stl_reader.h"
+
+// a triangle soup as produced by stl_reader::ReadStlFileSoup
+struct Soup
+{
+    std::vector<float> coords;
+    std::vector<float> normals;
+    std::vector<unsigned int> solidRanges;
+};
+
+// bit patterns of floats, so that comparisons tell -0 from +0
+static std::vector<quint32> bits(const std::vector<float>& values)
+{
+    std::vector<quint32> result(values.size());
+    if (!values.empty())
+        memcpy(result.data(), values.data(), values.size() * sizeof(float));
+    return result;
+}
+
+static quint64 bits(double value)
+{
+    quint64 result;
+    memcpy(&result, &value, sizeof(value));
+    return result;
+}
+
+// the former istringstream based ASCII reader, reduced to the soup of the triangles it read
+static Soup readSoupReference(const std::string& text)
+{
+    Soup soup;
+    std::istringstream in(text);
+    std::string buffer;
+    std::vector<float> vertices;
+    float normal[3] = {0, 0, 0};
+
+    while (!(in.eof() || in.fail()))
+    {
+        std::getline(in, buffer);
+        std::istringstream line(buffer);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (line >> token)
+            tokens.push_back(token);
+        if (tokens.empty())
+            continue;
+
+        if (tokens[0] == "vertex")
+        {
+            for (int i = 1; i < 4; i++)
+                vertices.push_back(static_cast<float>(atof(tokens[i].c_str())));
+        }
+        else if (tokens[0] == "facet")
+        {
+            for (int i = 0; i < 3; i++)
+                normal[i] = static_cast<float>(atof(tokens[i + 2].c_str()));
+        }
+        else if (tokens[0] == "endfacet")
+        {
+            soup.coords.insert(soup.coords.end(), vertices.end() - 9, vertices.end());
+            soup.normals.insert(soup.normals.end(), normal, normal + 3);
+        }
+        else if (tokens[0] == "solid")
+        {
+            soup.solidRanges.push_back(static_cast<unsigned int>(soup.normals.size() / 3));
+        }
+    }
+    soup.solidRanges.push_back(static_cast<unsigned int>(soup.normals.size() / 3));
+    return soup;
+}
+
+// numbers as they are written by various exporters, and some which aren't
+static const char* const numberTokens[] = {
+    "0", "-0", "+0.0", "1", "-1", "+1.5", "3.", ".5", "-.5e1", "0.000000",
+    "1e3", "-2.5E-4", "1.0e+10", "+12.5E+02", "1e-30", "-7.25e-45", "1e22", "1e23", "4.2e38",
+    "1.000000e+000", "-9.876543e-001", "0.1", "0.2", "0.3", "123.456", "-98765.4321",
+    "9007199254740993", "123456789012345", "1234567890123456", "12345678901234567890",
+    "123456789012345678901234567890", "0.1000000000000000055511151231257827",
+    "3.14159265358979323846264338327950288419716939937510",
+    "0.00000000000000000000000000000000000000001401298464324817",
+    "1e", "2.5e+", "-e5", ".", "-", "1.5abc", "0x1p3", "inf", "-INF",
+};
+
+// a long mantissa which doesn't fit into the parser's buffer
+static std::string longNumber()
+{
+    std::string number = "-1.";
+    for (int i = 0; i < 200; i++)
+        number += char('0' + (i * 7) % 10);
+    return number + "e-150";
+}
+
+// the i-th number of a file, cycling through several notations
+static std::string fileNumber(int i)
+{
+    const int tokenCount = sizeof(numberTokens) / sizeof(numberTokens[0]);
+    const double value = ((i % 20011) * 7919 % 20011 - 10005) / 97.0;
+    char buffer[128];
+    switch (i % 7)
+    {
+        case 0: snprintf(buffer, sizeof(buffer), "%.9g", value); break;
+        case 1: snprintf(buffer, sizeof(buffer), "%E", value); break;
+        case 2: snprintf(buffer, sizeof(buffer), "%+.4e", value); break;
+        case 3: snprintf(buffer, sizeof(buffer), "%.30f", value); break;
+        case 4: snprintf(buffer, sizeof(buffer), "%.17g", value); break;
+        case 5: snprintf(buffer, sizeof(buffer), "%f", value); break;
+        default: return numberTokens[(i / 7) % tokenCount];
+    }
+    return buffer;
+}
+
+// an ASCII stl file with solidCount solids of facetCount facets each
+static std::string makeAsciiStl(int solidCount, int facetCount, const char* newline)
+{
+    std::string text;
+    int number_i = 0;
+    for (int solid_i = 0; solid_i < solidCount; solid_i++)
+    {
+        text += "solid part" + std::to_string(solid_i) + newline;
+        for (int facet_i = 0; facet_i < facetCount; facet_i++)
+        {
+            const char* indent = (facet_i % 3 == 0) ? "\t" : "  ";
+            text += std::string(indent) + "facet normal";
+            for (int i = 0; i < 3; i++)
+                text += " " + fileNumber(number_i++);
+            text += newline;
+            text += std::string(indent) + "  outer loop" + newline;
+            for (int corner = 0; corner < 3; corner++)
+            {
+                text += std::string(indent) + "    vertex";
+                for (int i = 0; i < 3; i++)
+                    text += ((i + facet_i) % 4 == 0 ? "\t " : " ") + fileNumber(number_i++);
+                text += newline;
+            }
+            text += std::string(indent) + "  endloop" + newline;
+            text += std::string(indent) + "endfacet" + newline;
+        }
+        text += "endsolid part" + std::to_string(solid_i) + newline;
+    }
+    return text;
+}
+
+static bool writeFile(const QString& path, const std::string& text)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly)
+           && file.write(text.data(), text.size()) == qint64(text.size());
+}
+
+// the output of stl_reader::WeldStlSoup
+struct Welded
+{
+    std::vector<float> coords;
+    std::vector<float> normals;
+    std::vector<unsigned int> tris;
+    std::vector<unsigned int> solidRanges;
+};
+
+static Welded weld(const Soup& soup, double tolerance = 0, size_t* mergedPoints = NULL)
+{
+    Welded welded;
+    welded.normals = soup.normals;
+    welded.solidRanges = soup.solidRanges;
+    stl_reader::WeldStlSoup(soup.coords, welded.coords, welded.normals, welded.tris, welded.solidRanges, tolerance,
+                            mergedPoints);
+    return welded;
+}
+
+typedef std::array<float, 3> Coord;
+
+// the former sort based weld: unique coordinates in lexicographic order, degenerated
+// triangles removed together with their normals
+static Welded weldReference(const Soup& soup)
+{
+    const size_t cornerCount = soup.coords.size() / 3;
+    std::vector<std::pair<Coord, unsigned int>> sorted(cornerCount);
+    for (size_t corner = 0; corner < cornerCount; corner++)
+    {
+        sorted[corner].first = {soup.coords[corner * 3], soup.coords[corner * 3 + 1], soup.coords[corner * 3 + 2]};
+        sorted[corner].second = static_cast<unsigned int>(corner);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    Welded welded;
+    std::vector<unsigned int> newIndex(cornerCount);
+    for (size_t i = 0; i < cornerCount; i++)
+    {
+        if (i == 0 || sorted[i].first != sorted[i - 1].first)
+            welded.coords.insert(welded.coords.end(), sorted[i].first.begin(), sorted[i].first.end());
+        newIndex[sorted[i].second] = static_cast<unsigned int>(welded.coords.size() / 3 - 1);
+    }
+
+    size_t solid_i = 0;
+    for (size_t face_i = 0; face_i < cornerCount / 3; face_i++)
+    {
+        while (solid_i < soup.solidRanges.size() && soup.solidRanges[solid_i] <= face_i)
+        {
+            welded.solidRanges.push_back(static_cast<unsigned int>(welded.tris.size() / 3));
+            solid_i++;
+        }
+        const unsigned int t[3] = {newIndex[face_i * 3], newIndex[face_i * 3 + 1], newIndex[face_i * 3 + 2]};
+        if (t[0] != t[1] && t[0] != t[2] && t[1] != t[2])
+        {
+            welded.tris.insert(welded.tris.end(), t, t + 3);
+            welded.normals.insert(welded.normals.end(), &soup.normals[face_i * 3], &soup.normals[face_i * 3 + 3]);
+        }
+    }
+    while (solid_i++ < soup.solidRanges.size())
+        welded.solidRanges.push_back(static_cast<unsigned int>(welded.tris.size() / 3));
+    return welded;
+}
+
+// sorted unique points and the corner coordinates of each triangle, which don't
+// depend on how the points are numbered
+static std::vector<Coord> sortedPoints(const Welded& welded)
+{
+    std::vector<Coord> points(welded.coords.size() / 3);
+    for (size_t point_i = 0; point_i < points.size(); point_i++)
+        points[point_i] = {welded.coords[point_i * 3], welded.coords[point_i * 3 + 1], welded.coords[point_i * 3 + 2]};
+    std::sort(points.begin(), points.end());
+    return points;
+}
+
+static std::vector<Coord> triangleCorners(const Welded& welded)
+{
+    std::vector<Coord> corners;
+    for (unsigned int point_i : welded.tris)
+        corners.push_back({welded.coords[point_i * 3], welded.coords[point_i * 3 + 1], welded.coords[point_i * 3 + 2]});
+    return corners;
+}
+
+// a soup of side x side squares of two triangles each, split into three solids. Zero
+// coordinates are written as -0 by some triangles and as +0 by others, and some
+// triangles degenerate when welded. The normal of each triangle holds its index.
+static Soup makeGridSoup(int side)
+{
+    Soup soup;
+    const float half = side / 2;
+    int face_i = 0;
+    auto corner = [&](int x, int y) {
+        const bool negativeZero = (face_i % 5 == 0);
+        const float cx = (x - half) * 0.25f;
+        const float cy = (y - half) * 0.125f;
+        soup.coords.push_back(cx == 0 && negativeZero ? -0.0f : cx);
+        soup.coords.push_back(cy == 0 && negativeZero ? -0.0f : cy);
+        soup.coords.push_back(negativeZero ? -0.0f : 0.0f);
+    };
+    auto face = [&](int x0, int y0, int x1, int y1, int x2, int y2) {
+        if (face_i % 37 == 0)
+        {
+            x2 = x1;
+            y2 = y1;
+        }
+        corner(x0, y0);
+        corner(x1, y1);
+        corner(x2, y2);
+        soup.normals.push_back(float(face_i));
+        soup.normals.push_back(0);
+        soup.normals.push_back(1);
+        face_i++;
+    };
+
+    for (int y = 0; y < side; y++)
+    {
+        if (y % (side / 3 + 1) == 0)
+            soup.solidRanges.push_back(static_cast<unsigned int>(face_i));
+        for (int x = 0; x < side; x++)
+        {
+            face(x, y, x + 1, y, x + 1, y + 1);
+            face(x, y, x + 1, y + 1, x, y + 1);
+        }
+    }
+    soup.solidRanges.push_back(static_cast<unsigned int>(face_i));
+    return soup;
+}
+
+// welds triangles which each have one corner at one of the given points and two corners
+// far away from everything else. Returns the vertex of each point, numbered in order
+// of the points.
+static std::vector<unsigned int> weldPoints(const std::vector<Coord>& points, double tolerance, size_t* mergedPoints)
+{
+    Soup soup;
+    for (size_t point_i = 0; point_i < points.size(); point_i++)
+    {
+        const float far = 1000 + 10 * float(point_i);
+        const Coord corners[3] = {points[point_i], {far, -far, far}, {far, far, -far}};
+        for (const Coord& corner : corners)
+            soup.coords.insert(soup.coords.end(), corner.begin(), corner.end());
+        soup.normals.insert(soup.normals.end(), {0, 0, 1});
+    }
+    soup.solidRanges = {0, static_cast<unsigned int>(points.size())};
+
+    const Welded welded = weld(soup, tolerance, mergedPoints);
+    std::map<unsigned int, unsigned int> numbers;
+    std::vector<unsigned int> vertices;
+    for (size_t face_i = 0; face_i < welded.tris.size() / 3; face_i++)
+    {
+        const unsigned int number = static_cast<unsigned int>(numbers.size());
+        vertices.push_back(numbers.insert({welded.tris[face_i * 3], number}).first->second);
+    }
+    return vertices;
+}
+
+// a soup of side x side squares of two triangles each on the integer lattice, whose
+// corners are moved by up to 1/16 per axis, differently for each triangle. The copies
+// of a lattice point are within 0.25 of each other and straddle cell borders.
+static Soup makeJitteredSoup(int side)
+{
+    static const float jitter[] = {-0.0625f, -0.03125f, 0, 0.03125f, 0.0625f};
+    Soup soup;
+    unsigned int seed = 1;
+    auto corner = [&](int x, int y) {
+        const float c[3] = {float(x - side / 2), float(y - side / 2), 0};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            soup.coords.push_back(c[axis] + jitter[(seed >> 16) % 5]);
+        }
+    };
+    for (int y = 0; y < side; y++)
+    {
+        for (int x = 0; x < side; x++)
+        {
+            corner(x, y); corner(x + 1, y); corner(x + 1, y + 1);
+            corner(x, y); corner(x + 1, y + 1); corner(x, y + 1);
+            soup.normals.insert(soup.normals.end(), {0, 0, 1, 0, 0, 1});
+        }
+    }
+    soup.solidRanges = {0, static_cast<unsigned int>(soup.normals.size() / 3)};
+    return soup;
+}
+
+class TestReader : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+    void test_parse_number();
+    void test_ascii_soup();
+    void test_ascii_chunk_boundaries();
+    void test_ascii_threads();
+    void test_weld_reference_data();
+    void test_weld_reference();
+    void test_weld_threads();
+    void test_weld_tolerant_borders();
+    void test_weld_tolerant_lattice();
+    void test_cancel();
+};
+
+void TestReader::cleanup()
+{
+    stl_reader::SetMaxWorkerThreads(0);
+}
+
+// the fast path and the strtod fallback give what atof gave, to the bit
+void TestReader::test_parse_number()
+{
+    std::vector<std::string> tokens(std::begin(numberTokens), std::end(numberTokens));
+    tokens.push_back(longNumber());
+    for (int i = 0; i < 2000; i++)
+        tokens.push_back(fileNumber(i));
+
+    for (const std::string& token : tokens)
+    {
+        const double parsed = stl_reader::stl_reader_impl::ParseNumber(token.data(), token.data() + token.size());
+        QVERIFY2(bits(parsed) == bits(atof(token.c_str())), token.c_str());
+    }
+
+//  only the token is parsed, not the text behind it
+    const char text[] = "12.5e2 7";
+    QCOMPARE(stl_reader::stl_reader_impl::ParseNumber(text, text + 4), 12.5);
+}
+
+// whole files, with several solids and both kinds of line ends
+void TestReader::test_ascii_soup()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    const char* newlines[] = {"\n", "\r\n"};
+    for (const char* newline : newlines)
+    {
+        const std::string text = makeAsciiStl(3, 40, newline);
+        const QString path = directory.filePath("soup.stl");
+        QVERIFY(writeFile(path, text));
+
+        Soup soup;
+        QVERIFY(stl_reader::ReadStlFileSoup(QFile::encodeName(path).constData(), soup.coords, soup.normals,
+                                            soup.solidRanges));
+
+        const Soup reference = readSoupReference(text);
+        QCOMPARE(soup.normals.size(), size_t(3 * 40 * 3));
+        QCOMPARE(bits(soup.coords), bits(reference.coords));
+        QCOMPARE(bits(soup.normals), bits(reference.normals));
+        QCOMPARE(soup.solidRanges, std::vector<unsigned int>({0, 40, 80, 120}));
+        QCOMPARE(soup.solidRanges, reference.solidRanges);
+    }
+}
+
+// splitting at any byte, including those inside facets, moves the split to the next
+// facet line, and the joined chunks are the same as the file parsed in one piece
+void TestReader::test_ascii_chunk_boundaries()
+{
+    using namespace stl_reader::stl_reader_impl;
+    typedef AsciiChunk<float, unsigned int> Chunk;
+
+    const std::string text = makeAsciiStl(2, 3, "\r\n");
+    const Soup reference = readSoupReference(text);
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+
+    for (size_t offset = 0; offset <= text.size(); offset++)
+    {
+        const char* split = FindFacetLine(begin, begin + offset, end);
+        QVERIFY(split == end || split == begin || split[-1] == '\n');
+
+        Chunk chunks[2];
+        QVERIFY(ParseAsciiChunk("chunks.stl", begin, begin, split, chunks[0], stl_reader::CancelCheck()));
+        QVERIFY(ParseAsciiChunk("chunks.stl", begin, split, end, chunks[1], stl_reader::CancelCheck()));
+
+        Soup soup;
+        for (const Chunk& chunk : chunks)
+        {
+            const unsigned int triOffset = static_cast<unsigned int>(soup.normals.size() / 3);
+            soup.coords.insert(soup.coords.end(), chunk.coords.begin(), chunk.coords.end());
+            soup.normals.insert(soup.normals.end(), chunk.normals.begin(), chunk.normals.end());
+            for (unsigned int solidBegin : chunk.solidBegins)
+                soup.solidRanges.push_back(triOffset + solidBegin);
+        }
+        soup.solidRanges.push_back(static_cast<unsigned int>(soup.normals.size() / 3));
+
+        QCOMPARE(bits(soup.coords), bits(reference.coords));
+        QCOMPARE(bits(soup.normals), bits(reference.normals));
+        QCOMPARE(soup.solidRanges, reference.solidRanges);
+    }
+}
+
+// a file large enough to be split into chunks gives the same soup on one and on all threads
+void TestReader::test_ascii_threads()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    const std::string text = makeAsciiStl(4, 12000, "\n");
+    QVERIFY(text.size() > 3 * (4 << 20));
+    const QString path = directory.filePath("large.stl");
+    QVERIFY(writeFile(path, text));
+    const QByteArray filename = QFile::encodeName(path);
+
+    stl_reader::SetMaxWorkerThreads(1);
+    Soup serial;
+    QVERIFY(stl_reader::ReadStlFileSoup_ASCII(filename.constData(), serial.coords, serial.normals, serial.solidRanges));
+
+    stl_reader::SetMaxWorkerThreads(0);
+    Soup parallel;
+    QVERIFY(stl_reader::ReadStlFileSoup_ASCII(filename.constData(), parallel.coords, parallel.normals,
+                                              parallel.solidRanges));
+
+    const Soup reference = readSoupReference(text);
+    QCOMPARE(bits(serial.coords), bits(reference.coords));
+    QCOMPARE(bits(serial.normals), bits(reference.normals));
+    QCOMPARE(serial.solidRanges, reference.solidRanges);
+    QCOMPARE(bits(parallel.coords), bits(reference.coords));
+    QCOMPARE(bits(parallel.normals), bits(reference.normals));
+    QCOMPARE(parallel.solidRanges, reference.solidRanges);
+}
+
+void TestReader::test_weld_reference_data()
+{
+    QTest::addColumn<int>("side");
+    QTest::newRow("one partition") << 20;
+    QTest::newRow("several partitions") << 200;
+}
+
+// the hash weld finds the same points and triangles as the former sort based one,
+// only numbered in order of their first occurrence
+void TestReader::test_weld_reference()
+{
+    QFETCH(int, side);
+
+    const Soup soup = makeGridSoup(side);
+    const Welded welded = weld(soup);
+    const Welded reference = weldReference(soup);
+
+    QCOMPARE(welded.coords.size(), size_t((side + 1) * (side + 1) * 3));
+    QCOMPARE(welded.coords.size(), reference.coords.size());
+    QVERIFY(welded.tris.size() < soup.coords.size() / 3);
+    QCOMPARE(sortedPoints(welded), sortedPoints(reference));
+    QCOMPARE(triangleCorners(welded), triangleCorners(reference));
+    QCOMPARE(bits(welded.normals), bits(reference.normals));
+    QCOMPARE(welded.solidRanges, reference.solidRanges);
+
+//  each point is the first of its corners in the soup, degenerated triangles included
+    std::set<Coord> seen;
+    std::vector<float> firstCorners;
+    for (size_t corner = 0; corner < soup.coords.size() / 3; corner++)
+    {
+        const float* c = &soup.coords[corner * 3];
+        if (seen.insert({c[0], c[1], c[2]}).second)
+            firstCorners.insert(firstCorners.end(), c, c + 3);
+    }
+    QCOMPARE(bits(welded.coords), bits(firstCorners));
+}
+
+// welding on one and on all threads gives the same arrays
+void TestReader::test_weld_threads()
+{
+    const Soup soup = makeGridSoup(300);
+
+    stl_reader::SetMaxWorkerThreads(1);
+    const Welded serial = weld(soup);
+    stl_reader::SetMaxWorkerThreads(0);
+    const Welded parallel = weld(soup);
+
+    QCOMPARE(bits(parallel.coords), bits(serial.coords));
+    QCOMPARE(parallel.tris, serial.tris);
+    QCOMPARE(bits(parallel.normals), bits(serial.normals));
+    QCOMPARE(parallel.solidRanges, serial.solidRanges);
+}
+
+// with a tolerance of 0.25 the grid cells are 1 wide and neighbour cells are searched
+// within 0.3 of a border. Corners at most the tolerance apart are merged across all of them.
+void TestReader::test_weld_tolerant_borders()
+{
+    struct Case
+    {
+        const char* name;
+        std::vector<Coord> points;
+        std::vector<unsigned int> vertices;
+        size_t mergedPoints;
+    };
+    const Case cases[] = {
+        {"x border, at the tolerance", {{0.875f, 0.5f, 0.5f}, {1.125f, 0.5f, 0.5f}}, {0, 0}, 1},
+        {"x border, beyond the tolerance", {{0.875f, 0.5f, 0.5f}, {1.1875f, 0.5f, 0.5f}}, {0, 1}, 0},
+        {"y border", {{0.5f, 0.8125f, 0.5f}, {0.5f, 1.0f, 0.5f}}, {0, 0}, 1},
+        {"z border at 0", {{0.5f, 0.5f, -0.125f}, {0.5f, 0.5f, 0.0625f}}, {0, 0}, 1},
+        {"cell corner", {{0.9375f, 0.9375f, 0.9375f}, {1.0625f, 1.0625f, 1.0625f}}, {0, 0}, 1},
+        {"cell corner, beyond the tolerance", {{0.875f, 0.875f, 0.875f}, {1.125f, 1.125f, 1.125f}}, {0, 1}, 0},
+        {"inner margins of a cell", {{0.28125f, 0.5f, 0.5f}, {0.71875f, 0.5f, 0.5f}}, {0, 1}, 0},
+        {"later corner first", {{-1.0625f, 0.5f, 0.5f}, {-0.9375f, 0.5f, 0.5f}, {-0.8125f, 0.5f, 0.5f}}, {0, 0, 0}, 2},
+        {"chain over a border", {{3.625f, 0, 0}, {3.8125f, 0, 0}, {4.0f, 0, 0}, {4.1875f, 0, 0}}, {0, 0, 0, 0}, 3},
+        {"equal corners", {{5.5f, 5.5f, 5.5f}, {5.6875f, 5.5f, 5.5f}, {5.5f, 5.5f, 5.5f}}, {0, 0, 0}, 1},
+        {"far from the origin", {{-1000.875f, 7.0f, 0}, {-1001.125f, 7.0f, 0}, {-1001.5f, 7.0f, 0}}, {0, 0, 1}, 1},
+    };
+
+    for (const Case& c : cases)
+    {
+        size_t mergedPoints = 0;
+        const std::vector<unsigned int> vertices = weldPoints(c.points, 0.25, &mergedPoints);
+        QVERIFY2(vertices == c.vertices, c.name);
+        QVERIFY2(mergedPoints == c.mergedPoints, c.name);
+    }
+
+//  all cases at once, far enough apart not to interact
+    std::vector<Coord> points;
+    size_t mergedPoints = 0;
+    for (size_t case_i = 0; case_i < sizeof(cases) / sizeof(cases[0]); case_i++)
+    {
+        mergedPoints += cases[case_i].mergedPoints;
+        for (Coord point : cases[case_i].points)
+        {
+            point[1] += 16 * float(case_i);
+            points.push_back(point);
+        }
+    }
+    size_t allMergedPoints = 0;
+    weldPoints(points, 0.25, &allMergedPoints);
+    QCOMPARE(allMergedPoints, mergedPoints);
+}
+
+// every lattice point becomes one vertex, on one and on all threads
+void TestReader::test_weld_tolerant_lattice()
+{
+    const int side = 200;
+    const Soup soup = makeJitteredSoup(side);
+
+    std::set<Coord> distinct;
+    for (size_t corner = 0; corner < soup.coords.size() / 3; corner++)
+        distinct.insert({soup.coords[corner * 3], soup.coords[corner * 3 + 1], soup.coords[corner * 3 + 2]});
+    const size_t latticePoints = size_t(side + 1) * (side + 1);
+    QVERIFY(distinct.size() > 2 * latticePoints);
+
+    stl_reader::SetMaxWorkerThreads(1);
+    size_t serialMerged = 0;
+    const Welded serial = weld(soup, 0.25, &serialMerged);
+    stl_reader::SetMaxWorkerThreads(0);
+    size_t parallelMerged = 0;
+    const Welded parallel = weld(soup, 0.25, &parallelMerged);
+
+    QCOMPARE(serial.coords.size(), latticePoints * 3);
+    QCOMPARE(serial.tris.size(), soup.coords.size() / 3);
+    QCOMPARE(serialMerged, distinct.size() - latticePoints);
+    for (size_t point_i = 0; point_i < latticePoints; point_i++)
+    {
+        QVERIFY(std::abs(serial.coords[point_i * 3] - std::round(serial.coords[point_i * 3])) <= 0.0625f);
+        QVERIFY(std::abs(serial.coords[point_i * 3 + 1] - std::round(serial.coords[point_i * 3 + 1])) <= 0.0625f);
+    }
+
+    QCOMPARE(parallelMerged, serialMerged);
+    QCOMPARE(bits(parallel.coords), bits(serial.coords));
+    QCOMPARE(parallel.tris, serial.tris);
+    QCOMPARE(bits(parallel.normals), bits(serial.normals));
+    QCOMPARE(parallel.solidRanges, serial.solidRanges);
+}
+
+// reading and welding stop once the check tells them to. Without a check, or with one
+// which doesn't fire, they run to the end.
+void TestReader::test_cancel()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    const std::string ascii = makeAsciiStl(1, 12000, "\n");
+    const QString asciiPath = directory.filePath("ascii.stl");
+    QVERIFY(writeFile(asciiPath, ascii));
+
+    const Soup grid = makeGridSoup(300);
+    std::string binary(84 + 50 * grid.normals.size() / 3, '\0');
+    const quint32 triangleCount = quint32(grid.normals.size() / 3);
+    memcpy(&binary[80], &triangleCount, 4);
+    for (size_t face_i = 0; face_i < triangleCount; face_i++)
+    {
+        memcpy(&binary[84 + 50 * face_i], &grid.normals[face_i * 3], 12);
+        memcpy(&binary[84 + 50 * face_i + 12], &grid.coords[face_i * 9], 36);
+    }
+    const QString binaryPath = directory.filePath("binary.stl");
+    QVERIFY(writeFile(binaryPath, binary));
+
+    std::atomic<int> checks(0);
+    const stl_reader::CancelCheck never = [&checks]() { checks++; return false; };
+    const stl_reader::CancelCheck always = []() { return true; };
+
+    const std::pair<QString, size_t> files[] = {{asciiPath, 12000 * 9}, {binaryPath, grid.coords.size()}};
+    for (const std::pair<QString, size_t>& file : files)
+    {
+        const QByteArray filename = QFile::encodeName(file.first);
+        Soup soup;
+        QVERIFY(!stl_reader::ReadStlFileSoup(filename.constData(), soup.coords, soup.normals, soup.solidRanges, always));
+        checks = 0;
+        QVERIFY(stl_reader::ReadStlFileSoup(filename.constData(), soup.coords, soup.normals, soup.solidRanges, never));
+        QVERIFY(checks > 0);
+        QCOMPARE(soup.coords.size(), file.second);
+    }
+
+    for (double tolerance : {0.0, 0.25})
+    {
+        Welded welded;
+        welded.normals = grid.normals;
+        welded.solidRanges = grid.solidRanges;
+        QVERIFY(!stl_reader::WeldStlSoup(grid.coords, welded.coords, welded.normals, welded.tris, welded.solidRanges,
+                                         tolerance, NULL, always));
+
+        welded.normals = grid.normals;
+        welded.solidRanges = grid.solidRanges;
+        checks = 0;
+        QVERIFY(stl_reader::WeldStlSoup(grid.coords, welded.coords, welded.normals, welded.tris, welded.solidRanges,
+                                        tolerance, NULL, never));
+        QVERIFY(checks > 0);
+        QCOMPARE(welded.tris, weld(grid, tolerance).tris);
+    }
+}
+
+QTEST_APPLESS_MAIN(TestReader)
+
+#include "tst_testreader.moc"